@@ -0,0 +1,577 @@
+// Microbenchmarks for the MIDI hot paths, built against the TinyUSB stand-in
+// so that they can be run (and compared between changes) on a Linux host.
+//
+// Usage: launchpad-bench [iterations]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "tusb.h"
+#include "tusb_stub.h"
+
+#include "client_packets.h"
+#include "host_events.h"
+#include "launchpad.h"
+#include "paint_scheduler.h"
+#include "tonnetz.h"
+
+#define DEFAULT_ITERATIONS 20000
+
+typedef void (*paint_fn)(struct board_state*);
+typedef void (*process_fn)(uint8_t*, struct board_state*, const struct launchpad_sink*);
+
+// The same starting point as the firmware.
+static void reset_board_state(struct board_state *board_state) {
+  memset(board_state, 0, sizeof(*board_state));
+
+  board_state->is_dirty = true;
+
+  for (int a = 0; a < 3; a++) {
+    board_state->client.offset_by_cable[a] = 45;
+  }
+
+  for (int idx = 0; idx < MAX_HOST_LAUNCHPADS; idx++) {
+    board_state->host_by_idx[idx].offset = 45;
+  }
+
+  board_state->host_by_idx[0].launchpad_version = MK3;
+
+  velocity_curves_init(&board_state->velocity_curves);
+  layout_init(&board_state->layout);
+  aftertouch_init(&board_state->aftertouch);
+  mpe_init(&board_state->mpe);
+  chords_init(&board_state->chords);
+  sustain_init(&board_state->sustain);
+  arpeggiator_init(&board_state->arpeggiator);
+
+  client_packets_reset();
+}
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ((uint64_t) ts.tv_sec * 1000000000ull) + ts.tv_nsec;
+}
+
+// The pad numbers each family sends for its 8x8 grid of square pads.
+static uint8_t pad_note(enum LaunchpadVersion version, int row, int column) {
+  if (version == MK1) {
+    return (row * 16) + column;
+  }
+
+  return ((row + 1) * 10) + column + 1;
+}
+
+static uint8_t cable_for_version(enum LaunchpadVersion version) {
+  return profile_for_version(version)->client_cable;
+}
+
+static const char *version_name(enum LaunchpadVersion version) {
+  return version == MK1 ? "mk1" : version == MK2 ? "mk2" : "mk3";
+}
+
+static void make_pad_packet(uint8_t packet[4], enum LaunchpadVersion version, int row, int column, uint8_t velocity) {
+  uint8_t cin = velocity ? MIDI_CIN_NOTE_ON : MIDI_CIN_NOTE_OFF;
+
+  packet[0] = (cable_for_version(version) << 4) | cin;
+  packet[1] = (cin << 4);
+  packet[2] = pad_note(version, row, column);
+  packet[3] = velocity;
+}
+
+static void bench_decode(const char *name, process_fn process, enum LaunchpadVersion version, int iterations) {
+  struct board_state board_state;
+  reset_board_state(&board_state);
+
+  uint8_t packets[128][4];
+  int packet_count = 0;
+
+  // Press and then release every pad.
+  for (int velocity = 100; velocity >= 0; velocity -= 100) {
+    for (int row = 0; row < 8; row++) {
+      for (int column = 0; column < 8; column++) {
+        make_pad_packet(packets[packet_count++], version, row, column, velocity);
+      }
+    }
+  }
+
+  // No queue, the stand-in takes everything.
+  struct launchpad_sink sink = { .host_or_client = CLIENT, .idx = 0, .cable = cable_for_version(version) };
+
+  uint64_t start = now_ns();
+  for (int i = 0; i < iterations; i++) {
+    for (int p = 0; p < packet_count; p++) {
+      process(packets[p], &board_state, &sink);
+    }
+  }
+  uint64_t elapsed = now_ns() - start;
+
+  double events = (double) iterations * packet_count;
+  printf("%-28s %10.1f ns/event\n", name, elapsed / events);
+}
+
+static void invalidate_frames(struct board_state *board_state) {
+  invalidate_client_frames(board_state);
+  invalidate_host_frames(board_state);
+}
+
+// A single client cable, so that the client painters fit paint_fn.
+static void paint_client_launchpad_0(struct board_state *board_state) {
+  paint_client_launchpad(board_state, 0);
+}
+
+static void paint_client_launchpad_1(struct board_state *board_state) {
+  paint_client_launchpad(board_state, 1);
+}
+
+static void paint_client_launchpad_2(struct board_state *board_state) {
+  paint_client_launchpad(board_state, 2);
+}
+
+// The first host Launchpad, as each model.
+static void paint_host_launchpad_0_as(struct board_state *board_state, enum LaunchpadVersion version) {
+  board_state->host_by_idx[0].launchpad_version = version;
+  paint_host_launchpad(board_state, 0);
+}
+
+static void paint_mk1_host_launchpad_0(struct board_state *board_state) {
+  paint_host_launchpad_0_as(board_state, MK1);
+}
+
+static void paint_mk2_host_launchpad_0(struct board_state *board_state) {
+  paint_host_launchpad_0_as(board_state, MK2);
+}
+
+static void paint_mk3_host_launchpad_0(struct board_state *board_state) {
+  paint_host_launchpad_0_as(board_state, MK3);
+}
+
+// A 2x2 wall of MK3s behind a hub, each showing its own part of the tonnetz.
+static void paint_four_host_launchpads(struct board_state *board_state) {
+  static const uint8_t wall_offsets[MAX_HOST_LAUNCHPADS] = { 45, 53, 77, 85 };
+
+  for (int idx = 0; idx < MAX_HOST_LAUNCHPADS; idx++) {
+    board_state->host_by_idx[idx].launchpad_version = MK3;
+    board_state->host_by_idx[idx].offset = wall_offsets[idx];
+    tusb_stub_set_host_mounted(idx, true);
+  }
+
+  paint_host_launchpads(board_state);
+}
+
+// Full repaints (i.e. with nothing shown yet), followed by repaints where
+// nothing has changed.
+static void bench_paint(const char *name, paint_fn paint, int iterations) {
+  struct board_state board_state;
+  reset_board_state(&board_state);
+  tusb_stub_set_host_mounted(0, true);
+
+  // Hold a few notes so that every colour is exercised.
+  board_state.held_note_velocities[60] = 100;
+  board_state.held_note_velocities[64] = 100;
+  board_state.held_note_velocities[67] = 100;
+
+  tusb_stub_reset();
+  invalidate_frames(&board_state);
+  paint(&board_state);
+  client_packets_flush();
+  struct tusb_stub_stats stats = tusb_stub_total_stats();
+
+  uint64_t start = now_ns();
+  for (int i = 0; i < iterations; i++) {
+    invalidate_frames(&board_state);
+    paint(&board_state);
+    client_packets_flush();
+  }
+  uint64_t elapsed = now_ns() - start;
+
+  printf("%-28s %10.1f ns/repaint %6u msgs %6u bytes %6u wire bytes\n",
+    name, (double) elapsed / iterations, stats.messages, stats.bytes, stats.packets * 4);
+
+  tusb_stub_reset();
+  start = now_ns();
+  for (int i = 0; i < iterations; i++) {
+    paint(&board_state);
+    client_packets_flush();
+  }
+  elapsed = now_ns() - start;
+  stats = tusb_stub_total_stats();
+
+  printf("%-28s %10.1f ns/repaint %6u msgs (unchanged)\n",
+    "", (double) elapsed / iterations, stats.messages);
+}
+
+// A full frame, sent either a note per pad or as the model's bulk sysex.
+static void encode_frame(const struct device_profile *profile, bool sysex, struct pad_frame *frame, const struct launchpad_sink *sink) {
+  if (sysex) {
+    paint_frame_sysex(profile, frame, sink);
+  }
+  else {
+    paint_dirty_pads(frame, sink);
+  }
+}
+
+static void bench_frame_encoder(const char *name, enum LaunchpadVersion version, bool sysex, int iterations) {
+  const struct device_profile *profile = profile_for_version(version);
+
+  struct board_state board_state;
+  reset_board_state(&board_state);
+
+  struct pad_frame full_frame = { 0 };
+  for (int pad = 0; pad < 128; pad++) {
+    if (profile->painted_pads[pad >> 5] & (1u << (pad & 31))) {
+      int tuned_note = tuned_note_for_pad(&board_state.layout, profile->cell_for_pad, 45, pad);
+      set_pad_colour(&full_frame, pad, pad_colour_for_note(&board_state, profile->colours, tuned_note));
+    }
+  }
+
+  struct launchpad_sink sink = { .host_or_client = CLIENT, .idx = 0, .cable = profile->client_cable };
+
+  tusb_stub_reset();
+  struct pad_frame frame = full_frame;
+  encode_frame(profile, sysex, &frame, &sink);
+  client_packets_flush();
+  struct tusb_stub_stats stats = tusb_stub_total_stats();
+
+  uint64_t start = now_ns();
+  for (int i = 0; i < iterations; i++) {
+    frame = full_frame;
+    encode_frame(profile, sysex, &frame, &sink);
+    client_packets_flush();
+  }
+  uint64_t elapsed = now_ns() - start;
+
+  printf("%-28s %10.1f ns/frame %6u msgs %6u bytes %6u wire bytes\n",
+    name, (double) elapsed / iterations, stats.messages, stats.bytes, stats.packets * 4);
+}
+
+// Everything sent when the offset of each family moves up a row.
+static void bench_transpose(void) {
+  static struct host_event_queue host_events;
+  struct paint_scheduler paint_scheduler;
+  paint_scheduler_init(&paint_scheduler, 0);
+
+  struct board_state board_state;
+  reset_board_state(&board_state);
+  tusb_stub_set_host_mounted(0, true);
+
+  tonnetz_task(&board_state, &host_events, &paint_scheduler, 0);
+
+  for (int cable = 0; cable < 3; cable++) {
+    board_state.client.offset_by_cable[cable] += 4;
+    board_state.is_dirty = true;
+
+    tusb_stub_reset();
+    repaint_launchpads(&board_state);
+    client_packets_flush();
+    struct tusb_stub_stats stats = tusb_stub_device_stats(cable);
+
+    char name[64];
+    snprintf(name, sizeof(name), "mk%d client transpose", cable + 1);
+    printf("%-28s %6u msgs %6u bytes %6u wire bytes\n",
+      name, stats.messages, stats.bytes, stats.packets * 4);
+  }
+}
+
+static void bench_sync(int iterations) {
+  struct board_state board_state;
+  reset_board_state(&board_state);
+
+  tusb_stub_reset();
+
+  // Idle, i.e. nothing has changed since the last pass.
+  uint64_t start = now_ns();
+  for (int i = 0; i < iterations; i++) {
+    sync_playing_notes(&board_state);
+    client_packets_flush();
+  }
+  uint64_t elapsed = now_ns() - start;
+  printf("%-28s %10.1f ns/call\n", "sync_playing_notes (idle)", (double) elapsed / iterations);
+
+  // A single note toggling on and off each pass.
+  start = now_ns();
+  for (int i = 0; i < iterations; i++) {
+    set_held_note_velocity(&board_state, 60, (i & 1) ? 0 : 100);
+    sync_playing_notes(&board_state);
+    client_packets_flush();
+  }
+  elapsed = now_ns() - start;
+  printf("%-28s %10.1f ns/call\n", "sync_playing_notes (1 note)", (double) elapsed / iterations);
+}
+
+// Host packets pushed through the core1 -> core0 queue and applied in batches,
+// as happens when core0 catches up after a burst.
+static void bench_host_events(int iterations) {
+  static struct host_event_queue host_events;
+  struct board_state board_state;
+  reset_board_state(&board_state);
+
+  struct host_event packet_event = { .type = HOST_EVENT_PACKET };
+
+  uint64_t start = now_ns();
+  for (int i = 0; i < iterations; i++) {
+    for (int p = 0; p < 64; p++) {
+      make_pad_packet(packet_event.packet, MK3, p / 8, p % 8, (i & 1) ? 0 : 100);
+      packet_event.timestamp_us = latency_now_us();
+      host_event_queue_push(&host_events, &packet_event);
+    }
+
+    host_event_task(&board_state, &host_events);
+    sync_playing_notes(&board_state);
+    client_packets_flush();
+  }
+  uint64_t elapsed = now_ns() - start;
+
+  double events = (double) iterations * 64;
+  printf("%-28s %10.1f ns/event %6u high watermark %6u overflows\n",
+    "host_event_queue", elapsed / events, host_events.high_watermark, host_events.overflows);
+
+  static const char *stage_names[LATENCY_STAGE_COUNT] = {
+    "latency: host queue", "latency: note out", "latency: total"
+  };
+
+  for (int stage = 0; stage < LATENCY_STAGE_COUNT; stage++) {
+    const struct latency_histogram *histogram = &board_state.latency.histograms[stage];
+    printf("%-28s %6u us p50 %6u us p99 %6u us max (%u samples)\n",
+      stage_names[stage], latency_percentile(histogram, 50), latency_percentile(histogram, 99),
+      histogram->max_us, histogram->count);
+  }
+}
+
+// Run a full pass of the main loop for a single pad press and release, and
+// count everything that goes out as a result.
+static void bench_pad_press(enum LaunchpadVersion version) {
+  static struct host_event_queue host_events;
+  struct paint_scheduler paint_scheduler;
+  paint_scheduler_init(&paint_scheduler, 0);
+
+  struct board_state board_state;
+  reset_board_state(&board_state);
+  tusb_stub_set_host_mounted(0, true);
+
+  // Settle, i.e. paint everything once.
+  tonnetz_task(&board_state, &host_events, &paint_scheduler, 0);
+
+  const char *labels[2] = { "press", "release" };
+  uint8_t velocities[2] = { 100, 0 };
+
+  for (int a = 0; a < 2; a++) {
+    uint8_t packet[4];
+    make_pad_packet(packet, version, 3, 3, velocities[a]);
+
+    tusb_stub_reset();
+    tusb_stub_queue_device_packet(packet);
+    tonnetz_task(&board_state, &host_events, &paint_scheduler, 0);
+
+    struct tusb_stub_stats stats = tusb_stub_total_stats();
+    struct tusb_stub_stats notes = tusb_stub_device_stats(3);
+
+    char name[64];
+    snprintf(name, sizeof(name), "%s pad %s", version_name(version), labels[a]);
+    printf("%-28s %6u msgs %6u bytes %6u wire bytes (%u note msgs)\n",
+      name, stats.messages, stats.bytes, stats.packets * 4, notes.messages);
+  }
+}
+
+// A fast run across a row of pads, one press or release per millisecond, with
+// and without a frame interval.
+static void bench_coalescing(const char *name, uint32_t frame_interval_us) {
+  static struct host_event_queue host_events;
+  struct paint_scheduler paint_scheduler;
+  paint_scheduler_init(&paint_scheduler, frame_interval_us);
+
+  struct board_state board_state;
+  reset_board_state(&board_state);
+  tusb_stub_set_host_mounted(0, true);
+
+  uint64_t now_us = 0;
+  tonnetz_task(&board_state, &host_events, &paint_scheduler, now_us);
+
+  paint_scheduler_init(&paint_scheduler, frame_interval_us);
+  tusb_stub_reset();
+
+  for (int step = 0; step < 64; step++) {
+    uint8_t packet[4];
+    make_pad_packet(packet, MK3, step / 8 % 2 ? 3 : 4, step % 8, (step / 16) % 2 ? 0 : 100);
+    tusb_stub_queue_device_packet(packet);
+
+    now_us += 1000;
+    tonnetz_task(&board_state, &host_events, &paint_scheduler, now_us);
+  }
+
+  // Let anything still waiting go out.
+  for (int a = 0; a < 4; a++) {
+    now_us += frame_interval_us;
+    tonnetz_task(&board_state, &host_events, &paint_scheduler, now_us);
+  }
+
+  struct tusb_stub_stats stats = tusb_stub_total_stats();
+  struct tusb_stub_stats notes = tusb_stub_device_stats(3);
+
+  printf("%-28s %6u frames %6u merged %6u skipped %6u msgs %6u wire bytes (%u note msgs)\n",
+    name, paint_scheduler.frames_painted, paint_scheduler.frames_merged, paint_scheduler.frames_skipped,
+    stats.messages, stats.packets * 4, notes.messages);
+}
+
+// Transpose every Launchpad (three client, one host) with only so much room in
+// the TX FIFOs on each pass of the main loop, and count the passes it takes
+// for the outbound queues (and the client batch) to empty.
+static void bench_short_writes(uint32_t tx_space_per_pass) {
+  static struct host_event_queue host_events;
+  struct paint_scheduler paint_scheduler;
+  paint_scheduler_init(&paint_scheduler, 0);
+
+  static struct board_state board_state;
+  reset_board_state(&board_state);
+  tusb_stub_set_host_mounted(0, true);
+
+  tonnetz_task(&board_state, &host_events, &paint_scheduler, 0);
+
+  for (int cable = 0; cable < 3; cable++) {
+    board_state.client.offset_by_cable[cable] += 4;
+  }
+  board_state.host_by_idx[0].offset += 4;
+  board_state.is_dirty = true;
+
+  tusb_stub_reset();
+
+  int passes = 0;
+  bool settled = false;
+  while (!settled && passes < 1000) {
+    tusb_stub_set_tx_space(tx_space_per_pass);
+    tonnetz_task(&board_state, &host_events, &paint_scheduler, passes);
+    passes++;
+
+    settled = !paint_scheduler.frame_pending && outbound_queue_depth(&board_state.host_by_idx[0].queue) == 0 && client_packets_depth() == 0;
+    for (int cable = 0; cable < 3; cable++) {
+      settled &= outbound_queue_depth(&board_state.client.queue_by_cable[cable]) == 0;
+    }
+  }
+
+  tusb_stub_set_tx_space(TUSB_STUB_UNLIMITED);
+
+  uint32_t high_watermark = board_state.host_by_idx[0].queue.high_watermark;
+  uint32_t stalls = board_state.host_by_idx[0].queue.stalls;
+  uint32_t overflows = board_state.host_by_idx[0].queue.overflows;
+  for (int cable = 0; cable < 3; cable++) {
+    struct outbound_queue *queue = &board_state.client.queue_by_cable[cable];
+    if (queue->high_watermark > high_watermark) {
+      high_watermark = queue->high_watermark;
+    }
+    stalls += queue->stalls;
+    overflows += queue->overflows;
+  }
+
+  char name[64];
+  if (tx_space_per_pass == TUSB_STUB_UNLIMITED) {
+    snprintf(name, sizeof(name), "unlimited");
+  }
+  else {
+    snprintf(name, sizeof(name), "%u bytes per pass", tx_space_per_pass);
+  }
+
+  printf("%-28s %6d passes %6u high watermark %6u stalls %6u overflows %6u bytes\n",
+    name, passes, high_watermark, stalls, overflows, tusb_stub_total_stats().bytes);
+}
+
+// A chord's worth of notes (and then more) going out on the "notes" cable in
+// a single pass, one stream write per message versus the batch.
+static void bench_client_packets(int events_per_pass, int iterations) {
+  uint8_t packets[128][4];
+  for (int a = 0; a < events_per_pass; a++) {
+    packets[a][0] = (3 << 4) | MIDI_CIN_NOTE_ON;
+    packets[a][1] = MIDI_CIN_NOTE_ON << 4;
+    packets[a][2] = a;
+    packets[a][3] = 100;
+  }
+
+  tusb_stub_reset();
+  uint64_t start = now_ns();
+  for (int i = 0; i < iterations; i++) {
+    for (int a = 0; a < events_per_pass; a++) {
+      tud_midi_stream_write(3, packets[a] + 1, 3);
+    }
+  }
+  uint64_t stream_elapsed = now_ns() - start;
+
+  client_packets_reset();
+  tusb_stub_reset();
+  start = now_ns();
+  for (int i = 0; i < iterations; i++) {
+    for (int a = 0; a < events_per_pass; a++) {
+      client_packets_write(packets[a]);
+    }
+    client_packets_flush();
+  }
+  uint64_t batch_elapsed = now_ns() - start;
+
+  const struct client_packet_stats *stats = client_packets_stats();
+  double events = (double) iterations * events_per_pass;
+
+  char name[64];
+  snprintf(name, sizeof(name), "%d events per pass", events_per_pass);
+  // The stand-in doesn't have TinyUSB's stream parser or FIFO locking, so the
+  // number of calls into TinyUSB says more than the timings do.
+  printf("%-28s %6.1f ns/event (stream) %6.1f ns/event (batch) %4d calls/pass (stream) %4.1f calls/pass (batch) %5.1f events/flush\n",
+    name, stream_elapsed / events, batch_elapsed / events, events_per_pass,
+    (double) stats->writes / iterations, stats->flushes ? (double) stats->events / stats->flushes : 0.0);
+}
+
+int main(int argc, char **argv) {
+  int iterations = argc > 1 ? atoi(argv[1]) : DEFAULT_ITERATIONS;
+  if (iterations <= 0) {
+    iterations = DEFAULT_ITERATIONS;
+  }
+
+  printf("== decode (%d iterations)\n", iterations);
+  bench_decode("process_incoming_mk1_packet", process_incoming_mk1_packet, MK1, iterations);
+  bench_decode("process_incoming_mk2_packet", process_incoming_mk2_packet, MK2, iterations);
+  bench_decode("process_incoming_mk3_packet", process_incoming_mk3_packet, MK3, iterations);
+
+  printf("\n== paint (%d iterations)\n", iterations);
+  bench_paint("paint_mk1_client_launchpad", paint_client_launchpad_0, iterations);
+  bench_paint("paint_mk2_client_launchpad", paint_client_launchpad_1, iterations);
+  bench_paint("paint_mk3_client_launchpad", paint_client_launchpad_2, iterations);
+  bench_paint("paint_mk1_host_launchpad", paint_mk1_host_launchpad_0, iterations);
+  bench_paint("paint_mk2_host_launchpad", paint_mk2_host_launchpad_0, iterations);
+  bench_paint("paint_mk3_host_launchpad", paint_mk3_host_launchpad_0, iterations);
+  bench_paint("paint_host_launchpads (4)", paint_four_host_launchpads, iterations);
+
+  printf("\n== full frame encoders (%d iterations)\n", iterations);
+  bench_frame_encoder("mk2 note per pad", MK2, false, iterations);
+  bench_frame_encoder("mk2 set LEDs sysex", MK2, true, iterations);
+  bench_frame_encoder("mk3 note per pad", MK3, false, iterations);
+  bench_frame_encoder("mk3 LED lighting sysex", MK3, true, iterations);
+
+  printf("\n== transposition (one row up)\n");
+  bench_transpose();
+
+  printf("\n== sync (%d iterations)\n", iterations);
+  bench_sync(iterations);
+
+  printf("\n== host events (%d iterations)\n", iterations);
+  bench_host_events(iterations);
+
+  printf("\n== repaint coalescing (64 pad changes, 1 ms apart)\n");
+  bench_coalescing("every pass", 0);
+  bench_coalescing("8 ms frames", DEFAULT_FRAME_INTERVAL_US);
+
+  printf("\n== client packet batching (%d iterations)\n", iterations);
+  bench_client_packets(1, iterations);
+  bench_client_packets(16, iterations);
+  bench_client_packets(64, iterations);
+
+  printf("\n== short writes (transpose everything)\n");
+  bench_short_writes(TUSB_STUB_UNLIMITED);
+  bench_short_writes(256);
+  bench_short_writes(64);
+
+  printf("\n== messages per pad press (client pad, host mounted)\n");
+  bench_pad_press(MK1);
+  bench_pad_press(MK2);
+  bench_pad_press(MK3);
+
+  return 0;
+}
@@ -0,0 +1,23 @@
+#ifndef _PLATFORM_STUB_H_
+#define _PLATFORM_STUB_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+// By default latency_now_us reads the real (monotonic) clock. Setting the
+// clock pins it to a given time until it's set again, so that a run (for
+// example a replay, see replay.c) doesn't depend on how fast it goes.
+//
+// Setting the clock is also when the arpeggiator's alarm goes off, if it's
+// due, as if the interrupt had come in between passes of the main loop.
+void platform_stub_set_clock(uint32_t);
+void platform_stub_use_real_clock(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _PLATFORM_STUB_H_ */
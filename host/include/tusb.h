@@ -0,0 +1,53 @@
+#ifndef _TUSB_STUB_TUSB_H_
+#define _TUSB_STUB_TUSB_H_
+
+// A stand-in for the parts of TinyUSB that the board logic uses, so that it
+// can be built and benchmarked on a Linux host. Writes are recorded rather
+// than sent, see tusb_stub.h for the calls used to inspect and drive them.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+// Code Index Numbers, copied from TinyUSB's midi.h
+enum {
+  MIDI_CIN_MISC              = 0,
+  MIDI_CIN_CABLE_EVENT       = 1,
+  MIDI_CIN_SYSCOM_2BYTE      = 2,
+  MIDI_CIN_SYSCOM_3BYTE      = 3,
+  MIDI_CIN_SYSEX_START       = 4,
+  MIDI_CIN_SYSEX_END_1BYTE   = 5,
+  MIDI_CIN_SYSEX_END_2BYTE   = 6,
+  MIDI_CIN_SYSEX_END_3BYTE   = 7,
+  MIDI_CIN_NOTE_OFF          = 8,
+  MIDI_CIN_NOTE_ON           = 9,
+  MIDI_CIN_POLY_KEYPRESS     = 10,
+  MIDI_CIN_CONTROL_CHANGE    = 11,
+  MIDI_CIN_PROGRAM_CHANGE    = 12,
+  MIDI_CIN_CHANNEL_PRESSURE  = 13,
+  MIDI_CIN_PITCH_BEND_CHANGE = 14,
+  MIDI_CIN_1BYTE_DATA        = 15
+};
+
+// Device (client) side
+uint32_t tud_midi_available(void);
+bool tud_midi_packet_read(uint8_t packet[4]);
+bool tud_midi_packet_write(uint8_t const packet[4]);
+uint32_t tud_midi_packet_write_n(uint8_t const packets[], uint32_t bufsize);
+uint32_t tud_midi_stream_write(uint8_t cable_num, uint8_t const* buffer, uint32_t bufsize);
+
+// Host side
+bool tuh_midi_mounted(uint8_t idx);
+uint32_t tuh_midi_stream_write(uint8_t idx, uint8_t cable_num, uint8_t const* buffer, uint32_t bufsize);
+bool tuh_midi_packet_write(uint8_t idx, uint8_t const packet[4]);
+uint32_t tuh_midi_write_flush(uint8_t idx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _TUSB_STUB_TUSB_H_ */
@@ -0,0 +1,59 @@
+#ifndef _TUSB_STUB_H_
+#define _TUSB_STUB_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define TUSB_STUB_CABLES 16
+#define TUSB_STUB_HOST_DEVICES 4
+
+// What has been written to a single cable (device side) or device (host
+// side). "messages" counts calls to the stream write functions, "packets"
+// counts the 4-byte USB-MIDI event packets TinyUSB would have turned the
+// stream into, so `packets * 4` is what would actually go over the wire.
+struct tusb_stub_stats {
+    uint32_t messages;
+    uint32_t bytes;
+    uint32_t packets;
+};
+
+enum TusbStubSide {
+    TUSB_STUB_DEVICE,
+    TUSB_STUB_HOST
+};
+
+// Forget everything written so far (stats and the write log).
+void tusb_stub_reset(void);
+
+struct tusb_stub_stats tusb_stub_device_stats(uint8_t cable);
+struct tusb_stub_stats tusb_stub_host_stats(uint8_t idx);
+
+// Totals across every cable and device.
+struct tusb_stub_stats tusb_stub_total_stats(void);
+
+// Queue a packet to be returned by tud_midi_packet_read.
+bool tusb_stub_queue_device_packet(const uint8_t packet[4]);
+
+void tusb_stub_set_host_mounted(uint8_t idx, bool mounted);
+
+// How many more bytes the TX FIFOs will take (across every cable and device)
+// before writes come up short. Stream writes use one byte per MIDI byte,
+// packet writes four bytes per packet. TUSB_STUB_UNLIMITED (the default) means there is
+// no limit. Not affected by tusb_stub_reset.
+#define TUSB_STUB_UNLIMITED UINT32_MAX
+void tusb_stub_set_tx_space(uint32_t bytes);
+
+// Every write is appended to a log as a four byte header (side, idx, cable,
+// length) followed by the bytes written, so that two runs can be compared.
+const uint8_t *tusb_stub_log(size_t *length);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _TUSB_STUB_H_ */
@@ -0,0 +1,86 @@
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include "arpeggiator.h"
+#include "latency.h"
+#include "platform_stub.h"
+#include "settings.h"
+
+// Stand-ins for the things the firmware gets from the Pico SDK.
+
+static bool clock_is_set = false;
+static uint32_t set_clock_us = 0;
+
+static bool arpeggiator_alarm_is_set = false;
+static uint32_t arpeggiator_alarm_us = 0;
+
+void platform_stub_set_clock(uint32_t now_us) {
+  clock_is_set = true;
+  set_clock_us = now_us;
+
+  if (arpeggiator_alarm_is_set && (int32_t) (now_us - arpeggiator_alarm_us) >= 0) {
+    arpeggiator_alarm_is_set = false;
+    arpeggiator_alarm_fired(now_us);
+  }
+}
+
+void platform_stub_use_real_clock(void) {
+  clock_is_set = false;
+}
+
+uint32_t latency_now_us(void) {
+  if (clock_is_set) {
+    return set_clock_us;
+  }
+
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint32_t) (((uint64_t) ts.tv_sec * 1000000ull) + (ts.tv_nsec / 1000));
+}
+
+// The settings log, in memory. Like real flash, programming can only clear
+// bits, and only erasing sets them again.
+static uint8_t settings_flash[SETTINGS_STORE_SIZE];
+static bool settings_flash_is_initialised = false;
+
+static void initialise_settings_flash(void) {
+  if (!settings_flash_is_initialised) {
+    memset(settings_flash, 0xFF, sizeof(settings_flash));
+    settings_flash_is_initialised = true;
+  }
+}
+
+const uint8_t *settings_flash_contents(void) {
+  initialise_settings_flash();
+  return settings_flash;
+}
+
+bool settings_flash_program(uint32_t offset, const uint8_t *page) {
+  initialise_settings_flash();
+
+  for (uint32_t a = 0; a < SETTINGS_PAGE_SIZE; a++) {
+    settings_flash[offset + a] &= page[a];
+  }
+
+  return true;
+}
+
+bool settings_flash_erase(uint32_t offset) {
+  initialise_settings_flash();
+  memset(settings_flash + offset, 0xFF, SETTINGS_SECTOR_SIZE);
+  return true;
+}
+
+bool arpeggiator_alarm_set(uint32_t target_us) {
+  if ((int32_t) (target_us - latency_now_us()) <= 0) {
+    return false;
+  }
+
+  arpeggiator_alarm_is_set = true;
+  arpeggiator_alarm_us = target_us;
+  return true;
+}
+
+void arpeggiator_alarm_cancel(void) {
+  arpeggiator_alarm_is_set = false;
+}
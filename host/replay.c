@@ -0,0 +1,265 @@
+// Replays a capture (see src/capture.h) through the board logic, and writes
+// everything that would have been sent, so that two builds can be compared
+// on a real session, for example:
+//
+// launchpad-replay session.lptz before.out
+// (make a change, rebuild)
+// launchpad-replay session.lptz after.out
+// cmp before.out after.out
+//
+// The output is the tusb_stub log, i.e. a four byte header (side, idx, cable,
+// length) followed by the bytes for each write, see tusb_stub.h. The clock is
+// driven from the capture, so the same capture always produces the same
+// output. The settings the capture starts with are applied before anything
+// else (older captures don't have them, and start from the defaults).
+//
+// Usage: launchpad-replay <capture> [output]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "tusb.h"
+#include "tusb_stub.h"
+#include "platform_stub.h"
+
+#include "capture.h"
+#include "client_packets.h"
+#include "host_events.h"
+#include "launchpad.h"
+#include "paint_scheduler.h"
+#include "settings.h"
+#include "tonnetz.h"
+
+// How often the main loop is run between records, which only matters while
+// there's something waiting to be painted or sent.
+#define REPLAY_TICK_US 1000
+
+// How long to keep going after the last record, so that the last frame goes
+// out.
+#define REPLAY_TAIL_US 100000
+
+static struct board_state board_state;
+static struct host_event_queue host_events;
+static struct paint_scheduler paint_scheduler;
+
+// The settings at the start of the capture, if it has them.
+static struct capture_settings capture_settings;
+
+static FILE *output;
+static uint64_t output_bytes = 0;
+static uint32_t passes = 0;
+
+// The same starting point as the firmware, once the client port is mounted.
+static void reset_board_state(void) {
+  memset(&board_state, 0, sizeof(board_state));
+
+  board_state.is_dirty = true;
+
+  for (int a = 0; a < 3; a++) {
+    board_state.client.offset_by_cable[a] = 45;
+  }
+
+  for (int idx = 0; idx < MAX_HOST_LAUNCHPADS; idx++) {
+    board_state.host_by_idx[idx].offset = 45;
+  }
+
+  velocity_curves_init(&board_state.velocity_curves);
+  layout_init(&board_state.layout);
+  aftertouch_init(&board_state.aftertouch);
+  mpe_init(&board_state.mpe);
+  chords_init(&board_state.chords);
+  sustain_init(&board_state.sustain);
+  arpeggiator_init(&board_state.arpeggiator);
+  paint_scheduler_init(&paint_scheduler, DEFAULT_FRAME_INTERVAL_US);
+  client_packets_reset();
+
+  if (capture_settings_complete(&capture_settings)) {
+    if (capture_settings.format != SETTINGS_PAYLOAD_FORMAT ||
+        !settings_apply(&board_state, capture_settings.payload, capture_settings.length)) {
+      fprintf(stderr, "The capture's settings are from a different build, starting from the defaults\n");
+    }
+  }
+
+  initialise_client_launchpads(&board_state);
+}
+
+static bool has_work(void) {
+  if (paint_scheduler.frame_pending || board_state.is_dirty || client_packets_depth() > 0) {
+    return true;
+  }
+
+  for (int cable = 0; cable < 3; cable++) {
+    if (outbound_queue_depth(&board_state.client.queue_by_cable[cable])) {
+      return true;
+    }
+  }
+
+  for (int idx = 0; idx < MAX_HOST_LAUNCHPADS; idx++) {
+    if (outbound_queue_depth(&board_state.host_by_idx[idx].queue)) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+// Run a pass of the main loop, and move what it wrote to the output.
+static void run_pass(uint64_t now_us) {
+  platform_stub_set_clock((uint32_t) now_us);
+  tonnetz_task(&board_state, &host_events, &paint_scheduler, now_us);
+  passes++;
+
+  size_t length;
+  const uint8_t *log = tusb_stub_log(&length);
+  if (output && length) {
+    fwrite(log, 1, length, output);
+  }
+  output_bytes += length;
+  tusb_stub_reset();
+}
+
+static void apply_record(const struct capture_record *record) {
+  struct host_event event = {
+    .idx = record->idx,
+    .timestamp_us = record->timestamp_us
+  };
+
+  switch (record->source) {
+    case CAPTURE_CLIENT_PACKET:
+      tusb_stub_queue_device_packet(record->packet);
+      break;
+    case CAPTURE_HOST_PACKET:
+      event.type = HOST_EVENT_PACKET;
+      memcpy(event.packet, record->packet, 4);
+      host_event_queue_push(&host_events, &event);
+      break;
+    case CAPTURE_HOST_MOUNT:
+      event.type = HOST_EVENT_MOUNT;
+      event.launchpad_version = record->packet[0];
+      tusb_stub_set_host_mounted(record->idx, true);
+      host_event_queue_push(&host_events, &event);
+      break;
+    case CAPTURE_HOST_UNMOUNT:
+      event.type = HOST_EVENT_UNMOUNT;
+      tusb_stub_set_host_mounted(record->idx, false);
+      host_event_queue_push(&host_events, &event);
+      break;
+    default:
+      break;
+  }
+}
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ((uint64_t) ts.tv_sec * 1000000000ull) + ts.tv_nsec;
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    fprintf(stderr, "Usage: %s <capture> [output]\n", argv[0]);
+    return 2;
+  }
+
+  FILE *capture = fopen(argv[1], "rb");
+  if (!capture) {
+    perror(argv[1]);
+    return 1;
+  }
+
+  uint8_t header[CAPTURE_HEADER_SIZE];
+  if (fread(header, 1, sizeof(header), capture) != sizeof(header) || !capture_header_check(header)) {
+    fprintf(stderr, "%s: not a capture\n", argv[1]);
+    return 1;
+  }
+
+  if (argc > 2) {
+    output = fopen(argv[2], "wb");
+    if (!output) {
+      perror(argv[2]);
+      return 1;
+    }
+  }
+
+  platform_stub_set_clock(0);
+  tusb_stub_reset();
+
+  uint32_t records = 0;
+  uint32_t records_by_source[5] = { 0 };
+
+  // Capture timestamps are 32 bits, so follow them as they wrap.
+  uint64_t now_us = 0;
+  uint32_t last_timestamp_us = 0;
+  bool started = false;
+
+  uint64_t start = now_ns();
+
+  uint8_t bytes[CAPTURE_RECORD_SIZE];
+  while (fread(bytes, 1, sizeof(bytes), capture) == sizeof(bytes)) {
+    struct capture_record record;
+    capture_record_decode(bytes, &record);
+
+    records++;
+    if (record.source < 5) {
+      records_by_source[record.source]++;
+    }
+
+    // The settings lead, and the board is only set up once they're all in.
+    if (!started) {
+      if (capture_settings_add(&capture_settings, &record)) {
+        continue;
+      }
+
+      reset_board_state();
+    }
+
+    if (started && record.timestamp_us != last_timestamp_us) {
+      uint64_t record_us = now_us + (uint32_t) (record.timestamp_us - last_timestamp_us);
+
+      // Everything that arrived at the same time is decoded in one pass, and
+      // the loop keeps running in between for as long as there's something
+      // to paint or send.
+      run_pass(now_us);
+      now_us += REPLAY_TICK_US;
+      while (now_us < record_us && has_work()) {
+        run_pass(now_us);
+        now_us += REPLAY_TICK_US;
+      }
+
+      now_us = record_us;
+    }
+
+    started = true;
+    last_timestamp_us = record.timestamp_us;
+
+    apply_record(&record);
+  }
+
+  if (!started) {
+    reset_board_state();
+  }
+
+  uint64_t end_us = now_us + REPLAY_TAIL_US;
+  while (now_us <= end_us) {
+    run_pass(now_us);
+    now_us += REPLAY_TICK_US;
+  }
+
+  uint64_t elapsed = now_ns() - start;
+
+  fclose(capture);
+  if (output) {
+    fclose(output);
+  }
+
+  printf("%u records (%u client, %u host, %u mounts, %u unmounts, %u settings) in %u passes\n",
+    records, records_by_source[CAPTURE_CLIENT_PACKET], records_by_source[CAPTURE_HOST_PACKET],
+    records_by_source[CAPTURE_HOST_MOUNT], records_by_source[CAPTURE_HOST_UNMOUNT],
+    records_by_source[CAPTURE_SETTINGS], passes);
+  printf("%llu output bytes (including write headers), %.1f ns/record\n",
+    (unsigned long long) output_bytes, records ? (double) elapsed / records : 0.0);
+
+  return 0;
+}
@@ -0,0 +1,595 @@
+// A flood (or, left running for longer, soak) test of the board logic, using
+// the synthetic load from src/stress.h. This is the standard throughput
+// benchmark, i.e. how much the board takes before notes are dropped or held
+// up, for example:
+//
+// launchpad-stress --pressure 2000 --notes 1000 --seconds 60 --report 10
+// launchpad-stress --sweep
+//
+// The generator's packets go through the same paths as real ones, i.e. the
+// client port's FIFO and the host event queue, and the main loop is run every
+// --pass-us of simulated time, with the TX FIFOs taking --tx bytes per
+// millisecond between them. Everything is reported in simulated time, apart
+// from how busy the board logic kept this machine, which is what ends a
+// --sweep once the simulated load stops being the limit.
+//
+// Note latency is measured up to the note being added to the client batch
+// (see latency.h), so time spent waiting for the TX FIFO shows up as
+// deferred packets and a deeper batch instead.
+//
+// Usage: launchpad-stress [options], see usage() below.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "tusb.h"
+#include "tusb_stub.h"
+#include "platform_stub.h"
+
+#include "capture.h"
+#include "client_packets.h"
+#include "host_events.h"
+#include "launchpad.h"
+#include "paint_scheduler.h"
+#include "stress.h"
+#include "tonnetz.h"
+
+// How long to keep going once the load stops, so that whatever is queued goes
+// out.
+#define STRESS_TAIL_US 200000
+
+// For --sweep, the 99th percentile note latency (from the packet arriving to
+// the note going out) that counts as "held up".
+#define SWEEP_MAX_P99_US 5000
+
+struct options {
+    struct stress_config config;
+    uint32_t seconds;
+    uint32_t pass_us;
+
+    // TX FIFO space per millisecond, across both ports.
+    uint32_t tx_bytes_per_ms;
+
+    // Print a line every this many (simulated) seconds.
+    uint32_t report_seconds;
+
+    // Member channels for MPE output (see mpe.h), or zero for a single
+    // channel.
+    uint32_t mpe_members;
+
+    // Arpeggiate everything that's held, in this ArpMode (see
+    // arpeggiator.h), at the default rate and gate.
+    uint32_t arp_mode;
+
+    bool sweep;
+    const char *capture_path;
+};
+
+struct results {
+    uint32_t generated;
+
+    // Packets that didn't fit in the client port's FIFO, or the host event
+    // queue.
+    uint32_t client_input_dropped;
+    uint32_t host_input_dropped;
+
+    // Messages the outbound queues had to turn away, i.e. pads that weren't
+    // painted.
+    uint32_t outbound_overflows;
+
+    // Packets that didn't fit in the client batch, and were left for a later
+    // pass (see sync_playing_notes).
+    uint32_t client_deferred;
+
+    // What the aftertouch coalescer did with pressure changes, see
+    // aftertouch.h.
+    uint32_t pressure_sent;
+    uint32_t pressure_replaced;
+    uint32_t pressure_dropped;
+
+    // Channels handed out, and notes that lost theirs, with MPE output.
+    uint32_t mpe_allocations;
+    uint32_t mpe_steals;
+
+    uint64_t client_output_bytes;
+    uint64_t host_output_bytes;
+    uint32_t notes_out;
+
+    uint32_t max_host_event_depth;
+    uint32_t max_client_packets_depth;
+    uint32_t max_outbound_depth;
+    uint32_t max_pending_notes;
+
+    uint64_t passes;
+    uint64_t engine_ns;
+};
+
+static struct board_state board_state;
+static struct host_event_queue host_events;
+static struct paint_scheduler paint_scheduler;
+
+static struct results results;
+static FILE *capture;
+
+// Once the load has stopped, everything is released at once, which isn't
+// something a real Launchpad can do, so the deepest queues are only tracked
+// while the load is running.
+static bool draining = false;
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ((uint64_t) ts.tv_sec * 1000000000ull) + ts.tv_nsec;
+}
+
+// The same starting point as the firmware, once the client port is mounted.
+static void reset_board_state(void) {
+  memset(&board_state, 0, sizeof(board_state));
+  memset(&host_events, 0, sizeof(host_events));
+
+  board_state.is_dirty = true;
+
+  for (int a = 0; a < 3; a++) {
+    board_state.client.offset_by_cable[a] = 45;
+  }
+
+  for (int idx = 0; idx < MAX_HOST_LAUNCHPADS; idx++) {
+    board_state.host_by_idx[idx].offset = 45;
+  }
+
+  velocity_curves_init(&board_state.velocity_curves);
+  layout_init(&board_state.layout);
+  aftertouch_init(&board_state.aftertouch);
+  mpe_init(&board_state.mpe);
+  chords_init(&board_state.chords);
+  sustain_init(&board_state.sustain);
+  arpeggiator_init(&board_state.arpeggiator);
+  paint_scheduler_init(&paint_scheduler, DEFAULT_FRAME_INTERVAL_US);
+  client_packets_reset();
+  tusb_stub_reset();
+
+  initialise_client_launchpads(&board_state);
+}
+
+static void write_capture_record(uint32_t timestamp_us, uint8_t source, uint8_t idx, const uint8_t packet[4]) {
+  if (capture) {
+    struct capture_record record = { timestamp_us, source, idx, { packet[0], packet[1], packet[2], packet[3] } };
+    uint8_t bytes[CAPTURE_RECORD_SIZE];
+    capture_record_encode(&record, bytes);
+    fwrite(bytes, 1, sizeof(bytes), capture);
+  }
+}
+
+static void mount_host_launchpads(const struct stress_config *config) {
+  for (int idx = 0; idx < MAX_HOST_LAUNCHPADS; idx++) {
+    if (config->host_versions[idx] == UNkNOWN) {
+      continue;
+    }
+
+    struct host_event event = {
+      .type = HOST_EVENT_MOUNT,
+      .idx = idx,
+      .launchpad_version = config->host_versions[idx]
+    };
+
+    tusb_stub_set_host_mounted(idx, true);
+    host_event_queue_push(&host_events, &event);
+
+    uint8_t version_packet[4] = { config->host_versions[idx] };
+    write_capture_record(0, CAPTURE_HOST_MOUNT, idx, version_packet);
+  }
+}
+
+// Where the generator's packets go, i.e. where TinyUSB (or core1) would have
+// put them.
+static void feed(void *context, uint8_t source, uint8_t idx, const uint8_t packet[4], uint32_t timestamp_us) {
+  (void) context;
+
+  results.generated++;
+
+  if (source == CAPTURE_HOST_PACKET) {
+    struct host_event event = {
+      .type = HOST_EVENT_PACKET,
+      .idx = idx,
+      .timestamp_us = timestamp_us
+    };
+    memcpy(event.packet, packet, 4);
+
+    if (!host_event_queue_push(&host_events, &event)) {
+      results.host_input_dropped++;
+      return;
+    }
+  }
+  else if (!tusb_stub_queue_device_packet(packet)) {
+    results.client_input_dropped++;
+    return;
+  }
+
+  write_capture_record(timestamp_us, source, idx, packet);
+}
+
+static uint32_t count_bits(const uint32_t *words, int count) {
+  uint32_t bits = 0;
+  for (int a = 0; a < count; a++) {
+    bits += __builtin_popcount(words[a]);
+  }
+
+  return bits;
+}
+
+static uint32_t outbound_depth(void) {
+  uint32_t depth = 0;
+
+  for (int cable = 0; cable < 3; cable++) {
+    depth += outbound_queue_depth(&board_state.client.queue_by_cable[cable]);
+  }
+
+  for (int idx = 0; idx < MAX_HOST_LAUNCHPADS; idx++) {
+    depth += outbound_queue_depth(&board_state.host_by_idx[idx].queue);
+  }
+
+  return depth;
+}
+
+static uint32_t outbound_overflows(void) {
+  uint32_t overflows = 0;
+
+  for (int cable = 0; cable < 3; cable++) {
+    overflows += board_state.client.queue_by_cable[cable].overflows;
+  }
+
+  for (int idx = 0; idx < MAX_HOST_LAUNCHPADS; idx++) {
+    overflows += board_state.host_by_idx[idx].queue.overflows;
+  }
+
+  return overflows;
+}
+
+static bool has_work(void) {
+  return paint_scheduler.frame_pending || board_state.is_dirty || client_packets_depth() > 0 ||
+    host_event_queue_depth(&host_events) > 0 || tud_midi_available() > 0 ||
+    count_bits(board_state.pending_notes, 4) > 0 || outbound_depth() > 0;
+}
+
+// A pass of the main loop, with the TX FIFOs emptied beforehand by however
+// much the bus would have sent since the last one.
+static void run_pass(const struct options *options, uint64_t now_us) {
+  platform_stub_set_clock((uint32_t) now_us);
+
+  if (options->tx_bytes_per_ms) {
+    tusb_stub_set_tx_space(((uint64_t) options->tx_bytes_per_ms * options->pass_us) / 1000);
+  }
+
+  uint32_t host_event_depth = host_event_queue_depth(&host_events);
+  if (!draining && host_event_depth > results.max_host_event_depth) {
+    results.max_host_event_depth = host_event_depth;
+  }
+
+  uint64_t start = now_ns();
+  tonnetz_task(&board_state, &host_events, &paint_scheduler, now_us);
+  results.engine_ns += now_ns() - start;
+  results.passes++;
+
+  if (!draining) {
+    if (client_packets_depth() > results.max_client_packets_depth) {
+      results.max_client_packets_depth = client_packets_depth();
+    }
+
+    if (outbound_depth() > results.max_outbound_depth) {
+      results.max_outbound_depth = outbound_depth();
+    }
+
+    uint32_t pending_notes = count_bits(board_state.pending_notes, 4);
+    if (pending_notes > results.max_pending_notes) {
+      results.max_pending_notes = pending_notes;
+    }
+  }
+
+  // The stub's counters are cleared every pass, so that its log doesn't fill
+  // up on a long run.
+  for (int cable = 0; cable < TUSB_STUB_CABLES; cable++) {
+    results.client_output_bytes += tusb_stub_device_stats(cable).packets * 4;
+  }
+  for (int idx = 0; idx < TUSB_STUB_HOST_DEVICES; idx++) {
+    results.host_output_bytes += tusb_stub_host_stats(idx).packets * 4;
+  }
+  results.notes_out += tusb_stub_device_stats(3).packets;
+
+  results.client_deferred = client_packets_stats()->rejected;
+  results.outbound_overflows = outbound_overflows();
+
+  results.pressure_sent = board_state.aftertouch.sent;
+  results.pressure_replaced = board_state.aftertouch.replaced;
+  results.pressure_dropped = board_state.aftertouch.dropped;
+
+  results.mpe_allocations = board_state.mpe.allocator.allocations;
+  results.mpe_steals = board_state.mpe.allocator.steals;
+
+  tusb_stub_reset();
+}
+
+static void print_report(const char *label, const struct results *results, double seconds) {
+  const struct latency_histogram *total = &board_state.latency.histograms[LATENCY_TOTAL];
+  uint32_t processed = results->generated - results->client_input_dropped - results->host_input_dropped;
+
+  printf("%s: %.0f events/s in, %.0f processed, %.0f notes/s out, %.0f bytes/s out (%.0f client, %.0f host)\n",
+    label, results->generated / seconds, processed / seconds, results->notes_out / seconds,
+    (results->client_output_bytes + results->host_output_bytes) / seconds,
+    results->client_output_bytes / seconds, results->host_output_bytes / seconds);
+  printf("  dropped: %u client input, %u host input, %u outbound messages, deferred: %u client packets\n",
+    results->client_input_dropped, results->host_input_dropped, results->outbound_overflows, results->client_deferred);
+  printf("  deepest: %u host events, %u client packets, %u outbound bytes, %u pending notes\n",
+    results->max_host_event_depth, results->max_client_packets_depth, results->max_outbound_depth, results->max_pending_notes);
+  printf("  aftertouch: %u sent, %u replaced before they were sent, %u in the deadband\n",
+    results->pressure_sent, results->pressure_replaced, results->pressure_dropped);
+  if (board_state.mpe.active.mode == OUTPUT_MPE) {
+    printf("  mpe: %u channels handed out, %u notes stolen\n", results->mpe_allocations, results->mpe_steals);
+  }
+  if (arpeggiator_is_active(&board_state.arpeggiator)) {
+    const struct arpeggiator *arpeggiator = &board_state.arpeggiator;
+    printf("  arpeggiator: %u notes, %u steps missed, alarm late by max %u us, notes late by p50 %u us, p99 %u us, max %u us\n",
+      arpeggiator->steps, arpeggiator->missed_steps, arpeggiator->alarm_lateness.max_us,
+      latency_percentile(&arpeggiator->note_lateness, 50), latency_percentile(&arpeggiator->note_lateness, 99),
+      arpeggiator->note_lateness.max_us);
+  }
+  printf("  note latency: p50 %u us, p99 %u us, max %u us (%u notes)\n",
+    latency_percentile(total, 50), latency_percentile(total, 99), total->max_us, total->count);
+}
+
+// Run the load for the given number of (simulated) seconds, then let
+// everything drain.
+static void run(const struct options *options, bool quiet) {
+  memset(&results, 0, sizeof(results));
+  draining = false;
+  reset_board_state();
+  platform_stub_set_clock(0);
+  tusb_stub_set_tx_space(TUSB_STUB_UNLIMITED);
+
+  mount_host_launchpads(&options->config);
+
+  if (options->mpe_members) {
+    struct mpe_config mpe_config = {
+      .mode = OUTPUT_MPE,
+      .zone = MPE_LOWER_ZONE,
+      .member_count = options->mpe_members
+    };
+    mpe_configure(&board_state.mpe, &mpe_config);
+  }
+
+  if (options->arp_mode) {
+    struct arp_config arp_config = board_state.arpeggiator.requested;
+    arp_config.mode = options->arp_mode;
+    arpeggiator_configure(&board_state.arpeggiator, &arp_config);
+  }
+
+  struct stress_generator generator;
+  stress_init(&generator, &options->config);
+
+  uint64_t end_us = (uint64_t) options->seconds * 1000000;
+  uint64_t report_us = (uint64_t) options->report_seconds * 1000000;
+  uint64_t now_us = 0;
+
+  struct results last_report = { 0 };
+  uint64_t last_report_us = 0;
+
+  for (; now_us < end_us; now_us += options->pass_us) {
+    stress_generate(&generator, (uint32_t) now_us, feed, NULL);
+    run_pass(options, now_us);
+
+    // For a soak test, print what happened since the last line, so that
+    // anything that builds up over time stands out.
+    if (!quiet && report_us && now_us + options->pass_us - last_report_us >= report_us) {
+      struct results interval = results;
+      interval.generated -= last_report.generated;
+      interval.client_input_dropped -= last_report.client_input_dropped;
+      interval.host_input_dropped -= last_report.host_input_dropped;
+      interval.client_output_bytes -= last_report.client_output_bytes;
+      interval.host_output_bytes -= last_report.host_output_bytes;
+      interval.notes_out -= last_report.notes_out;
+      interval.client_deferred -= last_report.client_deferred;
+      interval.outbound_overflows -= last_report.outbound_overflows;
+      interval.pressure_sent -= last_report.pressure_sent;
+      interval.pressure_replaced -= last_report.pressure_replaced;
+      interval.pressure_dropped -= last_report.pressure_dropped;
+
+      char label[32];
+      snprintf(label, sizeof(label), "%6.1fs", (now_us + options->pass_us) / 1000000.0);
+      print_report(label, &interval, (now_us + options->pass_us - last_report_us) / 1000000.0);
+
+      last_report = results;
+      last_report_us = now_us + options->pass_us;
+    }
+  }
+
+  draining = true;
+  stress_release(&generator, (uint32_t) now_us, feed, NULL);
+
+  uint64_t tail_end_us = now_us + STRESS_TAIL_US;
+  do {
+    run_pass(options, now_us);
+    now_us += options->pass_us;
+  } while (now_us < tail_end_us && has_work());
+}
+
+// How much of the (simulated) time the board logic would have kept this
+// machine busy for.
+static double cpu_load(const struct options *options) {
+  return results.engine_ns / (results.passes * options->pass_us * 1000.0);
+}
+
+static bool kept_up(const struct options *options) {
+  const struct latency_histogram *total = &board_state.latency.histograms[LATENCY_TOTAL];
+
+  return results.client_input_dropped == 0 && results.host_input_dropped == 0 && results.outbound_overflows == 0 &&
+    latency_percentile(total, 99) <= SWEEP_MAX_P99_US && cpu_load(options) <= 1.0;
+}
+
+// Double the aftertouch rate until the board can't keep up, and then report
+// the last rate it managed.
+static void sweep(struct options *options) {
+  uint32_t best = 0;
+
+  printf("%10s %12s %12s %10s %10s %10s %8s\n", "pressure/s", "events/s", "bytes/s out", "dropped", "p99 us", "max us", "cpu");
+
+  for (uint32_t rate = options->config.pressure_rate ? options->config.pressure_rate : 100; rate <= 1000000; rate *= 2) {
+    options->config.pressure_rate = rate;
+    run(options, true);
+
+    const struct latency_histogram *total = &board_state.latency.histograms[LATENCY_TOTAL];
+    uint32_t dropped = results.client_input_dropped + results.host_input_dropped + results.outbound_overflows;
+
+    printf("%10u %12.0f %12.0f %10u %10u %10u %7.1f%%\n", rate,
+      results.generated / (double) options->seconds,
+      (results.client_output_bytes + results.host_output_bytes) / (double) options->seconds,
+      dropped, latency_percentile(total, 99), total->max_us, cpu_load(options) * 100);
+
+    if (!kept_up(options)) {
+      break;
+    }
+
+    best = rate;
+  }
+
+  if (best) {
+    printf("Kept up with %u pressure events/s per Launchpad\n", best);
+  }
+  else {
+    printf("Couldn't keep up with the lowest rate\n");
+  }
+}
+
+static void usage(const char *name) {
+  fprintf(stderr,
+    "Usage: %s [options]\n"
+    "  --pressure N   poly aftertouch events/s per Launchpad (default 1000)\n"
+    "  --pads N       pad presses and releases/s per Launchpad (default 20)\n"
+    "  --notes N      note ons and offs/s on the notes cable (default 500)\n"
+    "  --clients N    client Launchpads to drive, one bit per cable (default 7)\n"
+    "  --hosts N      MK3s on the host port (default 4)\n"
+    "  --seconds N    how long to run for, in simulated time (default 10)\n"
+    "  --pass-us N    how often the main loop runs (default 100)\n"
+    "  --tx N         bytes/ms the TX FIFOs take, 0 for no limit (default 128)\n"
+    "  --report N     print a line every N seconds, for soak tests\n"
+    "  --mpe N        send notes with MPE, on N member channels\n"
+    "  --arp N        arpeggiate the held notes, N being an ArpMode\n"
+    "  --sweep        double the aftertouch rate until something gives\n"
+    "  --capture FILE write the load as a capture, for launchpad-replay\n",
+    name);
+}
+
+int main(int argc, char **argv) {
+  struct options options = {
+    .config = {
+      .pressure_rate = 1000,
+      .pad_rate = 20,
+      .note_rate = 500,
+      .client_cables = 0x07
+    },
+    .seconds = 10,
+    .pass_us = 100,
+    .tx_bytes_per_ms = 128
+  };
+
+  uint32_t hosts = MAX_HOST_LAUNCHPADS;
+
+  for (int a = 1; a < argc; a++) {
+    const char *value = a + 1 < argc ? argv[a + 1] : NULL;
+
+    if (strcmp(argv[a], "--sweep") == 0) {
+      options.sweep = true;
+      continue;
+    }
+
+    if (!value) {
+      usage(argv[0]);
+      return 2;
+    }
+
+    if (strcmp(argv[a], "--pressure") == 0) {
+      options.config.pressure_rate = strtoul(value, NULL, 10);
+    }
+    else if (strcmp(argv[a], "--pads") == 0) {
+      options.config.pad_rate = strtoul(value, NULL, 10);
+    }
+    else if (strcmp(argv[a], "--notes") == 0) {
+      options.config.note_rate = strtoul(value, NULL, 10);
+    }
+    else if (strcmp(argv[a], "--clients") == 0) {
+      options.config.client_cables = strtoul(value, NULL, 0) & 0x07;
+    }
+    else if (strcmp(argv[a], "--hosts") == 0) {
+      hosts = strtoul(value, NULL, 10);
+    }
+    else if (strcmp(argv[a], "--seconds") == 0) {
+      options.seconds = strtoul(value, NULL, 10);
+    }
+    else if (strcmp(argv[a], "--pass-us") == 0) {
+      options.pass_us = strtoul(value, NULL, 10);
+    }
+    else if (strcmp(argv[a], "--tx") == 0) {
+      options.tx_bytes_per_ms = strtoul(value, NULL, 10);
+    }
+    else if (strcmp(argv[a], "--mpe") == 0) {
+      options.mpe_members = strtoul(value, NULL, 10);
+    }
+    else if (strcmp(argv[a], "--arp") == 0) {
+      options.arp_mode = strtoul(value, NULL, 10);
+    }
+    else if (strcmp(argv[a], "--report") == 0) {
+      options.report_seconds = strtoul(value, NULL, 10);
+    }
+    else if (strcmp(argv[a], "--capture") == 0) {
+      options.capture_path = value;
+    }
+    else {
+      usage(argv[0]);
+      return 2;
+    }
+
+    a++;
+  }
+
+  if (options.pass_us == 0 || options.seconds == 0) {
+    usage(argv[0]);
+    return 2;
+  }
+
+  for (uint32_t idx = 0; idx < MAX_HOST_LAUNCHPADS; idx++) {
+    options.config.host_versions[idx] = idx < hosts ? MK3 : UNkNOWN;
+  }
+
+  if (options.sweep) {
+    sweep(&options);
+    return 0;
+  }
+
+  if (options.capture_path) {
+    capture = fopen(options.capture_path, "wb");
+    if (!capture) {
+      perror(options.capture_path);
+      return 1;
+    }
+
+    uint8_t header[CAPTURE_HEADER_SIZE];
+    capture_header_encode(header);
+    fwrite(header, 1, sizeof(header), capture);
+  }
+
+  run(&options, false);
+
+  if (capture) {
+    fclose(capture);
+  }
+
+  print_report("Total", &results, options.seconds);
+
+  uint32_t processed = results.generated - results.client_input_dropped - results.host_input_dropped;
+  printf("Board logic on this machine: %.1f ns/event, %.1f ns/pass over %llu passes, %.1f%% busy\n",
+    processed ? (double) results.engine_ns / processed : 0.0,
+    results.passes ? (double) results.engine_ns / results.passes : 0.0,
+    (unsigned long long) results.passes, cpu_load(&options) * 100);
+
+  return 0;
+}
@@ -0,0 +1,1135 @@
+// Checks for the board logic that can go wrong without anything looking
+// slower, so that the benchmarks aren't the only thing keeping it honest.
+// Run by ctest, and exits non-zero if any check fails.
+//
+// Usage: launchpad-tests
+
+#include <stdio.h>
+#include <string.h>
+
+#include "tusb.h"
+#include "tusb_stub.h"
+
+#include "chords.h"
+#include "arpeggiator.h"
+#include "capture.h"
+#include "client_packets.h"
+#include "host_events.h"
+#include "launchpad.h"
+#include "midi_packets.h"
+#include "mpe.h"
+#include "outbound_queue.h"
+#include "platform_stub.h"
+#include "settings.h"
+#include "sustain.h"
+#include "sysex_commands.h"
+#include "tonnetz.h"
+#include "velocity_curves.h"
+
+static int checks = 0;
+static int failures = 0;
+
+#define CHECK(condition) check((condition), #condition, __FILE__, __LINE__)
+
+static void check(bool passed, const char *condition, const char *file, int line) {
+  checks++;
+
+  if (!passed) {
+    failures++;
+    fprintf(stderr, "%s:%d: failed: %s\n", file, line, condition);
+  }
+}
+
+// The same starting point as the firmware, with nothing on the host port.
+static void reset_board_state(struct board_state *board_state) {
+  memset(board_state, 0, sizeof(*board_state));
+
+  board_state->is_dirty = true;
+
+  for (int a = 0; a < 3; a++) {
+    board_state->client.offset_by_cable[a] = 45;
+  }
+
+  for (int idx = 0; idx < MAX_HOST_LAUNCHPADS; idx++) {
+    board_state->host_by_idx[idx].offset = 45;
+  }
+
+  velocity_curves_init(&board_state->velocity_curves);
+  layout_init(&board_state->layout);
+  aftertouch_init(&board_state->aftertouch);
+  mpe_init(&board_state->mpe);
+  chords_init(&board_state->chords);
+  sustain_init(&board_state->sustain);
+  arpeggiator_init(&board_state->arpeggiator);
+}
+
+static bool packet_is(const uint8_t *packet, uint8_t b0, uint8_t b1, uint8_t b2, uint8_t b3) {
+  return packet[0] == b0 && packet[1] == b1 && packet[2] == b2 && packet[3] == b3;
+}
+
+// Sysex is sent three bytes at a time with CIN 4, and the last packet says
+// how many bytes it has, 1 to 3 (CIN 5 to 7).
+static void test_sysex_packets(void) {
+  uint8_t packets[8][4];
+  uint32_t consumed = 0;
+
+  const uint8_t six[] = { 0xF0, 0x01, 0x02, 0x03, 0x04, 0xF7 };
+  CHECK(midi_stream_to_packets(1, six, sizeof(six), packets, 8, &consumed) == 2);
+  CHECK(consumed == sizeof(six));
+  CHECK(packet_is(packets[0], 0x14, 0xF0, 0x01, 0x02));
+  CHECK(packet_is(packets[1], 0x17, 0x03, 0x04, 0xF7));
+
+  const uint8_t four[] = { 0xF0, 0x01, 0x02, 0xF7 };
+  CHECK(midi_stream_to_packets(0, four, sizeof(four), packets, 8, &consumed) == 2);
+  CHECK(packet_is(packets[0], 0x04, 0xF0, 0x01, 0x02));
+  CHECK(packet_is(packets[1], 0x05, 0xF7, 0x00, 0x00));
+
+  const uint8_t five[] = { 0xF0, 0x01, 0x02, 0x03, 0xF7 };
+  CHECK(midi_stream_to_packets(0, five, sizeof(five), packets, 8, &consumed) == 2);
+  CHECK(packet_is(packets[1], 0x06, 0x03, 0xF7, 0x00));
+
+  const uint8_t two[] = { 0xF0, 0xF7 };
+  CHECK(midi_stream_to_packets(2, two, sizeof(two), packets, 8, &consumed) == 1);
+  CHECK(packet_is(packets[0], 0x26, 0xF0, 0xF7, 0x00));
+
+  // Channel messages either side of a message, with program change only
+  // having the one data byte.
+  const uint8_t mixed[] = { 0x90, 0x3C, 0x64, 0xF0, 0x7E, 0xF7, 0xC0, 0x05 };
+  CHECK(midi_stream_to_packets(0, mixed, sizeof(mixed), packets, 8, &consumed) == 3);
+  CHECK(consumed == sizeof(mixed));
+  CHECK(packet_is(packets[0], 0x09, 0x90, 0x3C, 0x64));
+  CHECK(packet_is(packets[1], 0x07, 0xF0, 0x7E, 0xF7));
+  CHECK(packet_is(packets[2], 0x0C, 0xC0, 0x05, 0x00));
+
+  // Without the end of the message we can only send whole packets of three,
+  // and leave the rest for later.
+  CHECK(midi_stream_to_packets(0, six, 5, packets, 8, &consumed) == 1);
+  CHECK(consumed == 3);
+  CHECK(midi_stream_to_packets(0, six + consumed, sizeof(six) - consumed, packets, 8, &consumed) == 1);
+  CHECK(packet_is(packets[0], 0x07, 0x03, 0x04, 0xF7));
+
+  // Running out of packets stops part of the way through.
+  CHECK(midi_stream_to_packets(0, six, sizeof(six), packets, 1, &consumed) == 1);
+  CHECK(consumed == 3);
+}
+
+static void test_sysex_buffer(void) {
+  struct sysex_buffer sysex = { 0 };
+  uint8_t message[SYSEX_BUFFER_SIZE];
+  uint8_t packets[16][4];
+  uint32_t consumed = 0;
+
+  for (uint8_t length = 2; length <= SYSEX_BUFFER_SIZE; length++) {
+    message[0] = 0xF0;
+    for (uint8_t a = 1; a < length - 1; a++) {
+      message[a] = a;
+    }
+    message[length - 1] = 0xF7;
+
+    uint32_t packet_count = midi_stream_to_packets(0, message, length, packets, 16, &consumed);
+    uint8_t result = 0;
+    for (uint32_t a = 0; a < packet_count; a++) {
+      result = sysex_buffer_add_packet(&sysex, packets[a]);
+      CHECK(result == 0 || a == packet_count - 1);
+    }
+
+    CHECK(result == length);
+    CHECK(memcmp(sysex.data, message, length) == 0);
+  }
+
+  // Anything too long for the buffer is dropped, and doesn't get in the way
+  // of the next message.
+  uint8_t long_message[SYSEX_BUFFER_SIZE + 4];
+  memset(long_message, 0x01, sizeof(long_message));
+  long_message[0] = 0xF0;
+  long_message[sizeof(long_message) - 1] = 0xF7;
+
+  uint32_t packet_count = midi_stream_to_packets(0, long_message, sizeof(long_message), packets, 16, &consumed);
+  uint8_t result = 0;
+  for (uint32_t a = 0; a < packet_count; a++) {
+    result = sysex_buffer_add_packet(&sysex, packets[a]);
+  }
+  CHECK(result == 0);
+
+  const uint8_t short_packet[4] = { 0x07, 0xF0, 0x01, 0xF7 };
+  CHECK(sysex_buffer_add_packet(&sysex, short_packet) == 3);
+}
+
+// A stand-in for TinyUSB's TX FIFO, which takes up to `writer_space` bytes
+// and keeps everything it's taken in order.
+static uint32_t writer_space = 0;
+static uint8_t written[4096];
+static uint32_t written_length = 0;
+
+static uint32_t limited_write(uint8_t idx, uint8_t cable, const uint8_t *data, uint32_t length) {
+  (void) idx;
+  (void) cable;
+
+  uint32_t taken = length < writer_space ? length : writer_space;
+  memcpy(written + written_length, data, taken);
+  written_length += taken;
+  writer_space -= taken;
+
+  return taken;
+}
+
+static void test_outbound_queue(void) {
+  struct outbound_queue queue = { 0 };
+  uint8_t stream[2048];
+  for (uint32_t a = 0; a < sizeof(stream); a++) {
+    stream[a] = a * 7;
+  }
+
+  // A short write keeps the rest, and anything written after it waits
+  // behind it.
+  writer_space = 10;
+  CHECK(outbound_queue_write(&queue, limited_write, 0, 0, stream, 100) == 100);
+  CHECK(written_length == 10);
+  CHECK(outbound_queue_depth(&queue) == 90);
+  CHECK(queue.stalls == 1);
+
+  CHECK(outbound_queue_write(&queue, limited_write, 0, 0, stream + 100, 50) == 50);
+  CHECK(outbound_queue_depth(&queue) == 140);
+  CHECK(queue.stalls == 2);
+
+  // Resuming carries on from where the write stopped.
+  writer_space = 25;
+  outbound_queue_flush(&queue, limited_write, 0, 0);
+  CHECK(written_length == 35);
+  CHECK(outbound_queue_depth(&queue) == 115);
+
+  writer_space = UINT32_MAX;
+  outbound_queue_flush(&queue, limited_write, 0, 0);
+  CHECK(outbound_queue_depth(&queue) == 0);
+  CHECK(written_length == 150);
+  CHECK(memcmp(written, stream, 150) == 0);
+
+  // Messages that don't fit are turned away whole.
+  writer_space = 0;
+  CHECK(outbound_queue_write(&queue, limited_write, 0, 0, stream, OUTBOUND_QUEUE_SIZE + 1) == 0);
+  CHECK(outbound_queue_write(&queue, limited_write, 0, 0, stream + 150, 300) == 300);
+  CHECK(outbound_queue_write(&queue, limited_write, 0, 0, stream + 450, 300) == 0);
+  CHECK(queue.overflows == 2);
+  CHECK(queue.high_watermark == 300);
+
+  // Round the end of the buffer a few times, a little at a time.
+  uint32_t position = 450;
+  while (position < sizeof(stream)) {
+    uint32_t length = sizeof(stream) - position < 70 ? sizeof(stream) - position : 70;
+    writer_space = 83;
+    CHECK(outbound_queue_write(&queue, limited_write, 0, 0, stream + position, length) == length);
+    position += length;
+  }
+
+  writer_space = UINT32_MAX;
+  outbound_queue_flush(&queue, limited_write, 0, 0);
+  CHECK(written_length == sizeof(stream));
+  CHECK(memcmp(written, stream, sizeof(stream)) == 0);
+}
+
+static void test_custom_velocity_curve(void) {
+  struct velocity_curves curves;
+  velocity_curves_init(&curves);
+
+  // Straight lines between the points.
+  const uint8_t points[] = { 1, 1, 64, 100, 127, 127 };
+  velocity_curves_set_custom(&curves, points, 3);
+  velocity_curves_select(&curves, MK3, VELOCITY_CURVE_CUSTOM);
+
+  const uint8_t *table = curves.table_by_family[MK3];
+  CHECK(table[0] == 0);
+  CHECK(table[1] == 1);
+  CHECK(table[32] == 1 + ((99 * 31) / 63));
+  CHECK(table[64] == 100);
+  CHECK(table[96] == 100 + ((27 * 32) / 63));
+  CHECK(table[127] == 127);
+
+  // Only the selected family uses it.
+  CHECK(curves.table_by_family[MK2][32] == 32);
+
+  // Flat before the first point and after the last, and never zero, which
+  // would be a release.
+  const uint8_t steep[] = { 40, 0, 80, 120 };
+  velocity_curves_set_custom(&curves, steep, 2);
+  CHECK(table[0] == 0);
+  CHECK(table[20] == 1);
+  CHECK(table[60] == 60);
+  CHECK(table[100] == 120);
+  CHECK(curves.custom_point_count == 2);
+  CHECK(memcmp(curves.custom_points, steep, sizeof(steep)) == 0);
+
+  // No points at all is linear.
+  velocity_curves_set_custom(&curves, NULL, 0);
+  for (int velocity = 0; velocity < 128; velocity++) {
+    CHECK(table[velocity] == velocity);
+  }
+}
+
+// The curve applies to presses, and pressure on a held pad goes through as
+// it is.
+static void test_velocity_curve_decode(void) {
+  struct board_state board_state;
+  reset_board_state(&board_state);
+
+  const struct device_profile *profile = profile_for_version(MK3);
+  struct launchpad_sink sink = { .host_or_client = CLIENT, .idx = 0, .cable = profile->client_cable };
+
+  velocity_curves_set_fixed(&board_state.velocity_curves, 90);
+  velocity_curves_select(&board_state.velocity_curves, MK3, VELOCITY_CURVE_FIXED);
+
+  uint8_t pad = 11;
+  int note = tuned_note_for_pad(&board_state.layout, profile->cell_for_pad, 45, pad);
+  uint8_t cable = profile->client_cable << 4;
+
+  uint8_t press[4] = { cable | MIDI_CIN_NOTE_ON, 0x90, pad, 30 };
+  process_incoming_mk3_packet(press, &board_state, &sink);
+  CHECK(board_state.held_note_velocities[note] == 90);
+
+  uint8_t pressure[4] = { cable | MIDI_CIN_POLY_KEYPRESS, 0xA0, pad, 0x80 | 57 };
+  process_incoming_mk3_packet(pressure, &board_state, &sink);
+  CHECK(board_state.held_note_velocities[note] == 57);
+
+  // Pressure on a pad that isn't down doesn't start a note.
+  uint8_t other_pad = 12;
+  int other_note = tuned_note_for_pad(&board_state.layout, profile->cell_for_pad, 45, other_pad);
+  pressure[2] = other_pad;
+  process_incoming_mk3_packet(pressure, &board_state, &sink);
+  CHECK(board_state.held_note_velocities[other_note] == 0);
+
+  uint8_t release[4] = { cable | MIDI_CIN_NOTE_OFF, 0x80, pad, 0 };
+  process_incoming_mk3_packet(release, &board_state, &sink);
+  CHECK(board_state.held_note_velocities[note] == 0);
+}
+
+static bool only_note_in(const uint32_t notes[4], int note) {
+  for (int word = 0; word < 4; word++) {
+    uint32_t expected = (note >> 5) == word ? 1u << (note & 31) : 0;
+    if (notes[word] != expected) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+static bool no_notes_in(const uint32_t notes[4]) {
+  return !(notes[0] | notes[1] | notes[2] | notes[3]);
+}
+
+static void test_sustain_pedal(void) {
+  struct sustain sustain;
+  sustain_init(&sustain);
+  uint32_t released[4];
+
+  // Without the pedal, a release stops the note, and pressure goes through.
+  CHECK(sustain_note_changed(&sustain, 60, 100));
+  CHECK(sustain_note_changed(&sustain, 60, 80));
+  CHECK(sustain_note_changed(&sustain, 60, 0));
+
+  // With it down, the release is held back until the pedal comes up.
+  sustain_set_pedal(&sustain, SUSTAIN_SOURCE_CC, true, released);
+  CHECK(no_notes_in(released));
+  CHECK(sustain_note_changed(&sustain, 60, 100));
+  CHECK(!sustain_note_changed(&sustain, 60, 0));
+
+  // Pressing it again doesn't start it again, and it's sustained again once
+  // it's let go.
+  CHECK(!sustain_note_changed(&sustain, 60, 90));
+  CHECK(!sustain_note_changed(&sustain, 60, 0));
+
+  // A note that's still held when the pedal comes up carries on.
+  CHECK(sustain_note_changed(&sustain, 100, 100));
+
+  // Every source has to let go, and letting go of one that wasn't down does
+  // nothing.
+  sustain_set_pedal(&sustain, SUSTAIN_SOURCE_HOST(0), true, released);
+  sustain_set_pedal(&sustain, SUSTAIN_SOURCE_CC, false, released);
+  CHECK(no_notes_in(released));
+  sustain_set_pedal(&sustain, SUSTAIN_SOURCE_CLIENT(1), false, released);
+  CHECK(no_notes_in(released));
+  sustain_set_pedal(&sustain, SUSTAIN_SOURCE_HOST(0), false, released);
+  CHECK(only_note_in(released, 60));
+
+  CHECK(sustain_note_changed(&sustain, 100, 0));
+}
+
+// Pass a single event from the host port through the main loop's handler.
+static void host_event(struct board_state *board_state, const struct host_event *event) {
+  static struct host_event_queue host_events;
+
+  host_event_queue_push(&host_events, event);
+  host_event_task(board_state, &host_events);
+}
+
+// A Launchpad that goes away with its sustain button down doesn't leave the
+// pedal down.
+static void test_sustain_source_gone(void) {
+  struct board_state board_state;
+  reset_board_state(&board_state);
+
+  const struct device_profile *profile = profile_for_version(MK3);
+
+  struct host_event mount = { .type = HOST_EVENT_MOUNT, .idx = 1, .launchpad_version = MK3 };
+  host_event(&board_state, &mount);
+
+  struct host_event pedal = { .type = HOST_EVENT_PACKET, .idx = 1, .packet = { MIDI_CIN_CONTROL_CHANGE, 0xB0, profile->sustain_control, 127 } };
+  host_event(&board_state, &pedal);
+  CHECK(board_state.sustain.pedal_sources == SUSTAIN_SOURCE_HOST(1));
+
+  set_held_note_velocity(&board_state, 60, 100);
+  set_held_note_velocity(&board_state, 60, 0);
+  CHECK(board_state.held_note_velocities[60] == 100);
+
+  struct host_event unmount = { .type = HOST_EVENT_UNMOUNT, .idx = 1 };
+  host_event(&board_state, &unmount);
+  CHECK(board_state.sustain.pedal_sources == 0);
+  CHECK(board_state.held_note_velocities[60] == 0);
+
+  // The same for a client Launchpad when the computer comes back.
+  uint8_t client_pedal[4] = { (profile->client_cable << 4) | MIDI_CIN_CONTROL_CHANGE, 0xB0, profile->sustain_control, 127 };
+  process_incoming_client_packet(client_pedal, &board_state);
+  CHECK(board_state.sustain.pedal_sources == SUSTAIN_SOURCE_CLIENT(profile->client_cable));
+
+  set_held_note_velocity(&board_state, 62, 100);
+  set_held_note_velocity(&board_state, 62, 0);
+  CHECK(board_state.held_note_velocities[62] == 100);
+
+  initialise_client_launchpads(&board_state);
+  CHECK(board_state.sustain.pedal_sources == 0);
+  CHECK(board_state.held_note_velocities[62] == 0);
+
+  client_packets_reset();
+  tusb_stub_reset();
+}
+
+static void test_sustain_latch(void) {
+  struct sustain sustain;
+  sustain_init(&sustain);
+  uint32_t released[4];
+
+  sustain_set_mode(&sustain, HOLD_MODE_LATCH, released);
+  CHECK(no_notes_in(released));
+
+  // The first press starts the note, and it keeps going once it's let go.
+  CHECK(sustain_note_changed(&sustain, 60, 100));
+  CHECK(!sustain_note_changed(&sustain, 60, 0));
+
+  // The second press doesn't start it again, and it stops when that press is
+  // let go.
+  CHECK(!sustain_note_changed(&sustain, 60, 100));
+  CHECK(sustain_note_changed(&sustain, 60, 0));
+
+  // Leaving latch mode stops the latched notes that aren't held, and the
+  // held ones stop when they're let go.
+  CHECK(sustain_note_changed(&sustain, 62, 100));
+  CHECK(!sustain_note_changed(&sustain, 62, 0));
+  CHECK(sustain_note_changed(&sustain, 127, 100));
+
+  sustain_set_mode(&sustain, HOLD_MODE_NORMAL, released);
+  CHECK(only_note_in(released, 62));
+  CHECK(sustain_note_changed(&sustain, 127, 0));
+
+  // With the pedal down, latched notes are sustained instead, until it comes
+  // up.
+  sustain_set_mode(&sustain, HOLD_MODE_LATCH, released);
+  CHECK(sustain_note_changed(&sustain, 64, 100));
+  CHECK(!sustain_note_changed(&sustain, 64, 0));
+
+  sustain_set_pedal(&sustain, SUSTAIN_SOURCE_CC, true, released);
+  sustain_set_mode(&sustain, HOLD_MODE_NORMAL, released);
+  CHECK(no_notes_in(released));
+
+  sustain_set_pedal(&sustain, SUSTAIN_SOURCE_CC, false, released);
+  CHECK(only_note_in(released, 64));
+}
+
+// Hold the given notes, from nothing, and return what was recognised.
+static struct chord hold_chord(const uint8_t *notes, int count) {
+  struct chord_tracker tracker;
+  chords_init(&tracker);
+
+  for (int a = 0; a < count; a++) {
+    chords_note_changed(&tracker, notes[a], true);
+  }
+
+  return tracker.chord;
+}
+
+static bool chord_is(struct chord chord, uint8_t quality, uint8_t root, uint8_t inversion) {
+  return chord.quality == quality && chord.root == root && chord.inversion == inversion;
+}
+
+static void test_chords(void) {
+  // C major, in root position, both inversions, and spread out over a few
+  // octaves with the root doubled.
+  CHECK(chord_is(hold_chord((const uint8_t[]) { 60, 64, 67 }, 3), CHORD_MAJOR, 0, 0));
+  CHECK(chord_is(hold_chord((const uint8_t[]) { 64, 67, 72 }, 3), CHORD_MAJOR, 0, 1));
+  CHECK(chord_is(hold_chord((const uint8_t[]) { 67, 72, 76 }, 3), CHORD_MAJOR, 0, 2));
+  CHECK(chord_is(hold_chord((const uint8_t[]) { 72, 48, 64, 79 }, 4), CHORD_MAJOR, 0, 0));
+
+  CHECK(chord_is(hold_chord((const uint8_t[]) { 57, 60, 64 }, 3), CHORD_MINOR, 9, 0));
+  CHECK(chord_is(hold_chord((const uint8_t[]) { 65, 67, 71, 74 }, 4), CHORD_DOMINANT_7, 7, 3));
+  CHECK(chord_is(hold_chord((const uint8_t[]) { 59, 62, 65, 69 }, 4), CHORD_HALF_DIMINISHED_7, 11, 0));
+
+  // C F G is both Csus4 and Fsus2, and sus4 comes first.
+  CHECK(chord_is(hold_chord((const uint8_t[]) { 60, 65, 67 }, 3), CHORD_SUS4, 0, 0));
+
+  // Augmented and diminished sevenths are the same shape from every note,
+  // so the bass is the root, and they're never inverted.
+  CHECK(chord_is(hold_chord((const uint8_t[]) { 60, 64, 68 }, 3), CHORD_AUGMENTED, 0, 0));
+  CHECK(chord_is(hold_chord((const uint8_t[]) { 64, 68, 72 }, 3), CHORD_AUGMENTED, 4, 0));
+  CHECK(chord_is(hold_chord((const uint8_t[]) { 68, 60, 76 }, 3), CHORD_AUGMENTED, 0, 0));
+  CHECK(chord_is(hold_chord((const uint8_t[]) { 62, 65, 68, 71 }, 4), CHORD_DIMINISHED_7, 2, 0));
+  CHECK(chord_is(hold_chord((const uint8_t[]) { 71, 74, 77, 80 }, 4), CHORD_DIMINISHED_7, 11, 0));
+
+  // Anything else held means no chord.
+  CHECK(chord_is(hold_chord((const uint8_t[]) { 60, 62, 64, 67 }, 4), CHORD_NONE, 0, 0));
+  CHECK(chord_is(hold_chord((const uint8_t[]) { 60, 67 }, 2), CHORD_NONE, 0, 0));
+
+  // Changes are only reported when the chord (or its inversion) changes.
+  struct chord_tracker tracker;
+  chords_init(&tracker);
+  CHECK(!chords_note_changed(&tracker, 60, true));
+  CHECK(!chords_note_changed(&tracker, 64, true));
+  CHECK(chords_note_changed(&tracker, 67, true));
+  CHECK(!chords_note_changed(&tracker, 67, true));
+  CHECK(!chords_note_changed(&tracker, 72, true));
+  CHECK(chords_note_changed(&tracker, 60, false));
+  CHECK(chord_is(tracker.chord, CHORD_MAJOR, 0, 1));
+  CHECK(!chords_note_changed(&tracker, 61, false));
+  CHECK(chords_note_changed(&tracker, 64, false));
+  CHECK(!chords_recognised(&tracker));
+}
+
+static void test_mpe_allocator(void) {
+  struct mpe_output output;
+  mpe_init(&output);
+
+  struct mpe_config config = { .mode = OUTPUT_MPE, .zone = MPE_LOWER_ZONE, .member_count = 3 };
+  mpe_configure(&output, &config);
+  mpe_apply_config(&output);
+
+  struct mpe_allocator *allocator = &output.allocator;
+  uint8_t stolen = 0;
+
+  // Members count up from channel 2 (1 here).
+  uint8_t channels[3];
+  for (int a = 0; a < 3; a++) {
+    channels[a] = mpe_allocate(allocator, 60 + a, &stolen);
+    CHECK(stolen == MPE_NO_VOICE);
+    CHECK(channels[a] >= 1 && channels[a] <= 3);
+  }
+  CHECK(channels[0] != channels[1] && channels[1] != channels[2] && channels[0] != channels[2]);
+
+  // A note that already has a voice keeps it.
+  CHECK(mpe_allocate(allocator, 61, &stolen) == channels[1]);
+  CHECK(stolen == MPE_NO_VOICE);
+
+  // With every voice busy, the oldest note is stolen, and then has nothing
+  // to release.
+  CHECK(mpe_allocate(allocator, 63, &stolen) == channels[0]);
+  CHECK(stolen == 60);
+  CHECK(allocator->steals == 1);
+  CHECK(mpe_channel_for_note(allocator, 60) == MPE_NO_VOICE);
+  CHECK(mpe_release(allocator, 60) == MPE_NO_VOICE);
+
+  // The next oldest goes next.
+  CHECK(mpe_allocate(allocator, 64, &stolen) == channels[1]);
+  CHECK(stolen == 61);
+
+  // Released voices are reused oldest release first, without stealing.
+  CHECK(mpe_release(allocator, 62) == channels[2]);
+  CHECK(mpe_release(allocator, 63) == channels[0]);
+  CHECK(mpe_allocate(allocator, 65, &stolen) == channels[2]);
+  CHECK(stolen == MPE_NO_VOICE);
+  CHECK(mpe_allocate(allocator, 66, &stolen) == channels[0]);
+  CHECK(stolen == MPE_NO_VOICE);
+
+  // 64 is now the oldest.
+  CHECK(mpe_allocate(allocator, 67, &stolen) == channels[1]);
+  CHECK(stolen == 64);
+  CHECK(allocator->steals == 3);
+
+  // The upper zone counts down from channel 15 (14 here).
+  config.zone = MPE_UPPER_ZONE;
+  config.member_count = MPE_MAX_MEMBERS;
+  mpe_configure(&output, &config);
+  mpe_apply_config(&output);
+  CHECK(mpe_channel_for_note(allocator, 65) == MPE_NO_VOICE);
+
+  uint16_t used_channels = 0;
+  for (int a = 0; a < MPE_MAX_MEMBERS; a++) {
+    uint8_t channel = mpe_allocate(allocator, a, &stolen);
+    CHECK(stolen == MPE_NO_VOICE);
+    CHECK(channel <= 14);
+    used_channels |= 1u << channel;
+  }
+  CHECK(used_channels == 0x7FFF);
+}
+
+// Everything written to a client cable since the last tusb_stub_reset, as a
+// stream.
+static uint32_t client_stream(uint8_t cable, uint8_t *stream, uint32_t max_length) {
+  size_t log_length = 0;
+  const uint8_t *log = tusb_stub_log(&log_length);
+  uint32_t length = 0;
+
+  for (size_t a = 0; a + 4 <= log_length; a += 4 + log[a + 3]) {
+    if (log[a] == TUSB_STUB_DEVICE && log[a + 2] == cable && length + log[a + 3] <= max_length) {
+      memcpy(stream + length, log + a + 4, log[a + 3]);
+      length += log[a + 3];
+    }
+  }
+
+  return length;
+}
+
+// A reply to a query that doesn't fit in what's left of the batch waits for
+// the next pass rather than going out in pieces.
+static void test_deferred_replies(void) {
+  static const uint8_t queries[] = {
+    SYSEX_LATENCY_QUERY,
+    SYSEX_PACKET_STATS_QUERY,
+    SYSEX_STRESS_QUERY,
+    SYSEX_BOOT_TIMELINE_QUERY,
+    SYSEX_ARPEGGIATOR_QUERY
+  };
+
+  struct board_state board_state;
+  reset_board_state(&board_state);
+
+  for (size_t q = 0; q < sizeof(queries); q++) {
+    client_packets_reset();
+    tusb_stub_reset();
+
+    const uint8_t note[4] = { 0x09, 0x90, 0x3C, 0x64 };
+    while (client_packets_depth() < CLIENT_PACKETS_SIZE - 2) {
+      client_packets_write(note);
+    }
+
+    const uint8_t query[4] = { 0xF0, SYSEX_MANUFACTURER_ID, queries[q], 0xF7 };
+    process_sysex_command(&board_state, query, sizeof(query));
+    CHECK(client_packets_depth() == CLIENT_PACKETS_SIZE - 2);
+
+    client_packets_flush();
+    sysex_commands_task(&board_state);
+    uint32_t depth = client_packets_depth();
+    CHECK(depth > 2);
+
+    // Only once.
+    sysex_commands_task(&board_state);
+    CHECK(client_packets_depth() == depth);
+
+    client_packets_flush();
+
+    uint8_t stream[256];
+    uint32_t length = client_stream(3, stream, sizeof(stream));
+    CHECK((length + 2) / 3 == depth);
+    CHECK(length > 4 && stream[0] == 0xF0 && stream[2] == queries[q] && stream[length - 1] == 0xF7);
+    CHECK(memchr(stream + 1, 0xF0, length - 1) == NULL);
+  }
+
+  client_packets_reset();
+  tusb_stub_reset();
+}
+
+// Saves a record with the given client offset, the way the main loop would,
+// i.e. once it's stayed the same for long enough.
+static uint64_t save_offset(struct board_state *board_state, uint8_t offset, uint64_t now_us) {
+  board_state->client.offset_by_cable[0] = offset;
+
+  settings_task(board_state, now_us);
+  now_us += SETTINGS_STABLE_US + SETTINGS_CHECK_INTERVAL_US;
+  settings_task(board_state, now_us);
+
+  return now_us + SETTINGS_CHECK_INTERVAL_US;
+}
+
+// Clear a bit in the payload of the given record, so that its CRC fails.
+static void corrupt_record(uint32_t slot) {
+  uint32_t record_offset = slot * SETTINGS_RECORD_SIZE;
+  uint32_t page_offset = record_offset - (record_offset % SETTINGS_PAGE_SIZE);
+
+  uint8_t page[SETTINGS_PAGE_SIZE];
+  memcpy(page, settings_flash_contents() + page_offset, sizeof(page));
+  page[(record_offset - page_offset) + 8] &= 0xFE;
+
+  settings_flash_program(page_offset, page);
+}
+
+static uint8_t loaded_offset(void) {
+  struct board_state board_state;
+  reset_board_state(&board_state);
+  settings_load(&board_state);
+
+  return board_state.client.offset_by_cable[0];
+}
+
+// The settings log lives in module state, so this runs once, as a single
+// boot followed by a few "reboots" (loads into a fresh board state).
+static void test_settings_log(void) {
+  const struct settings_stats *stats = settings_stats();
+
+  struct board_state board_state;
+  reset_board_state(&board_state);
+
+  // A fresh log loads nothing.
+  settings_load(&board_state);
+  settings_prepare();
+  CHECK(stats->loaded_sequence == 0);
+  CHECK(board_state.client.offset_by_cable[0] == 45);
+
+  // Fill the first sector and go part of the way into the second, so that
+  // the newest record isn't in the first sector we look at. Odd offsets
+  // only, so that corrupt_record always changes something.
+  uint64_t now_us = 1000000;
+  uint32_t record_count = SETTINGS_RECORDS_PER_SECTOR + 4;
+  for (uint32_t a = 0; a < record_count; a++) {
+    now_us = save_offset(&board_state, (a * 2) + 1, now_us);
+  }
+
+  CHECK(stats->saves == record_count);
+  CHECK(stats->failed_saves == 0);
+
+  // Nothing changed, so nothing more is saved.
+  now_us = save_offset(&board_state, board_state.client.offset_by_cable[0], now_us);
+  CHECK(stats->saves == record_count);
+
+  CHECK(loaded_offset() == ((record_count - 1) * 2) + 1);
+  CHECK(stats->loaded_sequence == record_count);
+  CHECK(stats->bad_records == 0);
+
+  // A bad CRC falls back to the record before it.
+  corrupt_record(record_count - 1);
+  CHECK(loaded_offset() == ((record_count - 2) * 2) + 1);
+  CHECK(stats->loaded_sequence == record_count - 1);
+  CHECK(stats->bad_records == 1);
+
+  // Including back into the previous sector.
+  for (uint32_t slot = SETTINGS_RECORDS_PER_SECTOR; slot < record_count - 1; slot++) {
+    corrupt_record(slot);
+  }
+
+  uint32_t bad_records = stats->bad_records;
+  CHECK(loaded_offset() == ((SETTINGS_RECORDS_PER_SECTOR - 1) * 2) + 1);
+  CHECK(stats->loaded_sequence == SETTINGS_RECORDS_PER_SECTOR);
+  CHECK(stats->bad_records == bad_records + (record_count - SETTINGS_RECORDS_PER_SECTOR));
+
+  // The next save carries on after the newest record, bad or not, with the
+  // next sequence number.
+  reset_board_state(&board_state);
+  settings_load(&board_state);
+  now_us = save_offset(&board_state, 99, now_us);
+  CHECK(stats->saves == record_count + 1);
+  CHECK(loaded_offset() == 99);
+  CHECK(stats->loaded_sequence == record_count + 1);
+
+  // Nothing is saved while there's a Launchpad on the host port, and the
+  // change is saved once it's gone.
+  board_state.host_by_idx[0].launchpad_version = MK3;
+  now_us = save_offset(&board_state, 101, now_us);
+  now_us = save_offset(&board_state, 101, now_us);
+  CHECK(stats->saves == record_count + 1);
+
+  board_state.host_by_idx[0].launchpad_version = UNkNOWN;
+  now_us = save_offset(&board_state, 101, now_us);
+  CHECK(stats->saves == record_count + 2);
+  CHECK(loaded_offset() == 101);
+
+  // A rig that's never without a Launchpad on the host port saves when it's
+  // asked to, straight away, and that's what's there at the next boot.
+  board_state.host_by_idx[0].launchpad_version = MK3;
+  now_us = save_offset(&board_state, 103, now_us);
+  CHECK(stats->saves == record_count + 2);
+
+  const uint8_t save_now[4] = { 0xF0, SYSEX_MANUFACTURER_ID, SYSEX_SAVE_SETTINGS, 0xF7 };
+  process_sysex_command(&board_state, save_now, sizeof(save_now));
+  settings_task(&board_state, now_us);
+  CHECK(stats->saves == record_count + 3);
+  CHECK(loaded_offset() == 103);
+
+  // Including a change made a moment ago, and nothing is saved if nothing
+  // has changed.
+  board_state.client.offset_by_cable[0] = 105;
+  process_sysex_command(&board_state, save_now, sizeof(save_now));
+  settings_task(&board_state, now_us + 1);
+  CHECK(stats->saves == record_count + 4);
+  CHECK(loaded_offset() == 105);
+
+  process_sysex_command(&board_state, save_now, sizeof(save_now));
+  settings_task(&board_state, now_us + 2);
+  now_us = save_offset(&board_state, 105, now_us + 3);
+  CHECK(stats->saves == record_count + 4);
+  CHECK(stats->failed_saves == 0);
+  board_state.host_by_idx[0].launchpad_version = UNkNOWN;
+}
+
+// Step through the pattern, and check the notes played against the given
+// ones.
+static bool arpeggiates(struct arpeggiator *arpeggiator, const uint8_t *expected, int count) {
+  for (int a = 0; a < count; a++) {
+    uint8_t base_note = 0;
+    uint8_t note = arpeggiator_next_note(arpeggiator, &base_note);
+
+    if (note != expected[a] || base_note % 12 != note % 12) {
+      fprintf(stderr, "step %d: expected %d, got %d (from %d)\n", a, expected[a], note, base_note);
+      return false;
+    }
+  }
+
+  return true;
+}
+
+static void start_arpeggiator(struct arpeggiator *arpeggiator, uint8_t mode, uint8_t octaves, const uint8_t *notes, int count) {
+  arpeggiator_init(arpeggiator);
+
+  struct arp_config config = { mode, ARP_DEFAULT_RATE, ARP_DEFAULT_GATE, octaves };
+  arpeggiator_configure(arpeggiator, &config);
+  arpeggiator_apply_config(arpeggiator);
+
+  for (int a = 0; a < count; a++) {
+    arpeggiator_note_changed(arpeggiator, notes[a], true);
+  }
+}
+
+static void test_arpeggiator_patterns(void) {
+  struct arpeggiator arpeggiator;
+
+  // Pressed out of order, so that as played is different from up.
+  const uint8_t chord[] = { 64, 60, 67 };
+
+  start_arpeggiator(&arpeggiator, ARP_UP, 2, chord, 3);
+  CHECK(arpeggiates(&arpeggiator, (const uint8_t[]) { 60, 64, 67, 72, 76, 79, 60, 64 }, 8));
+
+  start_arpeggiator(&arpeggiator, ARP_DOWN, 2, chord, 3);
+  CHECK(arpeggiates(&arpeggiator, (const uint8_t[]) { 79, 76, 72, 67, 64, 60, 79, 76 }, 8));
+
+  // The top and bottom notes aren't played twice on the way round.
+  start_arpeggiator(&arpeggiator, ARP_UP_DOWN, 2, chord, 3);
+  CHECK(arpeggiates(&arpeggiator, (const uint8_t[]) { 60, 64, 67, 72, 76, 79, 76, 72, 67, 64, 60, 64, 67 }, 13));
+
+  start_arpeggiator(&arpeggiator, ARP_AS_PLAYED, 2, chord, 3);
+  CHECK(arpeggiates(&arpeggiator, (const uint8_t[]) { 64, 60, 67, 76, 72, 79, 64, 60 }, 8));
+
+  // Taking a note out carries on with the note after it, whether it's the
+  // one just played, one before it, or the first.
+  start_arpeggiator(&arpeggiator, ARP_AS_PLAYED, 2, chord, 3);
+  CHECK(arpeggiates(&arpeggiator, (const uint8_t[]) { 64, 60 }, 2));
+  arpeggiator_note_changed(&arpeggiator, 60, false);
+  CHECK(arpeggiates(&arpeggiator, (const uint8_t[]) { 67, 76, 79, 64 }, 4));
+  arpeggiator_note_changed(&arpeggiator, 64, false);
+  CHECK(arpeggiates(&arpeggiator, (const uint8_t[]) { 67, 79, 67 }, 3));
+
+  start_arpeggiator(&arpeggiator, ARP_AS_PLAYED, 2, chord, 3);
+  CHECK(arpeggiates(&arpeggiator, (const uint8_t[]) { 64, 60, 67, 76 }, 4));
+  arpeggiator_note_changed(&arpeggiator, 64, false);
+  CHECK(arpeggiates(&arpeggiator, (const uint8_t[]) { 72, 79, 60 }, 3));
+
+  // New notes go in as they come, up and down.
+  start_arpeggiator(&arpeggiator, ARP_UP, 2, chord, 3);
+  CHECK(arpeggiates(&arpeggiator, (const uint8_t[]) { 60, 64 }, 2));
+  arpeggiator_note_changed(&arpeggiator, 62, true);
+  arpeggiator_note_changed(&arpeggiator, 65, true);
+  CHECK(arpeggiates(&arpeggiator, (const uint8_t[]) { 65, 67, 72, 74, 76, 77, 79, 60, 62 }, 9));
+
+  // Octaves above the top note fold back down.
+  const uint8_t high[] = { 120, 124 };
+  start_arpeggiator(&arpeggiator, ARP_UP, 2, high, 2);
+  CHECK(arpeggiates(&arpeggiator, (const uint8_t[]) { 120, 124, 120, 124 }, 4));
+
+  // Random only ever plays the held notes, in the octaves asked for.
+  start_arpeggiator(&arpeggiator, ARP_RANDOM, 2, chord, 3);
+  uint32_t seen = 0;
+  for (int a = 0; a < 200; a++) {
+    uint8_t base_note = 0;
+    uint8_t note = arpeggiator_next_note(&arpeggiator, &base_note);
+    CHECK(memchr(chord, base_note, sizeof(chord)) != NULL);
+    CHECK(note == base_note || note == base_note + 12);
+    seen |= 1u << (note - 60);
+  }
+  CHECK(seen == ((1u << 0) | (1u << 4) | (1u << 7) | (1u << 12) | (1u << 16) | (1u << 19)));
+
+  // Once everything's let go, the pattern starts from the beginning.
+  start_arpeggiator(&arpeggiator, ARP_UP, 2, chord, 3);
+  CHECK(arpeggiates(&arpeggiator, (const uint8_t[]) { 60, 64, 67, 72 }, 4));
+  for (int a = 0; a < 3; a++) {
+    arpeggiator_note_changed(&arpeggiator, chord[a], false);
+  }
+  uint8_t base_note = 0;
+  CHECK(arpeggiator_next_note(&arpeggiator, &base_note) == ARP_NO_NOTE);
+  arpeggiator_note_changed(&arpeggiator, 67, true);
+  CHECK(arpeggiates(&arpeggiator, (const uint8_t[]) { 67, 79, 67 }, 3));
+}
+
+// Run a pass of the main loop at the given time.
+static void run_pass(struct board_state *board_state, struct paint_scheduler *paint_scheduler, uint32_t now_us) {
+  static struct host_event_queue host_events;
+
+  platform_stub_set_clock(now_us);
+  tonnetz_task(board_state, &host_events, paint_scheduler, now_us);
+}
+
+// Passes that come late skip the steps that went by in the meantime, and
+// count them.
+static void test_arpeggiator_missed_steps(void) {
+  struct board_state board_state;
+  reset_board_state(&board_state);
+  client_packets_reset();
+
+  struct paint_scheduler paint_scheduler;
+  paint_scheduler_init(&paint_scheduler, DEFAULT_FRAME_INTERVAL_US);
+
+  // A step every 100ms, with the note lasting 50ms of it.
+  struct arp_config config = { ARP_UP, 600, 50, 1 };
+  arpeggiator_configure(&board_state.arpeggiator, &config);
+
+  uint32_t start_us = 1000000;
+  run_pass(&board_state, &paint_scheduler, start_us);
+
+  set_held_note_velocity(&board_state, 60, 100);
+  set_held_note_velocity(&board_state, 64, 100);
+
+  // The first step is straight away.
+  run_pass(&board_state, &paint_scheduler, start_us + 1000);
+  struct arpeggiator *arpeggiator = &board_state.arpeggiator;
+  CHECK(arpeggiator->steps == 1);
+  CHECK(arpeggiator->missed_steps == 0);
+  CHECK(arpeggiator->playing_note == 60);
+
+  // Its gate closes.
+  run_pass(&board_state, &paint_scheduler, start_us + 60000);
+  CHECK(arpeggiator->playing_note == ARP_NO_NOTE);
+
+  // Steps 2 to 4 go by (4's gate closing at 351ms) before the next pass.
+  run_pass(&board_state, &paint_scheduler, start_us + 360000);
+  CHECK(arpeggiator->steps == 1);
+  CHECK(arpeggiator->missed_steps == 3);
+  CHECK(arpeggiator->playing_note == ARP_NO_NOTE);
+
+  run_pass(&board_state, &paint_scheduler, start_us + 420000);
+  CHECK(arpeggiator->steps == 2);
+  CHECK(arpeggiator->missed_steps == 3);
+  CHECK(arpeggiator->playing_note == 60 || arpeggiator->playing_note == 64);
+
+  // A late pass that's still inside a step's gate plays it, late.
+  run_pass(&board_state, &paint_scheduler, start_us + 530000);
+  CHECK(arpeggiator->steps == 3);
+  CHECK(arpeggiator->missed_steps == 3);
+  CHECK(arpeggiator->note_lateness.max_us >= 29000);
+
+  // Stop everything, so that the alarm isn't left pointing at this board.
+  set_held_note_velocity(&board_state, 60, 0);
+  set_held_note_velocity(&board_state, 64, 0);
+  run_pass(&board_state, &paint_scheduler, start_us + 600000);
+  run_pass(&board_state, &paint_scheduler, start_us + 700000);
+  CHECK(!arpeggiator->is_running);
+
+  client_packets_reset();
+  tusb_stub_reset();
+  platform_stub_use_real_clock();
+}
+
+// Resetting the stats while the alarm is running leaves its histogram to the
+// alarm, which clears it before it next adds to it.
+static void test_arpeggiator_stats_reset(void) {
+  struct arpeggiator arpeggiator;
+  arpeggiator_init(&arpeggiator);
+
+  struct arp_config config = { ARP_UP, 600, 100, 1 };
+  arpeggiator_configure(&arpeggiator, &config);
+  arpeggiator_apply_config(&arpeggiator);
+  arpeggiator_note_changed(&arpeggiator, 60, true);
+
+  // A step every 100ms, with the alarm a millisecond late.
+  platform_stub_set_clock(1000000);
+  arpeggiator_start(&arpeggiator, 1000000);
+  platform_stub_set_clock(1101000);
+  CHECK(arpeggiator.alarm_lateness.count == 1);
+  CHECK(arpeggiator.alarm_lateness.max_us == 1000);
+
+  arpeggiator_reset_stats(&arpeggiator);
+  CHECK(arpeggiator.alarm_lateness_reset_pending);
+
+  platform_stub_set_clock(1200000);
+  CHECK(!arpeggiator.alarm_lateness_reset_pending);
+  CHECK(arpeggiator.alarm_lateness.count == 1);
+  CHECK(arpeggiator.alarm_lateness.max_us == 0);
+
+  // The state and when its step was due always go together.
+  uint32_t state = 0;
+  uint32_t step_due_us = 0;
+  arpeggiator_read_alarm(&arpeggiator, &state, &step_due_us);
+  CHECK(state >> 1 == 3);
+  CHECK(step_due_us == 1200000);
+
+  // Once the alarm's stopped, it's cleared straight away.
+  arpeggiator_reset_stats(&arpeggiator);
+  arpeggiator_stop(&arpeggiator);
+  CHECK(!arpeggiator.alarm_lateness_reset_pending);
+  CHECK(arpeggiator.alarm_lateness.count == 0);
+
+  arpeggiator_reset_stats(&arpeggiator);
+  CHECK(!arpeggiator.alarm_lateness_reset_pending);
+
+  platform_stub_use_real_clock();
+}
+
+// Replay captured records onto a fresh board (the way launchpad-replay does,
+// for client packets), and return what was written, as the tusb_stub log.
+static uint32_t replay_records(const struct capture_record *records, uint32_t count, bool with_settings, uint8_t *out, uint32_t max_length) {
+  struct board_state board_state;
+  reset_board_state(&board_state);
+  client_packets_reset();
+  tusb_stub_reset();
+
+  struct paint_scheduler paint_scheduler;
+  paint_scheduler_init(&paint_scheduler, DEFAULT_FRAME_INTERVAL_US);
+
+  struct capture_settings settings = { 0 };
+  uint32_t first = 0;
+  while (first < count && capture_settings_add(&settings, &records[first])) {
+    first++;
+  }
+
+  if (with_settings) {
+    CHECK(capture_settings_complete(&settings));
+    CHECK(settings.format == SETTINGS_PAYLOAD_FORMAT);
+    CHECK(settings_apply(&board_state, settings.payload, settings.length));
+  }
+
+  initialise_client_launchpads(&board_state);
+
+  uint32_t length = 0;
+  for (uint32_t a = first; a <= count; a++) {
+    uint32_t now_us = a < count ? records[a].timestamp_us : records[count - 1].timestamp_us + 100000;
+    if (a < count && records[a].source == CAPTURE_CLIENT_PACKET) {
+      tusb_stub_queue_device_packet(records[a].packet);
+    }
+
+    for (int pass = 0; pass < 50; pass++) {
+      run_pass(&board_state, &paint_scheduler, now_us + (pass * 1000));
+    }
+
+    size_t log_length;
+    const uint8_t *log = tusb_stub_log(&log_length);
+    if (length + log_length <= max_length) {
+      memcpy(out + length, log, log_length);
+      length += log_length;
+    }
+    tusb_stub_reset();
+  }
+
+  client_packets_reset();
+  return length;
+}
+
+// A capture starts with the settings in effect when recording started, and a
+// replay that applies them gets the same output every time.
+static void test_capture_settings(void) {
+  struct board_state board_state;
+  reset_board_state(&board_state);
+  client_packets_reset();
+  tusb_stub_reset();
+
+  struct paint_scheduler paint_scheduler;
+  paint_scheduler_init(&paint_scheduler, DEFAULT_FRAME_INTERVAL_US);
+
+  board_state.client.offset_by_cable[0] = 30;
+  layout_select(&board_state.layout, LAYOUT_WICKI_HAYDEN);
+
+  uint32_t now_us = 2000000;
+  platform_stub_set_clock(now_us);
+  const uint8_t start[5] = { 0xF0, SYSEX_MANUFACTURER_ID, SYSEX_CAPTURE, 0x01, 0xF7 };
+  process_sysex_command(&board_state, start, sizeof(start));
+  CHECK(capture_is_recording());
+
+  // Notes from the computer, which light up whichever pads play them.
+  static const uint8_t notes[] = { 60, 64, 67 };
+  for (size_t a = 0; a < sizeof(notes); a++) {
+    const uint8_t note_on[4] = { 0x09, 0x90, notes[a], 0x64 };
+    tusb_stub_queue_device_packet(note_on);
+    now_us += 20000;
+    run_pass(&board_state, &paint_scheduler, now_us);
+  }
+
+  capture_stop();
+  client_packets_reset();
+  tusb_stub_reset();
+
+  // Through the file format and back.
+  uint8_t header[CAPTURE_HEADER_SIZE];
+  capture_header_encode(header);
+  CHECK(capture_header_check(header));
+
+  struct capture_record records[64];
+  uint32_t count = capture_read(0, records, 64);
+  CHECK(count > sizeof(notes));
+  CHECK(count == capture_count());
+
+  for (uint32_t a = 0; a < count; a++) {
+    uint8_t bytes[CAPTURE_RECORD_SIZE];
+    capture_record_encode(&records[a], bytes);
+    capture_record_decode(bytes, &records[a]);
+  }
+
+  CHECK(records[0].source == CAPTURE_SETTINGS);
+  CHECK(records[count - 1].source == CAPTURE_CLIENT_PACKET);
+
+  // The settings come back as they were.
+  struct capture_settings settings = { 0 };
+  uint32_t a = 0;
+  while (a < count && capture_settings_add(&settings, &records[a])) {
+    a++;
+  }
+  CHECK(capture_settings_complete(&settings));
+  CHECK(records[a].source == CAPTURE_CLIENT_PACKET);
+
+  struct board_state replayed;
+  reset_board_state(&replayed);
+  CHECK(settings_apply(&replayed, settings.payload, settings.length));
+
+  uint8_t expected[SETTINGS_PAYLOAD_MAX_SIZE];
+  uint8_t actual[SETTINGS_PAYLOAD_MAX_SIZE];
+  uint8_t expected_length = settings_encode(&board_state, expected);
+  CHECK(settings.length == expected_length);
+  CHECK(settings_encode(&replayed, actual) == expected_length);
+  CHECK(memcmp(actual, expected, expected_length) == 0);
+  CHECK(replayed.client.offset_by_cable[0] == 30);
+
+  // Twice gives the same output, and it isn't what the defaults give.
+  static uint8_t first[16384];
+  static uint8_t second[16384];
+  uint32_t first_length = replay_records(records, count, true, first, sizeof(first));
+  uint32_t second_length = replay_records(records, count, true, second, sizeof(second));
+  CHECK(first_length > 0 && first_length < sizeof(first));
+  CHECK(first_length == second_length && memcmp(first, second, first_length) == 0);
+
+  uint32_t defaults_length = replay_records(records, count, false, second, sizeof(second));
+  CHECK(defaults_length != first_length || memcmp(first, second, first_length) != 0);
+
+  // A payload of the wrong length is turned away.
+  CHECK(!settings_apply(&replayed, settings.payload, settings.length - 1));
+}
+
+int main(void) {
+  test_sysex_packets();
+  test_sysex_buffer();
+  test_outbound_queue();
+  test_custom_velocity_curve();
+  test_velocity_curve_decode();
+  test_deferred_replies();
+  test_mpe_allocator();
+  test_chords();
+  test_sustain_pedal();
+  test_sustain_latch();
+  test_sustain_source_gone();
+  test_arpeggiator_stats_reset();
+  test_arpeggiator_patterns();
+  test_arpeggiator_missed_steps();
+  test_settings_log();
+  test_capture_settings();
+
+  printf("%d checks, %d failed\n", checks, failures);
+
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,249 @@
+#include <string.h>
+#include "tusb.h"
+#include "tusb_stub.h"
+#include "midi_packets.h"
+
+#define TUSB_STUB_QUEUE_SIZE 1024
+#define TUSB_STUB_LOG_SIZE (4 * 1024 * 1024)
+
+static struct tusb_stub_stats device_stats[TUSB_STUB_CABLES];
+static struct tusb_stub_stats host_stats[TUSB_STUB_HOST_DEVICES];
+
+static bool host_mounted[TUSB_STUB_HOST_DEVICES];
+
+static uint32_t tx_space = TUSB_STUB_UNLIMITED;
+
+static uint8_t incoming_packets[TUSB_STUB_QUEUE_SIZE][4];
+static uint32_t incoming_head = 0;
+static uint32_t incoming_tail = 0;
+
+// Packets written to the host side are put back together into messages, so
+// that they're counted and logged the same way as stream writes.
+static uint8_t host_message[TUSB_STUB_HOST_DEVICES][512];
+static uint32_t host_message_length[TUSB_STUB_HOST_DEVICES];
+
+// The same, for packets written to the device side.
+static uint8_t device_message[TUSB_STUB_CABLES][512];
+static uint32_t device_message_length[TUSB_STUB_CABLES];
+
+static uint8_t log_buffer[TUSB_STUB_LOG_SIZE];
+static size_t log_length = 0;
+
+// Work out how many USB-MIDI event packets TinyUSB's stream parser would
+// produce for a buffer. Sysex carries three bytes per packet, everything else
+// we send is one packet per message.
+static uint32_t count_packets(uint8_t const *buffer, uint32_t bufsize) {
+  uint32_t packets = 0;
+  uint32_t i = 0;
+
+  while (i < bufsize) {
+    uint8_t status = buffer[i];
+
+    if (status == 0xF0) {
+      uint32_t sysex_end = i;
+      while (sysex_end < bufsize && buffer[sysex_end] != 0xF7) {
+        sysex_end++;
+      }
+
+      uint32_t sysex_length = sysex_end - i + 1;
+      packets += (sysex_length + 2) / 3;
+      i = sysex_end + 1;
+    }
+    else if (status >= 0x80) {
+      uint8_t type = status & 0xF0;
+      packets++;
+      i += (type == 0xC0 || type == 0xD0) ? 2 : 3;
+    }
+    // Stray data bytes, TinyUSB would drop these.
+    else {
+      i++;
+    }
+  }
+
+  return packets;
+}
+
+static void record_write(enum TusbStubSide side, uint8_t idx, uint8_t cable_num, struct tusb_stub_stats *stats, uint8_t const *buffer, uint32_t bufsize) {
+  stats->messages++;
+  stats->bytes += bufsize;
+  stats->packets += count_packets(buffer, bufsize);
+
+  if (bufsize <= 255 && log_length + 4 + bufsize <= sizeof(log_buffer)) {
+    log_buffer[log_length++] = side;
+    log_buffer[log_length++] = idx;
+    log_buffer[log_length++] = cable_num;
+    log_buffer[log_length++] = bufsize;
+    memcpy(log_buffer + log_length, buffer, bufsize);
+    log_length += bufsize;
+  }
+}
+
+void tusb_stub_reset(void) {
+  memset(device_stats, 0, sizeof(device_stats));
+  memset(host_stats, 0, sizeof(host_stats));
+  log_length = 0;
+}
+
+struct tusb_stub_stats tusb_stub_device_stats(uint8_t cable) {
+  return device_stats[cable % TUSB_STUB_CABLES];
+}
+
+struct tusb_stub_stats tusb_stub_host_stats(uint8_t idx) {
+  return host_stats[idx % TUSB_STUB_HOST_DEVICES];
+}
+
+struct tusb_stub_stats tusb_stub_total_stats(void) {
+  struct tusb_stub_stats total = { 0 };
+
+  for (int a = 0; a < TUSB_STUB_CABLES; a++) {
+    total.messages += device_stats[a].messages;
+    total.bytes += device_stats[a].bytes;
+    total.packets += device_stats[a].packets;
+  }
+
+  for (int a = 0; a < TUSB_STUB_HOST_DEVICES; a++) {
+    total.messages += host_stats[a].messages;
+    total.bytes += host_stats[a].bytes;
+    total.packets += host_stats[a].packets;
+  }
+
+  return total;
+}
+
+bool tusb_stub_queue_device_packet(const uint8_t packet[4]) {
+  if (incoming_head - incoming_tail >= TUSB_STUB_QUEUE_SIZE) {
+    return false;
+  }
+
+  memcpy(incoming_packets[incoming_head % TUSB_STUB_QUEUE_SIZE], packet, 4);
+  incoming_head++;
+  return true;
+}
+
+void tusb_stub_set_host_mounted(uint8_t idx, bool mounted) {
+  host_mounted[idx % TUSB_STUB_HOST_DEVICES] = mounted;
+}
+
+void tusb_stub_set_tx_space(uint32_t bytes) {
+  tx_space = bytes;
+}
+
+// Returns how many of the bytes fit, and takes them from the space left.
+static uint32_t take_tx_space(uint32_t bytes) {
+  if (tx_space == TUSB_STUB_UNLIMITED) {
+    return bytes;
+  }
+
+  if (bytes > tx_space) {
+    bytes = tx_space;
+  }
+
+  tx_space -= bytes;
+  return bytes;
+}
+
+const uint8_t *tusb_stub_log(size_t *length) {
+  *length = log_length;
+  return log_buffer;
+}
+
+// Stand-ins for the TinyUSB calls
+
+uint32_t tud_midi_available(void) {
+  return incoming_head - incoming_tail;
+}
+
+bool tud_midi_packet_read(uint8_t packet[4]) {
+  if (incoming_head == incoming_tail) {
+    return false;
+  }
+
+  memcpy(packet, incoming_packets[incoming_tail % TUSB_STUB_QUEUE_SIZE], 4);
+  incoming_tail++;
+  return true;
+}
+
+bool tud_midi_packet_write(uint8_t const packet[4]) {
+  record_write(TUSB_STUB_DEVICE, 0, packet[0] >> 4, &device_stats[(packet[0] >> 4) % TUSB_STUB_CABLES], packet + 1, midi_packet_length(packet));
+  return true;
+}
+
+// Each packet takes four bytes of TX space, and packets are all or nothing.
+uint32_t tud_midi_packet_write_n(uint8_t const packets[], uint32_t bufsize) {
+  uint32_t written = 0;
+
+  while (written + 4 <= bufsize) {
+    const uint8_t *packet = packets + written;
+    uint8_t cable = (packet[0] >> 4) % TUSB_STUB_CABLES;
+    uint8_t length = midi_packet_length(packet);
+
+    if (tx_space != TUSB_STUB_UNLIMITED && tx_space < 4) {
+      break;
+    }
+    take_tx_space(4);
+
+    if (device_message_length[cable] + length <= sizeof(device_message[cable])) {
+      memcpy(device_message[cable] + device_message_length[cable], packet + 1, length);
+      device_message_length[cable] += length;
+    }
+
+    if ((packet[0] & 0x0F) != MIDI_CIN_SYSEX_START) {
+      record_write(TUSB_STUB_DEVICE, 0, cable, &device_stats[cable], device_message[cable], device_message_length[cable]);
+      device_message_length[cable] = 0;
+    }
+
+    written += 4;
+  }
+
+  return written;
+}
+
+uint32_t tud_midi_stream_write(uint8_t cable_num, uint8_t const* buffer, uint32_t bufsize) {
+  bufsize = take_tx_space(bufsize);
+
+  if (bufsize) {
+    record_write(TUSB_STUB_DEVICE, 0, cable_num, &device_stats[cable_num % TUSB_STUB_CABLES], buffer, bufsize);
+  }
+
+  return bufsize;
+}
+
+bool tuh_midi_mounted(uint8_t idx) {
+  return host_mounted[idx % TUSB_STUB_HOST_DEVICES];
+}
+
+uint32_t tuh_midi_stream_write(uint8_t idx, uint8_t cable_num, uint8_t const* buffer, uint32_t bufsize) {
+  record_write(TUSB_STUB_HOST, idx, cable_num, &host_stats[idx % TUSB_STUB_HOST_DEVICES], buffer, bufsize);
+  return bufsize;
+}
+
+bool tuh_midi_packet_write(uint8_t idx, uint8_t const packet[4]) {
+  idx %= TUSB_STUB_HOST_DEVICES;
+
+  uint8_t cin = packet[0] & 0x0F;
+  uint8_t length = midi_packet_length(packet);
+
+  // Packets are all or nothing.
+  if (tx_space != TUSB_STUB_UNLIMITED && tx_space < length) {
+    return false;
+  }
+  take_tx_space(length);
+
+  if (host_message_length[idx] + length <= sizeof(host_message[idx])) {
+    memcpy(host_message[idx] + host_message_length[idx], packet + 1, length);
+    host_message_length[idx] += length;
+  }
+
+  // Everything but the start (or middle) of a sysex ends a message.
+  if (cin != MIDI_CIN_SYSEX_START) {
+    record_write(TUSB_STUB_HOST, idx, packet[0] >> 4, &host_stats[idx], host_message[idx], host_message_length[idx]);
+    host_message_length[idx] = 0;
+  }
+
+  return true;
+}
+
+uint32_t tuh_midi_write_flush(uint8_t idx) {
+  (void) idx;
+  return 0;
+}
@@ -0,0 +1,94 @@
+#!/usr/bin/env python3
+"""Show how long a Launchpad Tonnetz took to start up.
+
+Asks the device when each step of starting up happened (see
+src/boot_timeline.h and src/sysex_commands.h), and prints each one with the
+time since the one before. Run it straight after plugging in (and pressing a
+pad, if you want to see the first note).
+
+Requires python-rtmidi (pip install python-rtmidi).
+
+Usage: boot_timeline.py [--port Notes]
+"""
+
+import argparse
+import sys
+import time
+
+import rtmidi
+
+MANUFACTURER_ID = 0x7D
+BOOT_TIMELINE_QUERY = 0x11
+
+EVENTS = [
+    "main",
+    "state ready",
+    "settings prepared",
+    "device stack started",
+    "host stack started",
+    "device mounted",
+    "client painted",
+    "host mounted",
+    "host painted",
+    "first note",
+]
+
+
+def find_port(midi, name):
+    for index, port_name in enumerate(midi.get_ports()):
+        if "Tonnetz" in port_name and name in port_name:
+            return index
+
+    sys.exit("Can't find a Launchpad Tonnetz port matching '%s', ports are: %s" % (name, midi.get_ports()))
+
+
+def wait_for(midi_in, matches, timeout=1.0):
+    deadline = time.perf_counter() + timeout
+    while time.perf_counter() < deadline:
+        message = midi_in.get_message()
+        if message and matches(message[0]):
+            return message[0]
+    return None
+
+
+def septets(data):
+    value = 0
+    for byte in data:
+        value = (value << 7) | byte
+    return value
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--port", default="Notes", help="the port to use (default: Notes)")
+    args = parser.parse_args()
+
+    midi_in = rtmidi.MidiIn()
+    midi_out = rtmidi.MidiOut()
+    midi_in.ignore_types(sysex=False)
+    midi_in.open_port(find_port(midi_in, args.port))
+    midi_out.open_port(find_port(midi_out, args.port))
+
+    midi_out.send_message([0xF0, MANUFACTURER_ID, BOOT_TIMELINE_QUERY, 0xF7])
+
+    reply = wait_for(midi_in, lambda m: m[:3] == [0xF0, MANUFACTURER_ID, BOOT_TIMELINE_QUERY])
+    if reply is None:
+        sys.exit("No reply to the boot timeline query")
+
+    values = reply[3:-1]
+    previous = 0
+    for index, event in enumerate(EVENTS):
+        at_us = septets(values[index * 5:(index * 5) + 5])
+        if not at_us:
+            print("%-24s not yet" % event)
+            continue
+
+        # The steps don't always happen in this order (the host stack usually
+        # starts long before the computer mounts us), so this is the time
+        # since the last step listed that has happened.
+        print("%-24s %10.3f ms (+%.3f ms)" % (event, at_us / 1000, (at_us - previous) / 1000))
+        previous = at_us
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,114 @@
+#!/usr/bin/env python3
+"""Record a session on a Launchpad Tonnetz and save it as a capture file.
+
+Starts recording everything the device receives (from both ports), waits
+until you press Enter, then reads the recording back and writes it to a file
+that can be replayed with the Linux build (see host/replay.c), for example:
+
+    ./scripts/capture.py session.lptz
+    ./build-host/host/launchpad-replay session.lptz session.out
+
+See src/capture.h for the file format, and src/sysex_commands.h for the
+messages used.
+
+Requires python-rtmidi (pip install python-rtmidi).
+
+Usage: capture.py [--port Notes] <output>
+"""
+
+import argparse
+import sys
+import time
+
+import rtmidi
+
+MANUFACTURER_ID = 0x7D
+CAPTURE = 0x08
+CAPTURE_DUMP = 0x09
+
+CAPTURE_HEADER = b"LPTZ\x02\x00\x00\x00"
+CAPTURE_RECORD_SIZE = 10
+
+
+def find_port(midi, name):
+    for index, port_name in enumerate(midi.get_ports()):
+        if "Tonnetz" in port_name and name in port_name:
+            return index
+
+    sys.exit("Can't find a Launchpad Tonnetz port matching '%s', ports are: %s" % (name, midi.get_ports()))
+
+
+def septets(data):
+    value = 0
+    for byte in data:
+        value = (value << 7) | byte
+    return value
+
+
+def unpack(data):
+    """Undo the packing used for dumps, i.e. a byte of top bits for every seven bytes."""
+    unpacked = bytearray()
+    for group in range(0, len(data), 8):
+        top_bits = data[group]
+        for index, byte in enumerate(data[group + 1:group + 8]):
+            unpacked.append(byte | (((top_bits >> index) & 1) << 7))
+    return bytes(unpacked)
+
+
+def read_dump(midi_in, midi_out, timeout=5.0):
+    midi_out.send_message([0xF0, MANUFACTURER_ID, CAPTURE_DUMP, 0xF7])
+
+    records = bytearray()
+    deadline = time.perf_counter() + timeout
+    while time.perf_counter() < deadline:
+        message = midi_in.get_message()
+        if not message:
+            time.sleep(0.001)
+            continue
+
+        data = message[0]
+        if data[:3] != [0xF0, MANUFACTURER_ID, CAPTURE_DUMP]:
+            continue
+
+        first = septets(data[3:8])
+        count = data[8]
+        if count == 0:
+            return bytes(records), data[9] == 1
+
+        if first * CAPTURE_RECORD_SIZE != len(records):
+            sys.exit("Missed part of the dump (expected record %d, got %d)" % (len(records) // CAPTURE_RECORD_SIZE, first))
+
+        records.extend(unpack(data[9:-1])[:count * CAPTURE_RECORD_SIZE])
+        deadline = time.perf_counter() + timeout
+
+    sys.exit("Timed out reading the dump")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--port", default="Notes", help="the port to use (default: Notes)")
+    parser.add_argument("output", help="the capture file to write")
+    args = parser.parse_args()
+
+    midi_in = rtmidi.MidiIn()
+    midi_out = rtmidi.MidiOut()
+    midi_in.ignore_types(sysex=False)
+    midi_in.open_port(find_port(midi_in, args.port))
+    midi_out.open_port(find_port(midi_out, args.port))
+
+    midi_out.send_message([0xF0, MANUFACTURER_ID, CAPTURE, 0x01, 0xF7])
+    input("Recording, press Enter to stop... ")
+
+    records, overflowed = read_dump(midi_in, midi_out)
+    if overflowed:
+        print("The recording ran out of room, only the start of the session was kept", file=sys.stderr)
+
+    with open(args.output, "wb") as output:
+        output.write(CAPTURE_HEADER)
+        output.write(records)
+
+    print("Wrote %d records to %s" % (len(records) // CAPTURE_RECORD_SIZE, args.output))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,145 @@
+#!/usr/bin/env python3
+"""Measure round-trip latency through a Launchpad Tonnetz over USB.
+
+Sends notes to the "Notes" port and times how long it takes for them to come
+back, first in loopback mode (i.e. just the USB round trip), then through the
+full path (decoding, sync_playing_notes and back out). Then asks the device
+for its own latency histograms, see src/latency.h and src/sysex_commands.h,
+and for the arpeggiator's timing, if it's been used (see src/arpeggiator.h).
+
+Requires python-rtmidi (pip install python-rtmidi).
+
+Usage: latency.py [--port Notes] [--count 500]
+"""
+
+import argparse
+import statistics
+import sys
+import time
+
+import rtmidi
+
+MANUFACTURER_ID = 0x7D
+LATENCY_QUERY = 0x01
+LATENCY_RESET = 0x02
+LOOPBACK = 0x03
+ARPEGGIATOR_QUERY = 0x13
+
+STAGES = ["host queue", "note out", "total"]
+
+
+def find_port(midi, name):
+    for index, port_name in enumerate(midi.get_ports()):
+        if "Tonnetz" in port_name and name in port_name:
+            return index
+
+    sys.exit("Can't find a Launchpad Tonnetz port matching '%s', ports are: %s" % (name, midi.get_ports()))
+
+
+def wait_for(midi_in, matches, timeout=1.0):
+    deadline = time.perf_counter() + timeout
+    while time.perf_counter() < deadline:
+        message = midi_in.get_message()
+        if message and matches(message[0]):
+            return time.perf_counter(), message[0]
+    return None, None
+
+
+def round_trips(midi_in, midi_out, count):
+    times = []
+    for a in range(count):
+        note = 36 + (a % 48)
+
+        for velocity in (100, 0):
+            status = 0x90 if velocity else 0x80
+            sent = time.perf_counter()
+            midi_out.send_message([status, note, velocity])
+
+            received, _ = wait_for(midi_in, lambda m: len(m) == 3 and m[0] & 0xF0 == status and m[1] == note)
+            if received is None:
+                print("Timed out waiting for note %d" % note, file=sys.stderr)
+                continue
+
+            times.append((received - sent) * 1000000)
+
+    return times
+
+
+def report(name, times):
+    if not times:
+        print("%-24s no samples" % name)
+        return
+
+    times.sort()
+    p99 = times[min(len(times) - 1, int(len(times) * 0.99))]
+    print("%-24s %8.0f us p50 %8.0f us p99 %8.0f us max (%d samples)" % (
+        name, statistics.median(times), p99, times[-1], len(times)))
+
+
+def septets(data):
+    value = 0
+    for byte in data:
+        value = (value << 7) | byte
+    return value
+
+
+def query_device(midi_in, midi_out):
+    midi_out.send_message([0xF0, MANUFACTURER_ID, LATENCY_QUERY, 0xF7])
+
+    _, reply = wait_for(midi_in, lambda m: m[:3] == [0xF0, MANUFACTURER_ID, LATENCY_QUERY])
+    if reply is None:
+        print("No reply to the latency query", file=sys.stderr)
+        return
+
+    values = reply[3:-1]
+    for index, stage in enumerate(STAGES):
+        count, p50, p99, maximum = (septets(values[(index * 20) + (field * 5):(index * 20) + (field * 5) + 5]) for field in range(4))
+        print("%-24s %8d us p50 %8d us p99 %8d us max (%d samples)" % ("device: " + stage, p50, p99, maximum, count))
+
+
+def query_arpeggiator(midi_in, midi_out):
+    midi_out.send_message([0xF0, MANUFACTURER_ID, ARPEGGIATOR_QUERY, 0xF7])
+
+    _, reply = wait_for(midi_in, lambda m: m[:3] == [0xF0, MANUFACTURER_ID, ARPEGGIATOR_QUERY])
+    if reply is None:
+        print("No reply to the arpeggiator query", file=sys.stderr)
+        return
+
+    values = [septets(reply[3 + (index * 5):3 + (index * 5) + 5]) for index in range(10)]
+    notes, missed = values[0:2]
+    if not notes and not missed:
+        return
+
+    for index, name in enumerate(["arp alarm late", "arp note late"]):
+        count, p50, p99, maximum = values[2 + (index * 4):6 + (index * 4)]
+        print("%-24s %8d us p50 %8d us p99 %8d us max (%d samples)" % ("device: " + name, p50, p99, maximum, count))
+    print("%-24s %8d notes, %d steps missed" % ("device: arpeggiator", notes, missed))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--port", default="Notes", help="the port to use (default: Notes)")
+    parser.add_argument("--count", type=int, default=500, help="notes to send in each test (default: 500)")
+    args = parser.parse_args()
+
+    midi_in = rtmidi.MidiIn()
+    midi_out = rtmidi.MidiOut()
+    midi_in.ignore_types(sysex=False)
+    midi_in.open_port(find_port(midi_in, args.port))
+    midi_out.open_port(find_port(midi_out, args.port))
+
+    midi_out.send_message([0xF0, MANUFACTURER_ID, LOOPBACK, 0x01, 0xF7])
+    time.sleep(0.1)
+    report("loopback round trip", round_trips(midi_in, midi_out, args.count))
+
+    midi_out.send_message([0xF0, MANUFACTURER_ID, LOOPBACK, 0x00, 0xF7])
+    midi_out.send_message([0xF0, MANUFACTURER_ID, LATENCY_RESET, 0xF7])
+    time.sleep(0.1)
+    report("note round trip", round_trips(midi_in, midi_out, args.count))
+
+    query_device(midi_in, midi_out)
+    query_arpeggiator(midi_in, midi_out)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,110 @@
+#!/usr/bin/env python3
+"""Run the self-test on a Launchpad Tonnetz and print the results.
+
+The device generates poly aftertouch and pad presses for each client
+Launchpad (and each Launchpad on its host port), plus notes on the "Notes"
+port, for the given number of seconds, then reports how much it generated and
+whether anything was dropped. See src/stress.h, and host/stress.c for the
+same load run against the Linux build, for example:
+
+    ./scripts/stress.py --pressure 2000 --notes 500 --seconds 10
+
+Everything the device sends while the test is running is read and thrown
+away.
+
+Requires python-rtmidi (pip install python-rtmidi).
+
+Usage: stress.py [--port Notes] [--seconds 10] [--pressure 1000] [--pads 20] [--notes 500]
+"""
+
+import argparse
+import sys
+import time
+
+import rtmidi
+
+MANUFACTURER_ID = 0x7D
+STRESS_START = 0x0A
+STRESS_QUERY = 0x0B
+
+REPORT_FIELDS = [
+    "pressure events",
+    "pad events",
+    "note events",
+    "events behind",
+    "passes",
+    "longest pass (us)",
+    "client packets sent",
+    "client packets deferred",
+    "outbound messages dropped",
+    "deepest outbound queue (bytes)",
+    "running",
+]
+
+
+def find_port(midi, name):
+    for index, port_name in enumerate(midi.get_ports()):
+        if "Tonnetz" in port_name and name in port_name:
+            return index
+
+    sys.exit("Can't find a Launchpad Tonnetz port matching '%s', ports are: %s" % (name, midi.get_ports()))
+
+
+def septets(data):
+    value = 0
+    for byte in data:
+        value = (value << 7) | byte
+    return value
+
+
+def rate(value):
+    return [(value >> 14) & 0x7F, (value >> 7) & 0x7F, value & 0x7F]
+
+
+def query(midi_in, midi_out, timeout=2.0):
+    midi_out.send_message([0xF0, MANUFACTURER_ID, STRESS_QUERY, 0xF7])
+
+    deadline = time.perf_counter() + timeout
+    while time.perf_counter() < deadline:
+        message = midi_in.get_message()
+        if not message:
+            time.sleep(0.001)
+            continue
+
+        data = message[0]
+        if data[:3] == [0xF0, MANUFACTURER_ID, STRESS_QUERY]:
+            return [septets(data[3 + (5 * a):8 + (5 * a)]) for a in range(len(REPORT_FIELDS))]
+
+    sys.exit("Timed out waiting for the self-test report")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--port", default="Notes", help="the port to use (default: Notes)")
+    parser.add_argument("--seconds", type=int, default=10, help="how long to run for (default: 10, at most 127)")
+    parser.add_argument("--pressure", type=int, default=1000, help="aftertouch events/s per Launchpad (default: 1000)")
+    parser.add_argument("--pads", type=int, default=20, help="pad presses and releases/s per Launchpad (default: 20)")
+    parser.add_argument("--notes", type=int, default=500, help="note ons and offs/s on the Notes port (default: 500)")
+    args = parser.parse_args()
+
+    midi_in = rtmidi.MidiIn()
+    midi_out = rtmidi.MidiOut()
+    midi_in.ignore_types(sysex=False)
+    midi_in.open_port(find_port(midi_in, args.port))
+    midi_out.open_port(find_port(midi_out, args.port))
+
+    midi_out.send_message([0xF0, MANUFACTURER_ID, STRESS_START, min(args.seconds, 127)] +
+                          rate(args.pressure) + rate(args.pads) + rate(args.notes) + [0xF7])
+
+    # Keep reading, so that the device's output never backs up on our side.
+    deadline = time.perf_counter() + args.seconds + 0.5
+    while time.perf_counter() < deadline:
+        if not midi_in.get_message():
+            time.sleep(0.001)
+
+    for name, value in zip(REPORT_FIELDS, query(midi_in, midi_out)):
+        print("%-32s %d" % (name, value))
+
+
+if __name__ == "__main__":
+    main()
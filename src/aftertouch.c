@@ -0,0 +1,12 @@
+#include <string.h>
+#include "aftertouch.h"
+
+void aftertouch_init(struct aftertouch_coalescer *coalescer) {
+  memset(coalescer, 0, sizeof(*coalescer));
+  aftertouch_configure(coalescer, DEFAULT_AFTERTOUCH_INTERVAL_US, DEFAULT_AFTERTOUCH_DEADBAND);
+}
+
+void aftertouch_configure(struct aftertouch_coalescer *coalescer, uint32_t interval_us, uint8_t deadband) {
+  coalescer->interval_us = interval_us;
+  coalescer->deadband = deadband > 127 ? 127 : deadband;
+}
@@ -0,0 +1,81 @@
+#ifndef _AFTERTOUCH_H_
+#define _AFTERTOUCH_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// The MK2 and MK3 send a continuous stream of poly aftertouch while pads are
+// held. Only the latest pressure for each note is kept (see pending_notes in
+// launchpad.h), and it's sent at most once per interval, and only if it has
+// moved by more than the deadband since the last pressure we sent, so that
+// aftertouch alone can't fill the USB link. Note ons and offs are never held
+// back.
+
+// 100 updates a second per note.
+#define DEFAULT_AFTERTOUCH_INTERVAL_US 10000
+
+// Ignore changes of one either way, i.e. jitter from a pad that's being held
+// still.
+#define DEFAULT_AFTERTOUCH_DEADBAND 1
+
+enum AftertouchDecision {
+    AFTERTOUCH_SEND,
+
+    // Too soon since the last update for this note, try again later.
+    AFTERTOUCH_WAIT,
+
+    // Within the deadband, i.e. not worth sending at all.
+    AFTERTOUCH_DROP
+};
+
+struct aftertouch_coalescer {
+    // The shortest time between two updates for the same note. Zero sends
+    // every change.
+    uint32_t interval_us;
+
+    // Changes of at most this much from the last pressure sent are dropped.
+    uint8_t deadband;
+
+    // When each note (or its pressure) was last sent.
+    uint32_t last_sent_us[128];
+
+    uint32_t sent;
+
+    // Changes that were replaced by a later one before they were sent, and
+    // changes that were dropped by the deadband.
+    uint32_t replaced;
+    uint32_t dropped;
+};
+
+void aftertouch_init(struct aftertouch_coalescer*);
+
+void aftertouch_configure(struct aftertouch_coalescer*, uint32_t, uint8_t);
+
+// Whether to send a pressure change for a note now, given the pressure we
+// last sent for it.
+static inline enum AftertouchDecision aftertouch_check(const struct aftertouch_coalescer *coalescer, uint8_t note, uint8_t sent_pressure, uint8_t pressure, uint32_t now_us) {
+  int change = pressure - sent_pressure;
+  if (change <= coalescer->deadband && change >= -coalescer->deadband) {
+    return AFTERTOUCH_DROP;
+  }
+
+  if (now_us - coalescer->last_sent_us[note] < coalescer->interval_us) {
+    return AFTERTOUCH_WAIT;
+  }
+
+  return AFTERTOUCH_SEND;
+}
+
+static inline void aftertouch_mark_sent(struct aftertouch_coalescer *coalescer, uint8_t note, uint32_t now_us) {
+  coalescer->last_sent_us[note] = now_us;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _AFTERTOUCH_H_ */
@@ -0,0 +1,367 @@
+#include <string.h>
+#include "arpeggiator.h"
+
+// The arpeggiator the alarm works for (see arpeggiator_init).
+static struct arpeggiator *alarm_arpeggiator = NULL;
+
+// The next note in the set above (or below) the given one, or -1 if there
+// isn't one. Either can start from just outside the range, i.e. -1 or 128.
+static int next_above(const uint32_t note_set[4], int note) {
+  int start = note + 1;
+
+  for (int word = start >> 5; word < 4; word++) {
+    uint32_t bits = note_set[word];
+    if (word == start >> 5) {
+      bits &= ~0u << (start & 31);
+    }
+
+    if (bits) {
+      return (word << 5) + __builtin_ctz(bits);
+    }
+  }
+
+  return -1;
+}
+
+static int next_below(const uint32_t note_set[4], int note) {
+  int end = note - 1;
+
+  for (int word = end >> 5; word >= 0; word--) {
+    uint32_t bits = note_set[word];
+    if (word == end >> 5 && (end & 31) != 31) {
+      bits &= (1u << ((end & 31) + 1)) - 1;
+    }
+
+    if (bits) {
+      return (word << 5) + 31 - __builtin_clz(bits);
+    }
+  }
+
+  return -1;
+}
+
+static void reset_position(struct arpeggiator *arpeggiator) {
+  arpeggiator->position = ARP_NO_NOTE;
+  arpeggiator->octave = 0;
+  arpeggiator->is_going_down = false;
+}
+
+void arpeggiator_init(struct arpeggiator *arpeggiator) {
+  memset(arpeggiator, 0, sizeof(*arpeggiator));
+
+  arpeggiator->requested = (struct arp_config) { ARP_OFF, ARP_DEFAULT_RATE, ARP_DEFAULT_GATE, 1 };
+  arpeggiator_apply_config(arpeggiator);
+
+  arpeggiator->playing_note = ARP_NO_NOTE;
+
+  // Any seed but zero will do for xorshift, and a fixed one means a replay
+  // (see capture.h) always plays the same "random" notes.
+  arpeggiator->random_state = 0x2545F491;
+
+  alarm_arpeggiator = arpeggiator;
+}
+
+void arpeggiator_configure(struct arpeggiator *arpeggiator, const struct arp_config *config) {
+  arpeggiator->requested = *config;
+
+  if (arpeggiator->requested.mode >= ARP_MODE_COUNT) {
+    arpeggiator->requested.mode = ARP_OFF;
+  }
+
+  if (arpeggiator->requested.rate < ARP_MIN_RATE) {
+    arpeggiator->requested.rate = ARP_MIN_RATE;
+  }
+  else if (arpeggiator->requested.rate > ARP_MAX_RATE) {
+    arpeggiator->requested.rate = ARP_MAX_RATE;
+  }
+
+  if (arpeggiator->requested.gate < 1) {
+    arpeggiator->requested.gate = 1;
+  }
+  else if (arpeggiator->requested.gate > 100) {
+    arpeggiator->requested.gate = 100;
+  }
+
+  if (arpeggiator->requested.octaves < 1) {
+    arpeggiator->requested.octaves = 1;
+  }
+  else if (arpeggiator->requested.octaves > ARP_MAX_OCTAVES) {
+    arpeggiator->requested.octaves = ARP_MAX_OCTAVES;
+  }
+
+  arpeggiator->reconfigure_pending = true;
+}
+
+void arpeggiator_apply_config(struct arpeggiator *arpeggiator) {
+  arpeggiator_stop(arpeggiator);
+
+  arpeggiator->active = arpeggiator->requested;
+  arpeggiator->reconfigure_pending = false;
+
+  arpeggiator->step_us = 60000000 / arpeggiator->active.rate;
+  arpeggiator->gate_us = arpeggiator->step_us * arpeggiator->active.gate / 100;
+
+  reset_position(arpeggiator);
+}
+
+void arpeggiator_note_changed(struct arpeggiator *arpeggiator, uint8_t note, bool is_sounding) {
+  note &= 0x7F;
+
+  uint32_t *word = &arpeggiator->note_set[note >> 5];
+  uint32_t bit = 1u << (note & 31);
+
+  if (is_sounding) {
+    if ((*word & bit) || arpeggiator->note_count == ARP_MAX_NOTES) {
+      return;
+    }
+
+    *word |= bit;
+    arpeggiator->notes[arpeggiator->note_count++] = note;
+    return;
+  }
+
+  if (!(*word & bit)) {
+    return;
+  }
+
+  *word &= ~bit;
+
+  for (uint8_t a = 0; a < arpeggiator->note_count; a++) {
+    if (arpeggiator->notes[a] == note) {
+      memmove(&arpeggiator->notes[a], &arpeggiator->notes[a + 1], arpeggiator->note_count - a - 1);
+      arpeggiator->note_count--;
+
+      // Playing them as played, the position is an index into `notes`, so
+      // it has to move back with everything after the note. If it was the
+      // note we're on, the next step plays whichever note took its place,
+      // which means stepping back into the previous octave when it was the
+      // first.
+      if (arpeggiator->active.mode == ARP_AS_PLAYED && arpeggiator->position != ARP_NO_NOTE && a <= arpeggiator->position) {
+        if (arpeggiator->position > 0) {
+          arpeggiator->position--;
+        }
+        else {
+          arpeggiator->position = arpeggiator->note_count - 1;
+          arpeggiator->octave = (arpeggiator->octave + arpeggiator->active.octaves - 1) % arpeggiator->active.octaves;
+        }
+      }
+      break;
+    }
+  }
+}
+
+// Move up (or down) to the next note, going on to the next octave (or the
+// one before) once there are no more in this one. Returns false if we're
+// already at the top (or bottom).
+static bool step_up(struct arpeggiator *arpeggiator) {
+  int position = arpeggiator->position == ARP_NO_NOTE ? -1 : arpeggiator->position;
+  int note = next_above(arpeggiator->note_set, position);
+
+  if (note < 0) {
+    if (arpeggiator->octave + 1 >= arpeggiator->active.octaves) {
+      return false;
+    }
+
+    arpeggiator->octave++;
+    note = next_above(arpeggiator->note_set, -1);
+  }
+
+  arpeggiator->position = note;
+  return true;
+}
+
+static bool step_down(struct arpeggiator *arpeggiator) {
+  int position = arpeggiator->position == ARP_NO_NOTE ? 128 : arpeggiator->position;
+  int note = next_below(arpeggiator->note_set, position);
+
+  if (note < 0) {
+    if (arpeggiator->octave == 0) {
+      return false;
+    }
+
+    arpeggiator->octave--;
+    note = next_below(arpeggiator->note_set, 128);
+  }
+
+  arpeggiator->position = note;
+  return true;
+}
+
+static uint32_t next_random(struct arpeggiator *arpeggiator) {
+  uint32_t x = arpeggiator->random_state;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  arpeggiator->random_state = x;
+  return x;
+}
+
+uint8_t arpeggiator_next_note(struct arpeggiator *arpeggiator, uint8_t *base_note) {
+  *base_note = ARP_NO_NOTE;
+
+  // Start from the beginning of the pattern next time anything is pressed.
+  if (!arpeggiator->note_count) {
+    reset_position(arpeggiator);
+    return ARP_NO_NOTE;
+  }
+
+  uint8_t octaves = arpeggiator->active.octaves;
+
+  switch (arpeggiator->active.mode) {
+    case ARP_UP:
+      if (!step_up(arpeggiator)) {
+        reset_position(arpeggiator);
+        step_up(arpeggiator);
+      }
+      *base_note = arpeggiator->position;
+      break;
+    case ARP_DOWN:
+      if (arpeggiator->position == ARP_NO_NOTE || !step_down(arpeggiator)) {
+        arpeggiator->position = ARP_NO_NOTE;
+        arpeggiator->octave = octaves - 1;
+        step_down(arpeggiator);
+      }
+      *base_note = arpeggiator->position;
+      break;
+    case ARP_UP_DOWN:
+      // With a single note there's nowhere to go, so it just repeats.
+      if (!arpeggiator->is_going_down) {
+        if (!step_up(arpeggiator)) {
+          arpeggiator->is_going_down = true;
+          step_down(arpeggiator);
+        }
+      }
+      else if (!step_down(arpeggiator)) {
+        arpeggiator->is_going_down = false;
+        step_up(arpeggiator);
+      }
+      *base_note = arpeggiator->position;
+      break;
+    case ARP_AS_PLAYED:
+      // The position is an index into `notes` here.
+      if (arpeggiator->position == ARP_NO_NOTE) {
+        arpeggiator->position = 0;
+        arpeggiator->octave = 0;
+      }
+      else if (++arpeggiator->position >= arpeggiator->note_count) {
+        arpeggiator->position = 0;
+        arpeggiator->octave = (arpeggiator->octave + 1) % octaves;
+      }
+      *base_note = arpeggiator->notes[arpeggiator->position];
+      break;
+    case ARP_RANDOM: {
+      uint32_t random = next_random(arpeggiator);
+      *base_note = arpeggiator->notes[random % arpeggiator->note_count];
+      arpeggiator->octave = (random >> 16) % octaves;
+      break;
+    }
+    default:
+      return ARP_NO_NOTE;
+  }
+
+  int note = *base_note + (12 * arpeggiator->octave);
+  while (note > 127) {
+    note -= 12;
+  }
+
+  return note;
+}
+
+// Runs in the alarm's interrupt (or from the main loop while the alarm is
+// stopped). Each alarm either starts a step, with the gate open, or closes
+// the gate part of the way through one. Times are worked out from when the
+// step was due, so however late the alarm is, it doesn't add up.
+static void advance(struct arpeggiator *arpeggiator) {
+  uint32_t state = arpeggiator->alarm_state;
+
+  if ((state & 1) && arpeggiator->gate_us < arpeggiator->step_us) {
+    arpeggiator->alarm_state = state & ~1u;
+    arpeggiator->next_alarm_us = arpeggiator->step_due_us + arpeggiator->step_us;
+    return;
+  }
+
+  arpeggiator->step_due_us = arpeggiator->next_alarm_us;
+  arpeggiator->alarm_state = (state | 1) + 2;
+  arpeggiator->next_alarm_us += arpeggiator->gate_us < arpeggiator->step_us ? arpeggiator->gate_us : arpeggiator->step_us;
+}
+
+static uint32_t lateness(uint32_t now_us, uint32_t due_us) {
+  int32_t late_us = now_us - due_us;
+  return late_us > 0 ? late_us : 0;
+}
+
+// If we're so late that the next alarm is already due, catch up straight
+// away rather than waiting for the timer to come all the way round.
+static void schedule(struct arpeggiator *arpeggiator) {
+  while (!arpeggiator_alarm_set(arpeggiator->next_alarm_us)) {
+    latency_histogram_add(&arpeggiator->alarm_lateness, lateness(latency_now_us(), arpeggiator->next_alarm_us));
+    advance(arpeggiator);
+  }
+}
+
+void arpeggiator_start(struct arpeggiator *arpeggiator, uint32_t now_us) {
+  reset_position(arpeggiator);
+
+  arpeggiator->alarm_state &= ~1u;
+  arpeggiator->next_alarm_us = now_us;
+  advance(arpeggiator);
+
+  arpeggiator->is_running = true;
+  schedule(arpeggiator);
+}
+
+static void reset_alarm_lateness(struct arpeggiator *arpeggiator) {
+  memset(&arpeggiator->alarm_lateness, 0, sizeof(arpeggiator->alarm_lateness));
+  arpeggiator->alarm_lateness_reset_pending = false;
+}
+
+void arpeggiator_stop(struct arpeggiator *arpeggiator) {
+  arpeggiator->is_running = false;
+  arpeggiator_alarm_cancel();
+
+  // The alarm won't get to it now.
+  if (arpeggiator->alarm_lateness_reset_pending) {
+    reset_alarm_lateness(arpeggiator);
+  }
+}
+
+// The alarm can fire between any two reads, so the state is read again
+// afterwards, and if it's moved on (which it only ever does forwards), we
+// start again.
+void arpeggiator_read_alarm(const struct arpeggiator *arpeggiator, uint32_t *state, uint32_t *step_due_us) {
+  do {
+    *state = arpeggiator->alarm_state;
+    *step_due_us = arpeggiator->step_due_us;
+  } while (*state != arpeggiator->alarm_state);
+}
+
+void arpeggiator_reset_stats(struct arpeggiator *arpeggiator) {
+  // Clearing the alarm's histogram here could be interrupted by the alarm
+  // adding to it, leaving it half cleared.
+  if (arpeggiator->is_running) {
+    arpeggiator->alarm_lateness_reset_pending = true;
+  }
+  else {
+    reset_alarm_lateness(arpeggiator);
+  }
+
+  memset(&arpeggiator->note_lateness, 0, sizeof(arpeggiator->note_lateness));
+  arpeggiator->steps = 0;
+  arpeggiator->missed_steps = 0;
+}
+
+void arpeggiator_alarm_fired(uint32_t now_us) {
+  struct arpeggiator *arpeggiator = alarm_arpeggiator;
+
+  if (!arpeggiator || !arpeggiator->is_running) {
+    return;
+  }
+
+  if (arpeggiator->alarm_lateness_reset_pending) {
+    reset_alarm_lateness(arpeggiator);
+  }
+
+  latency_histogram_add(&arpeggiator->alarm_lateness, lateness(now_us, arpeggiator->next_alarm_us));
+  advance(arpeggiator);
+  schedule(arpeggiator);
+}
@@ -0,0 +1,180 @@
+#ifndef _ARPEGGIATOR_H_
+#define _ARPEGGIATOR_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "latency.h"
+
+// Plays the sounding notes (i.e. held, sustained or latched, see sustain.h)
+// one at a time, in a pattern, instead of all at once.
+//
+// The timing comes from a hardware alarm rather than the main loop, so that
+// a long pass (a burst of painting, say) can't push the steps around. The
+// alarm only keeps time: each time it fires it moves on to the next step (or
+// closes the gate on the current one) and schedules itself for the next,
+// from when that step was due rather than when it fired, so that nothing
+// drifts. The main loop then sends whatever the alarm says is due as soon as
+// it gets to it (sending from the interrupt would mean sharing the USB
+// device stack with the main loop). How late the alarm fires and how late
+// each note goes out are both kept as histograms (see latency.h).
+//
+// While it's on, held notes aren't sent by sync_playing_notes, the
+// arpeggiator sends its own notes (and keeps playing_note_velocities up to
+// date, so that switching it off again starts the held notes properly).
+
+enum ArpMode {
+    ARP_OFF,
+    ARP_UP,
+    ARP_DOWN,
+
+    // Up and back down again, without playing the top and bottom notes
+    // twice.
+    ARP_UP_DOWN,
+
+    // In the order the notes started.
+    ARP_AS_PLAYED,
+
+    ARP_RANDOM,
+
+    ARP_MODE_COUNT
+};
+
+// The most notes we'll arpeggiate at once, anything beyond this is left out.
+#define ARP_MAX_NOTES 32
+
+#define ARP_NO_NOTE 0xFF
+
+// The rate is in steps per minute, i.e. 480 is eighth notes at 120 BPM.
+#define ARP_DEFAULT_RATE 480
+#define ARP_MIN_RATE 30
+#define ARP_MAX_RATE 6000
+
+// The gate is how much of each step the note lasts, as a percentage. At 100%
+// each note lasts until the next one starts.
+#define ARP_DEFAULT_GATE 50
+
+#define ARP_MAX_OCTAVES 4
+
+struct arp_config {
+    uint8_t mode;
+    uint16_t rate;
+    uint8_t gate;
+    uint8_t octaves;
+};
+
+struct arpeggiator {
+    // What we're playing with now, and what we've been asked to switch to
+    // (see arpeggiator_configure).
+    struct arp_config active;
+    struct arp_config requested;
+    bool reconfigure_pending;
+
+    // The sounding notes, in the order they started, and the same notes as a
+    // set of 128 bits, so that the next one up or down is a bit scan away.
+    uint8_t notes[ARP_MAX_NOTES];
+    uint8_t note_count;
+    uint32_t note_set[4];
+
+    // Where we are in the pattern, i.e. the last note played (before
+    // transposing it by `octave`), or its index in `notes` when playing them
+    // as played.
+    uint8_t position;
+    uint8_t octave;
+    bool is_going_down;
+    uint32_t random_state;
+
+    // The note we're sounding, or ARP_NO_NOTE.
+    uint8_t playing_note;
+
+    // The length of each step and of each note, from the active config.
+    uint32_t step_us;
+    uint32_t gate_us;
+
+    // Whether the alarm is running. It's stopped while nothing is sounding,
+    // so that the first note pressed plays straight away.
+    volatile bool is_running;
+
+    // Everything from here to the stats is written by the alarm while it's
+    // running. The number of steps so far and whether the gate is open are
+    // packed into one word, (steps << 1) | gate open, so that the main loop
+    // reads both at once.
+    volatile uint32_t alarm_state;
+    volatile uint32_t step_due_us;
+    uint32_t next_alarm_us;
+
+    // The steps the main loop has acted on.
+    uint32_t steps_taken;
+
+    // How late the alarm fired, and how late each note was written, after
+    // its step was due. Steps that went by before the main loop got to them
+    // are counted in missed_steps.
+    struct latency_histogram alarm_lateness;
+    struct latency_histogram note_lateness;
+    uint32_t steps;
+    uint32_t missed_steps;
+
+    // alarm_lateness is added to by the alarm, so while it's running, the
+    // alarm is the one to clear it (see arpeggiator_reset_stats).
+    volatile bool alarm_lateness_reset_pending;
+};
+
+// Everything starts off, ready to play up one octave at the default rate
+// and gate. There's only one alarm, so this is also the arpeggiator it
+// works for.
+void arpeggiator_init(struct arpeggiator*);
+
+// Ask for a new config. Nothing changes until the main loop has room to stop
+// what's playing (see tonnetz.c).
+void arpeggiator_configure(struct arpeggiator*, const struct arp_config*);
+
+// Start using the requested config. The alarm is stopped, and starts again
+// on the next step.
+void arpeggiator_apply_config(struct arpeggiator*);
+
+static inline bool arpeggiator_is_active(const struct arpeggiator *arpeggiator) {
+  return arpeggiator->active.mode != ARP_OFF;
+}
+
+// Called whenever a note starts or stops sounding, whether or not we're
+// arpeggiating, so that everything that's sounding is ready to go when we
+// start.
+void arpeggiator_note_changed(struct arpeggiator*, uint8_t, bool);
+
+// Start the alarm, with the first step (of the pattern, from the beginning)
+// due now, or stop it.
+void arpeggiator_start(struct arpeggiator*, uint32_t);
+void arpeggiator_stop(struct arpeggiator*);
+
+// Move on to the next note in the pattern, returning it (transposed) and
+// setting the note it came from in the last argument. Returns ARP_NO_NOTE if
+// nothing is sounding.
+uint8_t arpeggiator_next_note(struct arpeggiator*, uint8_t*);
+
+// Read the alarm's state (see above) and when the current step was due,
+// both from the same step.
+void arpeggiator_read_alarm(const struct arpeggiator*, uint32_t*, uint32_t*);
+
+void arpeggiator_reset_stats(struct arpeggiator*);
+
+// Called by the platform when the alarm goes off.
+void arpeggiator_alarm_fired(uint32_t);
+
+// Provided by the platform (pico-launchpad-tonnetz.c, or platform_stub.c on
+// Linux), with times on the same clock as latency_now_us.
+
+// Call arpeggiator_alarm_fired at the given time. Returns false (and doesn't)
+// if that time has already gone.
+bool arpeggiator_alarm_set(uint32_t);
+
+void arpeggiator_alarm_cancel(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _ARPEGGIATOR_H_ */
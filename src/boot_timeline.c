@@ -0,0 +1,25 @@
+#include "boot_timeline.h"
+#include "latency.h"
+
+// BOOT_HOST_STARTED is written by core1, everything else by core0, and
+// each entry only ever has one writer.
+static volatile uint32_t timeline_us[BOOT_EVENT_COUNT];
+
+void boot_timeline_mark(enum BootEvent event) {
+  if (timeline_us[event]) {
+    return;
+  }
+
+  // Zero means "not yet", and the timer can't be at zero by the time we're
+  // running anyway.
+  uint32_t now_us = latency_now_us();
+  timeline_us[event] = now_us ? now_us : 1;
+}
+
+void boot_timeline_restart(enum BootEvent event) {
+  timeline_us[event] = 0;
+}
+
+uint32_t boot_timeline_read(enum BootEvent event) {
+  return timeline_us[event];
+}
@@ -0,0 +1,65 @@
+#ifndef _BOOT_TIMELINE_H_
+#define _BOOT_TIMELINE_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+// When each step of starting up happened, in microseconds since the chip
+// was reset (see latency_now_us), so that we can see how long it takes from
+// power-on (or plugging in) to being able to play. Read it back with
+// SYSEX_BOOT_TIMELINE_QUERY, see sysex_commands.h and
+// scripts/boot_timeline.py.
+//
+// Each step is only recorded the first time it happens. The steps that
+// happen again when something is plugged back in (a mount and the first
+// paint after it) are restarted when it's plugged in, so they always show
+// the latest connection.
+
+enum BootEvent {
+    // The start of main(), i.e. after the boot ROM and the SDK's runtime.
+    BOOT_MAIN,
+
+    // The board state is ready, and the settings have been loaded (see
+    // settings.h).
+    BOOT_STATE_READY,
+
+    // Anything the settings log needed erasing has been.
+    BOOT_SETTINGS_PREPARED,
+
+    // The device stack (tud_init) and the host stack (tuh_init, on core1)
+    // have started.
+    BOOT_DEVICE_STARTED,
+    BOOT_HOST_STARTED,
+
+    // The computer has finished setting us up (tud_mount_cb), and the client
+    // Launchpads have been painted since.
+    BOOT_DEVICE_MOUNTED,
+    BOOT_CLIENT_PAINTED,
+
+    // A Launchpad on the host port has been mounted, and painted since.
+    BOOT_HOST_MOUNTED,
+    BOOT_HOST_PAINTED,
+
+    // The first note was sent, i.e. something was actually played.
+    BOOT_FIRST_NOTE,
+
+    BOOT_EVENT_COUNT
+};
+
+// Record that a step has happened, unless it already has.
+void boot_timeline_mark(enum BootEvent);
+
+// Forget when a step happened, so that the next mark counts.
+void boot_timeline_restart(enum BootEvent);
+
+// When a step happened, or zero if it hasn't yet.
+uint32_t boot_timeline_read(enum BootEvent);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _BOOT_TIMELINE_H_ */
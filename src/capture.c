@@ -0,0 +1,127 @@
+#include <string.h>
+#include "capture.h"
+
+// The records themselves are kept in their encoded form, so that there's no
+// padding.
+static uint8_t records[CAPTURE_BUFFER_RECORDS][CAPTURE_RECORD_SIZE];
+static uint32_t record_count = 0;
+static bool recording = false;
+static bool overflowed = false;
+
+void capture_header_encode(uint8_t header[CAPTURE_HEADER_SIZE]) {
+  memset(header, 0, CAPTURE_HEADER_SIZE);
+  memcpy(header, CAPTURE_MAGIC, 4);
+  header[4] = CAPTURE_FORMAT_VERSION;
+}
+
+bool capture_header_check(const uint8_t header[CAPTURE_HEADER_SIZE]) {
+  return memcmp(header, CAPTURE_MAGIC, 4) == 0 && header[4] >= 1 && header[4] <= CAPTURE_FORMAT_VERSION;
+}
+
+void capture_record_encode(const struct capture_record *record, uint8_t bytes[CAPTURE_RECORD_SIZE]) {
+  bytes[0] = record->timestamp_us & 0xFF;
+  bytes[1] = (record->timestamp_us >> 8) & 0xFF;
+  bytes[2] = (record->timestamp_us >> 16) & 0xFF;
+  bytes[3] = (record->timestamp_us >> 24) & 0xFF;
+  bytes[4] = record->source;
+  bytes[5] = record->idx;
+  memcpy(bytes + 6, record->packet, 4);
+}
+
+void capture_record_decode(const uint8_t bytes[CAPTURE_RECORD_SIZE], struct capture_record *record) {
+  record->timestamp_us = bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | ((uint32_t) bytes[3] << 24);
+  record->source = bytes[4];
+  record->idx = bytes[5];
+  memcpy(record->packet, bytes + 6, 4);
+}
+
+void capture_start(void) {
+  record_count = 0;
+  overflowed = false;
+  recording = true;
+}
+
+void capture_stop(void) {
+  recording = false;
+}
+
+bool capture_is_recording(void) {
+  return recording;
+}
+
+void capture_add(uint32_t timestamp_us, uint8_t source, uint8_t idx, const uint8_t packet[4]) {
+  if (!recording) {
+    return;
+  }
+
+  if (record_count >= CAPTURE_BUFFER_RECORDS) {
+    overflowed = true;
+    recording = false;
+    return;
+  }
+
+  struct capture_record record = { timestamp_us, source, idx, { packet[0], packet[1], packet[2], packet[3] } };
+  capture_record_encode(&record, records[record_count++]);
+}
+
+void capture_add_settings(uint32_t timestamp_us, uint8_t format, const uint8_t *payload, uint8_t length) {
+  uint8_t packet[4] = { format, length, 0, 0 };
+  uint8_t idx = 0;
+  capture_add(timestamp_us, CAPTURE_SETTINGS, idx++, packet);
+
+  for (uint8_t offset = 0; offset < length; offset += 4) {
+    memset(packet, 0, sizeof(packet));
+    memcpy(packet, payload + offset, length - offset < 4 ? length - offset : 4);
+    capture_add(timestamp_us, CAPTURE_SETTINGS, idx++, packet);
+  }
+}
+
+bool capture_settings_add(struct capture_settings *settings, const struct capture_record *record) {
+  if (record->source != CAPTURE_SETTINGS || record->idx != settings->chunk_count) {
+    return false;
+  }
+
+  if (record->idx == 0) {
+    if (record->packet[1] > CAPTURE_SETTINGS_MAX_SIZE) {
+      return false;
+    }
+
+    settings->format = record->packet[0];
+    settings->length = record->packet[1];
+  }
+  else {
+    uint32_t offset = (record->idx - 1) * 4;
+    if (offset >= settings->length) {
+      return false;
+    }
+
+    uint32_t remaining = settings->length - offset;
+    memcpy(settings->payload + offset, record->packet, remaining < 4 ? remaining : 4);
+  }
+
+  settings->chunk_count++;
+  return true;
+}
+
+bool capture_settings_complete(const struct capture_settings *settings) {
+  return settings->chunk_count > 0 && (settings->chunk_count - 1) * 4 >= settings->length;
+}
+
+uint32_t capture_count(void) {
+  return record_count;
+}
+
+bool capture_overflowed(void) {
+  return overflowed;
+}
+
+uint32_t capture_read(uint32_t first, struct capture_record *out, uint32_t max) {
+  uint32_t copied = 0;
+
+  while (copied < max && first + copied < record_count) {
+    capture_record_decode(records[first + copied], &out[copied]);
+    copied++;
+  }
+
+  return copied;
+}
@@ -0,0 +1,118 @@
+#ifndef _CAPTURE_H_
+#define _CAPTURE_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Recording everything that comes in (from both ports) so that a real
+// performance can be replayed through the Linux build (see host/replay.c),
+// for benchmarking and for checking that a change doesn't alter the output.
+//
+// A capture file is an 8 byte header ("LPTZ", the format version, and three
+// zero bytes), followed by 10 byte records:
+//
+// <timestamp (4 bytes, little endian)> <source> <idx> <packet (4 bytes)>
+//
+// Records are in the order the packets were decoded. The timestamp is when
+// the packet arrived (for the host port, when tuh_midi_rx_cb saw it), in
+// microseconds.
+//
+// From version 2, a capture starts with the settings in effect when the
+// recording started (see CAPTURE_SETTINGS), followed by a mount record for
+// each Launchpad that was already on the host port, so that a replay starts
+// from the same place as the session did.
+
+#define CAPTURE_MAGIC "LPTZ"
+#define CAPTURE_FORMAT_VERSION 2
+#define CAPTURE_HEADER_SIZE 8
+#define CAPTURE_RECORD_SIZE 10
+
+enum CaptureSource {
+    // A packet read in midi_client_task.
+    CAPTURE_CLIENT_PACKET,
+
+    // A packet from the Launchpad at `idx` on the host port.
+    CAPTURE_HOST_PACKET,
+
+    // A Launchpad was connected to the host port at `idx`. The first byte of
+    // the packet is its LaunchpadVersion.
+    CAPTURE_HOST_MOUNT,
+
+    CAPTURE_HOST_UNMOUNT,
+
+    // The settings (see settings_encode), split over as many records as they
+    // need, with `idx` counting them. The first one's packet is the payload
+    // format and length (and two zero bytes), and each one after it carries
+    // the next four bytes of the payload.
+    CAPTURE_SETTINGS
+};
+
+// Enough for any settings payload.
+#define CAPTURE_SETTINGS_MAX_SIZE 128
+
+struct capture_record {
+    uint32_t timestamp_us;
+    uint8_t source;
+    uint8_t idx;
+    uint8_t packet[4];
+};
+
+void capture_header_encode(uint8_t[CAPTURE_HEADER_SIZE]);
+
+// Returns false if this isn't a capture (or it's from a later version).
+bool capture_header_check(const uint8_t[CAPTURE_HEADER_SIZE]);
+
+void capture_record_encode(const struct capture_record*, uint8_t[CAPTURE_RECORD_SIZE]);
+void capture_record_decode(const uint8_t[CAPTURE_RECORD_SIZE], struct capture_record*);
+
+// Recording on the device. Records are kept in RAM until they're read back
+// (see SYSEX_CAPTURE_DUMP in sysex_commands.h). Once the buffer is full,
+// recording stops and the rest of the session is lost.
+#define CAPTURE_BUFFER_RECORDS 2048
+
+// Starting a recording throws away the last one.
+void capture_start(void);
+void capture_stop(void);
+bool capture_is_recording(void);
+
+// Called for everything that's decoded, does nothing unless we're recording.
+void capture_add(uint32_t, uint8_t, uint8_t, const uint8_t[4]);
+
+// Record the settings, given their format and payload, as CAPTURE_SETTINGS
+// records.
+void capture_add_settings(uint32_t, uint8_t, const uint8_t*, uint8_t);
+
+// Putting the settings back together when reading a capture. Start with a
+// zeroed struct, and add each CAPTURE_SETTINGS record in turn.
+struct capture_settings {
+    uint8_t format;
+    uint8_t length;
+    uint8_t payload[CAPTURE_SETTINGS_MAX_SIZE];
+
+    // How many records have been added so far.
+    uint8_t chunk_count;
+};
+
+// Returns false if the record doesn't follow on from the last one (in which
+// case the settings are left alone).
+bool capture_settings_add(struct capture_settings*, const struct capture_record*);
+
+// True once every byte of the payload has been added.
+bool capture_settings_complete(const struct capture_settings*);
+
+uint32_t capture_count(void);
+bool capture_overflowed(void);
+
+// Copy up to `max` records, starting from `first`, and return how many were
+// copied.
+uint32_t capture_read(uint32_t, struct capture_record*, uint32_t);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _CAPTURE_H_ */
@@ -0,0 +1,142 @@
+#include <string.h>
+#include "chords.h"
+
+#define NO_INTERVAL 0xFF
+
+// The chord tones of each quality, in semitones above the root, from the
+// root up.
+static const uint8_t intervals_for_quality[CHORD_QUALITY_COUNT][4] = {
+  [CHORD_NONE]              = { NO_INTERVAL, NO_INTERVAL, NO_INTERVAL, NO_INTERVAL },
+  [CHORD_MAJOR]             = { 0, 4, 7, NO_INTERVAL },
+  [CHORD_MINOR]             = { 0, 3, 7, NO_INTERVAL },
+  [CHORD_DIMINISHED]        = { 0, 3, 6, NO_INTERVAL },
+  [CHORD_AUGMENTED]         = { 0, 4, 8, NO_INTERVAL },
+  [CHORD_SUS4]              = { 0, 5, 7, NO_INTERVAL },
+  [CHORD_SUS2]              = { 0, 2, 7, NO_INTERVAL },
+  [CHORD_DOMINANT_7]        = { 0, 4, 7, 10 },
+  [CHORD_MAJOR_7]           = { 0, 4, 7, 11 },
+  [CHORD_MINOR_7]           = { 0, 3, 7, 10 },
+  [CHORD_HALF_DIMINISHED_7] = { 0, 3, 6, 10 },
+  [CHORD_DIMINISHED_7]      = { 0, 3, 6, 9 },
+  [CHORD_MINOR_MAJOR_7]     = { 0, 3, 7, 11 }
+};
+
+// The chord for every mask of pitch classes, as (quality << 4) | root, or
+// zero for no chord. Some masks are more than one chord (a sus4 is also a
+// sus2 with a different root, a minor seventh is also a sixth), in which
+// case the quality listed first above wins.
+static uint8_t chord_for_mask[1 << 12];
+static bool table_built = false;
+
+static void build_table(void) {
+  memset(chord_for_mask, 0, sizeof(chord_for_mask));
+
+  for (uint8_t quality = CHORD_NONE + 1; quality < CHORD_QUALITY_COUNT; quality++) {
+    for (uint8_t root = 0; root < 12; root++) {
+      uint16_t mask = 0;
+      for (int a = 0; a < 4 && intervals_for_quality[quality][a] != NO_INTERVAL; a++) {
+        mask |= 1 << ((root + intervals_for_quality[quality][a]) % 12);
+      }
+
+      if (!chord_for_mask[mask]) {
+        chord_for_mask[mask] = (quality << 4) | root;
+      }
+    }
+  }
+
+  table_built = true;
+}
+
+void chords_init(struct chord_tracker *tracker) {
+  if (!table_built) {
+    build_table();
+  }
+
+  memset(tracker, 0, sizeof(*tracker));
+  tracker->output = CHORD_OUTPUT_NONE;
+  tracker->cc_channel = 15;
+}
+
+void chords_configure(struct chord_tracker *tracker, uint8_t output, uint8_t cc_channel) {
+  tracker->output = output;
+  tracker->cc_channel = cc_channel & 0x0F;
+
+  // Send what's held now, so that whatever is listening starts off right.
+  tracker->changed = true;
+}
+
+static uint8_t lowest_held_note(const struct chord_tracker *tracker) {
+  for (int word = 0; word < 4; word++) {
+    if (tracker->held_notes[word]) {
+      return (word << 5) + __builtin_ctz(tracker->held_notes[word]);
+    }
+  }
+
+  return 0;
+}
+
+static struct chord recognise(const struct chord_tracker *tracker) {
+  struct chord chord = { CHORD_NONE, 0, 0 };
+
+  uint8_t entry = chord_for_mask[tracker->pitch_classes];
+  if (!entry) {
+    return chord;
+  }
+
+  chord.quality = entry >> 4;
+  chord.root = entry & 0x0F;
+
+  uint8_t bass = lowest_held_note(tracker) % 12;
+
+  // Every note of these is the same distance from the next, so there's no
+  // way to tell the root from the notes alone. We go with the bass.
+  if (chord.quality == CHORD_AUGMENTED || chord.quality == CHORD_DIMINISHED_7) {
+    chord.root = bass;
+  }
+
+  uint8_t bass_interval = (bass + 12 - chord.root) % 12;
+  for (uint8_t a = 0; a < 4; a++) {
+    if (intervals_for_quality[chord.quality][a] == bass_interval) {
+      chord.inversion = a;
+      break;
+    }
+  }
+
+  return chord;
+}
+
+bool chords_note_changed(struct chord_tracker *tracker, uint8_t note, bool held) {
+  note &= 0x7F;
+
+  uint8_t pitch_class = note % 12;
+  uint32_t note_bit = 1u << (note & 31);
+
+  if (held) {
+    if (tracker->held_notes[note >> 5] & note_bit) {
+      return false;
+    }
+
+    tracker->held_notes[note >> 5] |= note_bit;
+    tracker->notes_by_pitch_class[pitch_class]++;
+    tracker->pitch_classes |= 1 << pitch_class;
+  }
+  else {
+    if (!(tracker->held_notes[note >> 5] & note_bit)) {
+      return false;
+    }
+
+    tracker->held_notes[note >> 5] &= ~note_bit;
+    if (--tracker->notes_by_pitch_class[pitch_class] == 0) {
+      tracker->pitch_classes &= ~(1 << pitch_class);
+    }
+  }
+
+  struct chord chord = recognise(tracker);
+  if (memcmp(&chord, &tracker->chord, sizeof(chord)) == 0) {
+    return false;
+  }
+
+  tracker->chord = chord;
+  tracker->changed = true;
+  return true;
+}
@@ -0,0 +1,107 @@
+#ifndef _CHORDS_H_
+#define _CHORDS_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Works out which chord is being held, from the pitch classes (C, C#, ... B)
+// of the held notes, so that the pads can show it and it can be sent on to
+// something else (a lighting rig, for example).
+//
+// The pitch classes are kept as a 12-bit mask, which is updated as notes are
+// pressed and released, and looked up in a table of every possible mask, so
+// working out the chord never looks at the held notes themselves. The table
+// only has exact matches, i.e. a chord is only recognised if nothing else is
+// held. Which octave each note is in doesn't matter, so inversions (and
+// spread out voicings) are recognised as well.
+
+enum ChordQuality {
+    CHORD_NONE,
+
+    CHORD_MAJOR,
+    CHORD_MINOR,
+    CHORD_DIMINISHED,
+    CHORD_AUGMENTED,
+    CHORD_SUS4,
+    CHORD_SUS2,
+
+    CHORD_DOMINANT_7,
+    CHORD_MAJOR_7,
+    CHORD_MINOR_7,
+    CHORD_HALF_DIMINISHED_7,
+    CHORD_DIMINISHED_7,
+    CHORD_MINOR_MAJOR_7,
+
+    CHORD_QUALITY_COUNT
+};
+
+// Where (if anywhere) the chord is sent on the "notes" cable when it changes.
+enum ChordOutput {
+    CHORD_OUTPUT_NONE,
+
+    // F0h 7Dh 0Fh <quality> <root> <inversion> F7h, see SYSEX_CHORDS in
+    // sysex_commands.h.
+    CHORD_OUTPUT_SYSEX,
+
+    // The root, inversion and quality as the CHORD_CC_* controllers (in that
+    // order), on `cc_channel`.
+    CHORD_OUTPUT_CC
+};
+
+#define CHORD_CC_QUALITY 20
+#define CHORD_CC_ROOT 21
+#define CHORD_CC_INVERSION 22
+
+struct chord {
+    // A ChordQuality.
+    uint8_t quality;
+
+    // The pitch class of the root, i.e. 0 for C to 11 for B.
+    uint8_t root;
+
+    // Which chord tone is lowest, i.e. 0 for root position, 1 for the first
+    // inversion, and so on.
+    uint8_t inversion;
+};
+
+struct chord_tracker {
+    // How many held notes there are of each pitch class, and which of those
+    // are non-zero, one bit per pitch class.
+    uint8_t notes_by_pitch_class[12];
+    uint16_t pitch_classes;
+
+    // Every held note, one bit per note, so that the lowest can be found
+    // quickly.
+    uint32_t held_notes[4];
+
+    struct chord chord;
+
+    // Whether the chord has changed since it was last sent.
+    bool changed;
+
+    uint8_t output;
+    uint8_t cc_channel;
+};
+
+// Also builds the table, the first time it's called.
+void chords_init(struct chord_tracker*);
+
+// Call for every press and release (not for pressure). Returns true if the
+// chord (including its inversion) has changed.
+bool chords_note_changed(struct chord_tracker*, uint8_t, bool);
+
+void chords_configure(struct chord_tracker*, uint8_t, uint8_t);
+
+static inline bool chords_recognised(const struct chord_tracker *tracker) {
+  return tracker->chord.quality != CHORD_NONE;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _CHORDS_H_ */
@@ -0,0 +1,83 @@
+#include <string.h>
+#include "client_packets.h"
+#include "midi_packets.h"
+#include "tusb.h"
+
+// There is a single client port, so (like TinyUSB's own FIFOs) there is a
+// single batch.
+static uint8_t packets[CLIENT_PACKETS_SIZE][4];
+static uint32_t packet_count = 0;
+
+static struct client_packet_stats stats;
+
+bool client_packets_write(const uint8_t packet[4]) {
+  if (packet_count >= CLIENT_PACKETS_SIZE) {
+    stats.rejected++;
+    return false;
+  }
+
+  memcpy(packets[packet_count++], packet, 4);
+  return true;
+}
+
+uint32_t client_packets_stream_write(uint8_t cable, const uint8_t *stream, uint32_t length) {
+  uint32_t space = CLIENT_PACKETS_SIZE - packet_count;
+  uint32_t consumed = 0;
+
+  // Converted straight into the batch, so only whole packets are taken.
+  packet_count += midi_stream_to_packets(cable, stream, length, packets + packet_count, space, &consumed);
+
+  if (consumed < length) {
+    stats.rejected++;
+  }
+
+  return consumed;
+}
+
+void client_packets_flush(void) {
+  if (packet_count == 0) {
+    return;
+  }
+
+  uint32_t sent = 0;
+  while (sent < packet_count) {
+    uint32_t chunk = packet_count - sent;
+    if (chunk > CLIENT_PACKETS_CHUNK) {
+      chunk = CLIENT_PACKETS_CHUNK;
+    }
+
+    uint32_t written = tud_midi_packet_write_n(packets[sent], chunk * 4) / 4;
+    sent += written;
+    stats.writes++;
+
+    if (written < chunk) {
+      stats.short_writes++;
+      break;
+    }
+  }
+
+  // Keep whatever didn't fit for next time, in order.
+  if (sent < packet_count) {
+    memmove(packets, packets[sent], (packet_count - sent) * 4);
+  }
+  packet_count -= sent;
+
+  stats.flushes++;
+  stats.events += sent;
+  if (sent > stats.max_events_per_flush) {
+    stats.max_events_per_flush = sent;
+  }
+}
+
+uint32_t client_packets_depth(void) {
+  return packet_count;
+}
+
+const struct client_packet_stats *client_packets_stats(void) {
+  return &stats;
+}
+
+void client_packets_reset(void) {
+  packet_count = 0;
+  memset(&stats, 0, sizeof(stats));
+}
@@ -0,0 +1,65 @@
+#ifndef _CLIENT_PACKETS_H_
+#define _CLIENT_PACKETS_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Everything we send on the client port (notes, and the client Launchpads'
+// pads) is collected as 4-byte USB-MIDI event packets over a pass of the main
+// loop, and handed to TinyUSB a full endpoint (64 bytes, i.e. 16 events) at a
+// time, rather than one stream write (and trip through TinyUSB's stream
+// parser) per 3-byte message.
+
+// Enough for a full repaint of all three client Launchpads (172 packets) in a
+// single pass.
+#define CLIENT_PACKETS_SIZE 256
+
+// One full-speed bulk packet.
+#define CLIENT_PACKETS_CHUNK 16
+
+struct client_packet_stats {
+    uint32_t flushes;
+
+    // Calls to TinyUSB, i.e. at most one per chunk.
+    uint32_t writes;
+
+    // Events sent across every flush, and the most sent by a single one.
+    uint32_t events;
+    uint32_t max_events_per_flush;
+
+    // Flushes where TinyUSB couldn't take everything, which is left for the
+    // next one.
+    uint32_t short_writes;
+
+    // Packets we had to turn away because the batch was full.
+    uint32_t rejected;
+};
+
+// Add a single packet. Returns false (and adds nothing) if the batch is full.
+bool client_packets_write(const uint8_t packet[4]);
+
+// Add a stream of MIDI messages for a cable, a packet at a time. Returns the
+// number of stream bytes that were added, which is short if the batch fills
+// up, in the same way as tud_midi_stream_write.
+uint32_t client_packets_stream_write(uint8_t, const uint8_t*, uint32_t);
+
+// Send as much of the batch as TinyUSB will take. Called once per pass of the
+// main loop.
+void client_packets_flush(void);
+
+uint32_t client_packets_depth(void);
+
+const struct client_packet_stats *client_packets_stats(void);
+
+// Drop anything waiting and clear the counters.
+void client_packets_reset(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _CLIENT_PACKETS_H_ */
@@ -0,0 +1,102 @@
+#ifndef _DEVICE_PROFILE_H_
+#define _DEVICE_PROFILE_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Everything that differs between the Launchpad models we support. The
+// profiles themselves are in launchpad.c, where each one is used to build a
+// set of paint, decode and initialisation functions for that model (see
+// DEFINE_DEVICE_ENGINE).
+//
+// To add a model, add a LaunchpadVersion, its layout tables (see layout.c),
+// a profile, and a line in the engine table. If it needs more than
+// VELOCITY_CURVE_FAMILIES, that needs to grow too.
+
+// How a model can be sent a lot of pads at once.
+enum BulkPaint {
+    // One note on per pad.
+    BULK_PAINT_NONE,
+
+    // The MK1's "rapid update" mode, which sends two pads per message on
+    // channel 3, in order from the top-left corner.
+    BULK_PAINT_RAPID_UPDATE,
+
+    // A single "set LEDs" sysex with a list of LEDs and colours.
+    BULK_PAINT_SYSEX
+};
+
+enum Arrow {
+    ARROW_UP,
+    ARROW_DOWN,
+    ARROW_LEFT,
+    ARROW_RIGHT,
+    ARROW_COUNT
+};
+
+struct device_profile {
+    // The note number each pad sends (and is painted with), mapped to the
+    // cell it plays, see layout.h.
+    const uint8_t *cell_for_pad;
+
+    // The pads we paint, one bit per note number.
+    const uint32_t *painted_pads;
+
+    // Pad colours, indexed by NoteType, followed by the colours for held
+    // notes and for held chords.
+    const uint8_t *colours;
+
+    // The control change sent by each arrow.
+    uint8_t arrows[ARROW_COUNT];
+
+    // The control change for the button that cycles through the velocity
+    // curves (see velocity_curves.h).
+    uint8_t velocity_curve_control;
+
+    // The control change for the button that cycles through the layouts (see
+    // layout.h).
+    uint8_t layout_control;
+
+    // The control change for the button that works as a sustain pedal (see
+    // sustain.h).
+    uint8_t sustain_control;
+
+    // Whether the round pads around the grid (which send control changes)
+    // also play notes.
+    bool control_changes_play_notes;
+
+    // The cable the client side uses for this model, and the port on the
+    // Launchpad itself that we talk to when it's on the host port.
+    uint8_t client_cable;
+    uint8_t host_cable;
+
+    // Sent when the Launchpad is connected, i.e. to select programmer mode.
+    const uint8_t *initialise_messages;
+    uint8_t initialise_length;
+
+    enum BulkPaint bulk_paint;
+
+    // Once at least this many pads have changed, they're sent in bulk.
+    uint8_t bulk_paint_threshold;
+
+    // For BULK_PAINT_SYSEX: the device ID in the Novation sysex header
+    // (F0h 00h 20h 29h 02h <device>), the "set LEDs" command, and whether
+    // each LED is preceded by a lighting type.
+    uint8_t sysex_device_id;
+    uint8_t sysex_set_leds;
+    bool sysex_lighting_type;
+
+    // The USB product IDs this model uses (Novation's vendor ID is 1235h).
+    uint16_t first_product_id;
+    uint16_t last_product_id;
+};
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _DEVICE_PROFILE_H_ */
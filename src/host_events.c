@@ -0,0 +1,52 @@
+#include "host_events.h"
+
+#define HOST_EVENT_QUEUE_MASK (HOST_EVENT_QUEUE_SIZE - 1)
+
+_Static_assert((HOST_EVENT_QUEUE_SIZE & HOST_EVENT_QUEUE_MASK) == 0, "HOST_EVENT_QUEUE_SIZE must be a power of two");
+
+bool host_event_queue_push(struct host_event_queue *queue, const struct host_event *event) {
+  // We're the only writer of head, so a relaxed read is enough. The tail has
+  // to be acquired so that we don't overwrite a slot that's still being read.
+  uint32_t head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+  uint32_t tail = atomic_load_explicit(&queue->tail, memory_order_acquire);
+
+  uint32_t depth = head - tail;
+  if (depth >= HOST_EVENT_QUEUE_SIZE) {
+    queue->overflows++;
+    return false;
+  }
+
+  queue->events[head & HOST_EVENT_QUEUE_MASK] = *event;
+
+  // Publish the event only once it's been written.
+  atomic_store_explicit(&queue->head, head + 1, memory_order_release);
+
+  if (depth + 1 > queue->high_watermark) {
+    queue->high_watermark = depth + 1;
+  }
+
+  return true;
+}
+
+bool host_event_queue_pop(struct host_event_queue *queue, struct host_event *event) {
+  uint32_t tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+  uint32_t head = atomic_load_explicit(&queue->head, memory_order_acquire);
+
+  if (head == tail) {
+    return false;
+  }
+
+  *event = queue->events[tail & HOST_EVENT_QUEUE_MASK];
+
+  // Hand the slot back only once we've finished reading it.
+  atomic_store_explicit(&queue->tail, tail + 1, memory_order_release);
+
+  return true;
+}
+
+uint32_t host_event_queue_depth(struct host_event_queue *queue) {
+  uint32_t head = atomic_load_explicit(&queue->head, memory_order_acquire);
+  uint32_t tail = atomic_load_explicit(&queue->tail, memory_order_acquire);
+
+  return head - tail;
+}
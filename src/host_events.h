@@ -0,0 +1,72 @@
+#ifndef _HOST_EVENTS_H_
+#define _HOST_EVENTS_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// Everything that happens on the USB host side (core1) is passed to core0
+// through a single-producer, single-consumer ring, so that core0 is the only
+// thing that ever writes to the board state.
+
+// Must be a power of two.
+#define HOST_EVENT_QUEUE_SIZE 256
+
+// Keep the producer's and consumer's fields on separate lines so that neither
+// side writes to memory the other is reading.
+#define HOST_EVENT_QUEUE_ALIGNMENT 32
+
+enum HostEventType {
+    HOST_EVENT_PACKET,
+    HOST_EVENT_MOUNT,
+    HOST_EVENT_UNMOUNT
+};
+
+// A packet from a Launchpad connected to the host port, or a change in what's
+// connected. Decoding the packet into a note needs the host offset, which
+// belongs to core0, so that happens when the event is consumed.
+struct host_event {
+    uint8_t type;
+    uint8_t idx;
+
+    // Only used for HOST_EVENT_MOUNT.
+    uint8_t launchpad_version;
+
+    uint8_t reserved;
+
+    // Only used for HOST_EVENT_PACKET.
+    uint8_t packet[4];
+
+    // When core1 received the packet, see latency.h.
+    uint32_t timestamp_us;
+};
+
+struct host_event_queue {
+    // Only written by the producer (core1).
+    _Atomic uint32_t head __attribute__((aligned(HOST_EVENT_QUEUE_ALIGNMENT)));
+    uint32_t overflows;
+    uint32_t high_watermark;
+
+    // Only written by the consumer (core0).
+    _Atomic uint32_t tail __attribute__((aligned(HOST_EVENT_QUEUE_ALIGNMENT)));
+
+    struct host_event events[HOST_EVENT_QUEUE_SIZE] __attribute__((aligned(HOST_EVENT_QUEUE_ALIGNMENT)));
+};
+
+// Producer side, returns false (and counts an overflow) if the queue is full.
+bool host_event_queue_push(struct host_event_queue*, const struct host_event*);
+
+// Consumer side, returns false if there is nothing waiting.
+bool host_event_queue_pop(struct host_event_queue*, struct host_event*);
+
+uint32_t host_event_queue_depth(struct host_event_queue*);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _HOST_EVENTS_H_ */
@@ -0,0 +1,63 @@
+#include <string.h>
+#include "latency.h"
+
+// Values below 4 get a bucket each, after that each power of two is split
+// into four.
+static int bucket_for_us(uint32_t us) {
+  if (us < 4) {
+    return us;
+  }
+
+  int msb = 31 - __builtin_clz(us);
+  int bucket = ((msb - 1) * 4) + ((us >> (msb - 2)) & 3);
+
+  return bucket < LATENCY_BUCKETS ? bucket : LATENCY_BUCKETS - 1;
+}
+
+static uint32_t bucket_upper_bound(int bucket) {
+  if (bucket < 4) {
+    return bucket;
+  }
+
+  int shift = (bucket / 4) - 1;
+  uint32_t lower = (uint32_t) (4 + (bucket % 4)) << shift;
+
+  return lower + (1u << shift) - 1;
+}
+
+void latency_record(struct latency_stats *latency, enum LatencyStage stage, uint32_t us) {
+  latency_histogram_add(&latency->histograms[stage], us);
+}
+
+void latency_histogram_add(struct latency_histogram *histogram, uint32_t us) {
+  histogram->buckets[bucket_for_us(us)]++;
+  histogram->count++;
+
+  if (us > histogram->max_us) {
+    histogram->max_us = us;
+  }
+}
+
+uint32_t latency_percentile(const struct latency_histogram *histogram, int percent) {
+  if (histogram->count == 0) {
+    return 0;
+  }
+
+  uint64_t target = ((uint64_t) histogram->count * percent + 99) / 100;
+  uint64_t seen = 0;
+
+  for (int bucket = 0; bucket < LATENCY_BUCKETS; bucket++) {
+    seen += histogram->buckets[bucket];
+
+    if (seen >= target) {
+      uint32_t upper_bound = bucket_upper_bound(bucket);
+      return upper_bound < histogram->max_us ? upper_bound : histogram->max_us;
+    }
+  }
+
+  return histogram->max_us;
+}
+
+void latency_reset(struct latency_stats *latency) {
+  memset(latency->histograms, 0, sizeof(latency->histograms));
+}
@@ -0,0 +1,85 @@
+#ifndef _LATENCY_H_
+#define _LATENCY_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Timestamps for each stage between a packet arriving and the note going out,
+// kept as fixed-bucket histograms so that they can be left running. Only note
+// ons and offs are timed, as pressure changes are held back on purpose (see
+// aftertouch.h). See
+// sysex_commands.c for how to read them.
+
+enum LatencyStage {
+    // From tuh_midi_rx_cb (core1) to the packet being decoded on core0.
+    LATENCY_HOST_QUEUE,
+
+    // From the packet being decoded to the note being written in
+    // sync_playing_notes.
+    LATENCY_NOTE_OUT,
+
+    // From the packet arriving (on either port) to the note being written.
+    LATENCY_TOTAL,
+
+    LATENCY_STAGE_COUNT
+};
+
+// Four buckets per power of two, so the error is at most 25%. Anything over
+// 131 ms ends up in the last bucket.
+#define LATENCY_BUCKETS 64
+
+struct latency_histogram {
+    uint32_t buckets[LATENCY_BUCKETS];
+    uint32_t count;
+    uint32_t max_us;
+};
+
+struct latency_stats {
+    // When the packet currently being decoded arrived, and when we started
+    // decoding it.
+    uint32_t input_us;
+    uint32_t decoded_us;
+
+    // The same, for the packet that last changed each pending note.
+    uint32_t note_input_us[128];
+    uint32_t note_decoded_us[128];
+
+    struct latency_histogram histograms[LATENCY_STAGE_COUNT];
+
+    // Echo everything on the "notes" cable straight back, so that a script on
+    // the computer can measure the round trip over USB on its own.
+    bool loopback;
+};
+
+// The microsecond timer, which is provided by the firmware (or the host build).
+uint32_t latency_now_us(void);
+
+void latency_record(struct latency_stats*, enum LatencyStage, uint32_t);
+
+// The same, for a histogram kept somewhere else (see arpeggiator.h).
+void latency_histogram_add(struct latency_histogram*, uint32_t);
+
+// The upper bound of the bucket holding the given percentile, in microseconds.
+uint32_t latency_percentile(const struct latency_histogram*, int);
+
+void latency_reset(struct latency_stats*);
+
+static inline void latency_mark_input(struct latency_stats *latency, uint32_t input_us, uint32_t decoded_us) {
+  latency->input_us = input_us;
+  latency->decoded_us = decoded_us;
+}
+
+static inline void latency_mark_note(struct latency_stats *latency, uint8_t note) {
+  latency->note_input_us[note] = latency->input_us;
+  latency->note_decoded_us[note] = latency->decoded_us;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _LATENCY_H_ */
@@ -1,662 +1,888 @@
 #include <stdint.h>
+#include <string.h>
 #include "launchpad.h"
+#include "chords.h"
+#include "client_packets.h"
+#include "device_profile.h"
+#include "layout.h"
+#include "midi_packets.h"
+#include "sysex_commands.h"
 #include "tusb.h"
-#include <math.h>
 
 // Common utility functions for all versions
 enum NoteType get_type_for_note(int note_number) {
-  int octave_offset = note_number % 12;
-
-  switch (octave_offset) {
-    case 0:
-      return C_NATURAL;
-      break;
-    case 1:
-    case 3:
-    case 6:
-    case 8:
-    case 10:
-      return SHARP_OR_FLAT;
-      break;
-    default:
-      return NON_C_NATURAL;
-  }
-}
-
-void clear_all_notes(struct board_state *board_state) {
-  for (int a = 0; a < 128; a++) {
-    if (board_state ->held_note_velocities[a]) {
-      board_state->held_note_velocities[a] = 0;
-    }
+  return note_type_for_note[note_number & 0x7F];
+}
 
-    if (board_state -> playing_note_velocities[a]) {
-      board_state->playing_note_velocities[a] = 0;
+// Change what a note should be playing, so that sync_playing_notes knows
+// which notes to look at.
+static void set_sounding_note_velocity(struct board_state *board_state, uint8_t note, uint8_t velocity) {
+  note &= 0x7F;
 
-      uint8_t note_off_message[3] = {
-          MIDI_CIN_NOTE_OFF << 4, a, 0
-      };
+  bool is_press_or_release = (board_state->held_note_velocities[note] > 0) != (velocity > 0);
+
+  // Only a press or release changes what the pads show, so pressure alone
+  // never causes a repaint.
+  if (is_press_or_release) {
+    board_state->repaint_notes[note >> 5] |= 1u << (note & 31);
+    board_state->is_dirty = true;
 
-      // This should use cable 3.
-      tud_midi_stream_write(3, note_off_message, sizeof note_off_message);
+    // When a chord is first recognised (or stops being one), every held note
+    // changes colour, see pad_colour_for_note.
+    bool was_recognised = chords_recognised(&board_state->chords);
+    if (chords_note_changed(&board_state->chords, note, velocity > 0) && was_recognised != chords_recognised(&board_state->chords)) {
+      for (int word = 0; word < 4; word++) {
+        board_state->repaint_notes[word] |= board_state->chords.held_notes[word];
+      }
     }
+
+    arpeggiator_note_changed(&board_state->arpeggiator, note, velocity > 0);
   }
-}
 
+  // Time the note from the first change that hasn't been sent yet, or from
+  // the press or release, rather than from a pressure change that the
+  // aftertouch coalescer was holding back.
+  if (is_press_or_release || !(board_state->pending_notes[note >> 5] & (1u << (note & 31)))) {
+    latency_mark_note(&board_state->latency, note);
+  }
+  else if (board_state->playing_note_velocities[note] && board_state->held_note_velocities[note] && velocity) {
+    board_state->aftertouch.replaced++;
+  }
 
-// End utility functions
+  board_state->held_note_velocities[note] = velocity;
 
-// Begin version-specific functions.
+  // The arpeggiator sends the notes itself.
+  if (!arpeggiator_is_active(&board_state->arpeggiator)) {
+    board_state->pending_notes[note >> 5] |= 1u << (note & 31);
+  }
+}
 
-void initialise_client_launchpads(void) {
-  initialise_mk1_client_launchpads();
-  initialise_mk2_client_launchpads();
-  initialise_mk3_client_launchpads();
+// All changes to held notes should go through this, so that sustained and
+// latched notes keep sounding (see sustain.h).
+void set_held_note_velocity(struct board_state *board_state, uint8_t note, uint8_t velocity) {
+  if (sustain_note_changed(&board_state->sustain, note, velocity)) {
+    set_sounding_note_velocity(board_state, note, velocity);
+  }
 }
 
-void initialise_mk1_client_launchpads(void) {
-  // Change the button layout Change the button layout Change the button layout
-  // Host » Launchpad: Channel 1: controller 0 set to 1 or 2.
-  //  B0h, 00h, 01-02h (176, 0, 1-2). 
-  uint8_t x_y_mode_packet[3] = {
-    0xB0, 0x00, 1
-  };
+static void stop_notes(struct board_state *board_state, const uint32_t notes[4]) {
+  for (int word = 0; word < 4; word++) {
+    uint32_t note_bits = notes[word];
+
+    while (note_bits) {
+      uint8_t note = (word << 5) + __builtin_ctz(note_bits);
+      note_bits &= note_bits - 1;
 
-  // This should use cable 0.
-  tud_midi_stream_write(0, x_y_mode_packet, sizeof(x_y_mode_packet));
+      set_sounding_note_velocity(board_state, note, 0);
+    }
+  }
 }
 
-void initialise_mk2_client_launchpads(void) {
-  // Select "standalone" mode (it's the default, but for users who also use
-  // Ableton, this will ensure things are set up properly).
-  uint8_t standalone_mode_packet[9] = {
-    0xf0, 0x00, 0x20, 0x29, 0x02, 0x10, 0x2C, 0x03, 0xf7
-  };
+void set_sustain_pedal(struct board_state *board_state, uint8_t source, bool is_down) {
+  uint32_t released[4];
+  sustain_set_pedal(&board_state->sustain, source, is_down, released);
+  stop_notes(board_state, released);
+}
 
-  // Select "programmer" layout ("note" layout is the default)
-  uint8_t programmer_layout_packet[9] = {
-    0xf0, 0, 0x20, 0x29, 0x02, 0x10, 0x16, 0x3, 0xf7
-  };
+void set_hold_mode(struct board_state *board_state, uint8_t mode) {
+  uint32_t released[4];
+  sustain_set_mode(&board_state->sustain, mode, released);
+  stop_notes(board_state, released);
+}
 
-  // This should use cable 1.
-  tud_midi_stream_write(1, standalone_mode_packet, sizeof(standalone_mode_packet));
-  tud_midi_stream_write(1, programmer_layout_packet, sizeof programmer_layout_packet);
+static void hold_pad(struct board_state *board_state, struct pad_holds *pad_holds, uint8_t pad, uint8_t note) {
+  pad_holds->held_pads[pad >> 5] |= 1u << (pad & 31);
+  pad_holds->note_for_pad[pad] = note;
+  board_state->holds_by_note[note]++;
 }
 
-void initialise_mk3_client_launchpads(void) {
-  // Select the programmer's layout, we want layout 11h and page 0
-  // F0h 00h 20h 29h 02h 0Eh 00h <layout> <page> 00h F7h
-  uint8_t select_programmers_layout[] = {
-    0xF0, 0x00, 0x20, 0x29, 0x02, 0x0E, 0x00, 0x11, 0x00, 0x00, 0xF7
-  };
+// A note is only released once every pad holding it has been released.
+static void release_pad(struct board_state *board_state, struct pad_holds *pad_holds, uint8_t pad) {
+  uint8_t note = pad_holds->note_for_pad[pad];
+
+  pad_holds->held_pads[pad >> 5] &= ~(1u << (pad & 31));
 
-  // They don't have a "clear all" method, just a sysex to send a value for
-  // every pad, so we skip that.
+  if (board_state->holds_by_note[note] > 0) {
+    board_state->holds_by_note[note]--;
+  }
 
-  // This should use cable 2.
-  tud_midi_stream_write(2, select_programmers_layout, sizeof select_programmers_layout);
+  if (board_state->holds_by_note[note] == 0) {
+    set_held_note_velocity(board_state, note, 0);
+  }
 }
 
-void paint_client_launchpads(struct board_state *board_state) {
-  paint_mk1_client_launchpads(board_state);
-  paint_mk2_client_launchpads(board_state);
-  paint_mk3_client_launchpads(board_state);
+// The note offs themselves are sent by sync_playing_notes, which only looks at
+// the notes that have changed.
+void release_held_pads(struct board_state *board_state, struct pad_holds *pad_holds) {
+  for (int word = 0; word < 4; word++) {
+    uint32_t pad_bits = pad_holds->held_pads[word];
+
+    while (pad_bits) {
+      uint8_t pad = (word << 5) + __builtin_ctz(pad_bits);
+      pad_bits &= pad_bits - 1;
+
+      release_pad(board_state, pad_holds, pad);
+    }
+  }
+
+  board_state->is_dirty = true;
 }
 
-void paint_mk1_client_launchpads(struct board_state *board_state) {
-  // There is a wacky mode for note on messages on channel 3 where the note is
-  // one colour for one pad and the velocity is the colour for the next pad. You
-  // blaze through them in sequnce from the top-left corner, which is not how
-  // we're working on other devices, and is why we reverse the rows.
+// Every Launchpad is repainted with the new layout the next time round. Held
+// pads are treated the same as when the offset changes, see TransposeMode.
+void apply_layout_change(struct board_state *board_state) {
+  if (board_state->transpose_mode == TRANSPOSE_RELEASES_NOTES) {
+    for (int idx = 0; idx < MAX_HOST_LAUNCHPADS; idx++) {
+      release_held_pads(board_state, &board_state->host_by_idx[idx].pad_holds);
+    }
 
-  // Send an initial (out of range) note to force any existing bulk update mode to end.
-  uint8_t initial_note_on_message[3] = {
-    MIDI_CIN_NOTE_ON << 4, 127, 0
-  };
+    for (int cable = 0; cable < 3; cable++) {
+      release_held_pads(board_state, &board_state->client.pad_holds_by_cable[cable]);
+    }
+  }
+
+  board_state->is_dirty = true;
+}
 
-  tud_midi_stream_write(0, initial_note_on_message, sizeof(initial_note_on_message));
+// End utility functions
 
-  for (int row = 7; row >= 0; row--) {
-    // Shift by one column so that the square pads align on all units.
-    for (int column = 1; column < 9; column += 2) {
-      // First pad
-      uint8_t note = 0x0c;
-      int first_tuned_note = board_state->client.offset_by_cable[0] + (column * 3) + (row * 4);
+// Begin version-specific functions.
 
-      if (board_state->held_note_velocities[first_tuned_note] > 0) {
-        note = 0x3C; // Green
-      }
-      else {
-        enum NoteType first_tuned_note_type = get_type_for_note(first_tuned_note);
-        if (first_tuned_note_type == C_NATURAL) {
-          note = 0x0F; // Red
-        }
-        else if (first_tuned_note_type == NON_C_NATURAL) {
-          note = 0x3E; // Yellow
-        }
-      }
+// The client side goes into the batch for this pass, see client_packets.h.
+static uint32_t client_stream_write(__attribute__((unused)) uint8_t idx, uint8_t cable, const uint8_t *message, uint32_t length) {
+  return client_packets_stream_write(cable, message, length);
+}
+
+// The host side gets its own packets (see midi_packets.c), as
+// tuh_midi_stream_write can't send sysex.
+static outbound_write_fn write_fn_for_sink(const struct launchpad_sink *sink) {
+  return sink->host_or_client == HOST ? host_stream_write : client_stream_write;
+}
 
-      // Second pad
-      uint8_t velocity = 0x0c;
-      int second_tuned_note = board_state->client.offset_by_cable[0] + ((column + 1) * 3) + (row * 4);
+static uint32_t write_to_sink(const struct launchpad_sink *sink, const uint8_t *message, uint32_t length) {
+  if (sink->queue) {
+    return outbound_queue_write(sink->queue, write_fn_for_sink(sink), sink->idx, sink->cable, message, length);
+  }
 
-      if (board_state->held_note_velocities[second_tuned_note] > 0) {
-        velocity = 0x3C; // Green
-      }
-      else {
-        enum NoteType second_tuned_note_type = get_type_for_note(second_tuned_note);
-        if (second_tuned_note_type == C_NATURAL) {
-          velocity = 0x0F;
-        }
-        else if (second_tuned_note_type == NON_C_NATURAL) {
-          velocity = 0x3E;
-        }
-      }
+  return write_fn_for_sink(sink)(sink->idx, sink->cable, message, length);
+}
 
-      uint8_t note_on_message[3] = { 0x92, note, velocity };
+// Carry on with anything that didn't fit in TinyUSB's TX FIFO last time.
+void flush_outbound_queues(struct board_state *board_state) {
+  for (int cable = 0; cable < 3; cable++) {
+    struct launchpad_sink sink = client_sink(board_state, cable);
+    outbound_queue_flush(sink.queue, client_stream_write, sink.idx, sink.cable);
+  }
 
-      // The virtual port for the MK1 should be cable 0.
-      tud_midi_stream_write(0, note_on_message, sizeof(note_on_message));
+  for (int idx = 0; idx < MAX_HOST_LAUNCHPADS; idx++) {
+    if (board_state->host_by_idx[idx].launchpad_version == UNkNOWN || !tuh_midi_mounted(idx)) {
+      continue;
     }
+
+    struct launchpad_sink sink = host_sink(board_state, idx);
+    outbound_queue_flush(sink.queue, host_stream_write, sink.idx, sink.cable);
   }
 }
 
-void paint_mk2_client_launchpads(struct board_state *board_state) {
-  // Sysex messages used to paint the Launchpad in this pass....
+// Colours for the MK1, which uses a different set of velocities to pick the
+// colour.
+#define MK1_BLACK  0x0C
+#define MK1_GREEN  0x3C
+#define MK1_RED    0x0F
+#define MK1_YELLOW 0x3E
+#define MK1_ORANGE 0x2F
+
+// Colours from the 128 colour palette used by the MK2 and MK3.
+#define PALETTE_BLACK 0
+#define PALETTE_WHITE 3
+#define PALETTE_BLUE  79
+#define PALETTE_RED   120
+#define PALETTE_GREEN 21
+
+// Pad colours, indexed by NoteType, followed by the colour for held notes and
+// the colour for held notes that make up a chord (see chords.h).
+#define HELD_NOTE_COLOUR 3
+#define CHORD_NOTE_COLOUR 4
+
+const uint8_t mk1_colours[5] = { MK1_RED, MK1_YELLOW, MK1_BLACK, MK1_GREEN, MK1_ORANGE };
+const uint8_t palette_colours[5] = { PALETTE_RED, PALETTE_WHITE, PALETTE_BLACK, PALETTE_BLUE, PALETTE_GREEN };
+
+// When at least this many pads have changed (for example, after the offset
+// changes), it's cheaper to send them in one bulk message than a note each.
+#define BULK_PAINT_THRESHOLD 8
+
+// Device profiles, see device_profile.h.
+
+// Change the button layout
+// Host » Launchpad: Channel 1: controller 0 set to 1 or 2.
+//  B0h, 00h, 01-02h (176, 0, 1-2).
+static const uint8_t mk1_initialise_messages[] = {
+  0xB0, 0x00, 1
+};
+
+static const uint8_t mk2_initialise_messages[] = {
+  // Select "standalone" mode (it's the default, but for users who also use
+  // Ableton, this will ensure things are set up properly).
+  0xf0, 0x00, 0x20, 0x29, 0x02, 0x10, 0x2C, 0x03, 0xf7,
+
+  // Select "programmer" layout ("note" layout is the default)
+  0xf0, 0, 0x20, 0x29, 0x02, 0x10, 0x16, 0x3, 0xf7,
 
   // The "paint all" operation doesn't support RGB, so you have to pick a colour
   // from the built-in 128 colour palette, for example, 0 for black and 3 for
-  // white, 24 for green.
+  // white, 24 for green. We only use it to clear everything once, after that
+  // we only paint the pads we use.
   //
-  // Paint All F0h 00h 20h 29h 02h 10h 0Eh                                                                                                                                  <Colour> F7h
-  uint8_t paint_all_sysex[9] = {
-      0xf0, 0, 0x20, 0x29, 0x2, 0x10, 0xE, 0, 0xf7
-  };
+  // Paint All F0h 00h 20h 29h 02h 10h 0Eh <Colour> F7h
+  0xf0, 0, 0x20, 0x29, 0x2, 0x10, 0xE, 0, 0xf7,
 
-  // The virtual port for the MK2 should be cable 1.
-  tud_midi_stream_write(1, paint_all_sysex, sizeof(paint_all_sysex));
-
-  // We could do this all in one, but per row seems less involved.
-  for (int row = 0; row < 8; row++) {
-    // Paint a row using the canned colour palette.
-    // F0h 00h 20h 29h 02h 10h 0Dh <Row> (<Colour> * 10) F7h
-    uint8_t paint_row[19] = {
-      0xf0, 0, 0x20, 0x29, 0x2, 0x10, 0xD, row + 1, 
-      0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-      0xf7
-    };
-
-    for (int column = 0; column < 10; column++) {
-      int tuned_note = board_state->client.offset_by_cable[1] + (column * 3) + (row * 4);
-      enum NoteType tuned_note_type = get_type_for_note(tuned_note);
-
-      if (board_state->held_note_velocities[tuned_note] > 0) {
-        paint_row[8 + column] = 79; // Blue
-      }
-      else {
-        if (tuned_note_type == C_NATURAL) {
-          paint_row[8 + column] = 120;
-        }
-        else if (tuned_note_type == NON_C_NATURAL) {
-          paint_row[8 + column] = 3;
-        }
-      }
-    }
-
-    // The virtual port for the MK2 should be cable 1.
-    tud_midi_stream_write(1, paint_row, sizeof(paint_row));
-  }
- 
   // We currently use the "pulse" method for the side light.
-  uint8_t paint_side_light[12] = {
-    0xf0, 0x00, 0x20, 0x29, 0x2, 0x10, 0x28, 0x63, 3, 0xf7
+  0xf0, 0x00, 0x20, 0x29, 0x2, 0x10, 0x28, 0x63, 3, 0xf7
+};
+
+// Select the programmer's layout, we want layout 11h and page 0
+// F0h 00h 20h 29h 02h 0Eh 00h <layout> <page> 00h F7h
+//
+// They don't have a "clear all" method, just a sysex to send a value for
+// every pad, so we skip that.
+static const uint8_t mk3_initialise_messages[] = {
+  0xF0, 0x00, 0x20, 0x29, 0x02, 0x0E, 0x00, 0x11, 0x00, 0x00, 0xF7
+};
+
+// The Launchpad S has a weird layout, i.e. each row has 16 columns, 8 square
+// pads, 1 circular pad, and 7 unused columns, see mk1_cell_for_pad. The round
+// pads above the grid send control changes, which we only use for the arrows.
+// It has a single port, so it's cable 0 on both sides.
+static const struct device_profile mk1_profile = {
+  .cell_for_pad = mk1_cell_for_pad,
+  .painted_pads = mk1_painted_pads,
+  .colours = mk1_colours,
+  .arrows = { [ARROW_UP] = 104, [ARROW_DOWN] = 105, [ARROW_LEFT] = 106, [ARROW_RIGHT] = 107 },
+  // The "Session" button.
+  .velocity_curve_control = 108,
+  // The button to the right of "Session".
+  .layout_control = 109,
+  // The "Mixer" button.
+  .sustain_control = 111,
+  .control_changes_play_notes = false,
+  .client_cable = 0,
+  .host_cable = 0,
+  .initialise_messages = mk1_initialise_messages,
+  .initialise_length = sizeof(mk1_initialise_messages),
+  // The bulk update always sends all 64 pads in 32 messages.
+  .bulk_paint = BULK_PAINT_RAPID_UPDATE,
+  .bulk_paint_threshold = 32,
+  .first_product_id = 0x000E,
+  .last_product_id = 0x000E
+};
+
+// The MK2's "standalone" port is the second one, i.e. cable 1 on both sides.
+static const struct device_profile mk2_profile = {
+  .cell_for_pad = mk2_cell_for_pad,
+  .painted_pads = mk2_painted_pads,
+  .colours = palette_colours,
+  .arrows = { [ARROW_UP] = 91, [ARROW_DOWN] = 92, [ARROW_LEFT] = 93, [ARROW_RIGHT] = 94 },
+  // The "Session" button.
+  .velocity_curve_control = 95,
+  // The button to the right of "Session".
+  .layout_control = 96,
+  // The last button on the top row.
+  .sustain_control = 98,
+  .control_changes_play_notes = true,
+  .client_cable = 1,
+  .host_cable = 1,
+  .initialise_messages = mk2_initialise_messages,
+  .initialise_length = sizeof(mk2_initialise_messages),
+  .bulk_paint = BULK_PAINT_SYSEX,
+  .bulk_paint_threshold = BULK_PAINT_THRESHOLD,
+  // F0h 00h 20h 29h 02h 10h 0Ah <LED> <Colour> [<LED> <Colour> ...] F7h
+  .sysex_device_id = 0x10,
+  .sysex_set_leds = 0x0A,
+  .sysex_lighting_type = false,
+  .first_product_id = 0x0051,
+  .last_product_id = 0x0060
+};
+
+// The first column of the MK3 is used for controls. On the client side the
+// MK3 gets cable 2, on the host side it wants the first port, i.e. "MIDI" and
+// not "DIN" or "DAW".
+static const struct device_profile mk3_profile = {
+  .cell_for_pad = mk3_cell_for_pad,
+  .painted_pads = mk3_painted_pads,
+  .colours = palette_colours,
+  .arrows = { [ARROW_UP] = 80, [ARROW_DOWN] = 70, [ARROW_LEFT] = 91, [ARROW_RIGHT] = 92 },
+  // The "Session" button.
+  .velocity_curve_control = 95,
+  // The button to the right of "Session".
+  .layout_control = 96,
+  // The last button on the top row.
+  .sustain_control = 98,
+  .control_changes_play_notes = true,
+  .client_cable = 2,
+  .host_cable = 0,
+  .initialise_messages = mk3_initialise_messages,
+  .initialise_length = sizeof(mk3_initialise_messages),
+  .bulk_paint = BULK_PAINT_SYSEX,
+  .bulk_paint_threshold = BULK_PAINT_THRESHOLD,
+  // F0h 00h 20h 29h 02h 0Eh 03h <Type> <LED> <Colour> [...] F7h, where type 0
+  // is a static colour from the palette.
+  .sysex_device_id = 0x0E,
+  .sysex_set_leds = 0x03,
+  .sysex_lighting_type = true,
+  .first_product_id = 0x0123,
+  .last_product_id = 0x0132
+};
+
+struct launchpad_sink client_sink(struct board_state *board_state, uint8_t cable) {
+  struct launchpad_sink sink = {
+    CLIENT,
+    0,
+    cable,
+    &board_state->client.queue_by_cable[cable]
   };
 
-  // The virtual port for the MK2 should be cable 1.
-  tud_midi_stream_write(1, paint_side_light, sizeof(paint_side_light));
-}
-
-void paint_mk3_client_launchpads(struct board_state *board_state) {
-  // For now, use notes.
-  for (int row = 0; row < 8; row++) {
-    for (int column = 0; column < 10; column++) {
-      // Offset the row by one to skip the very lowest row of buttons and paint the square pads.
-      int launchpad_note = ((row + 1) * 10) + column;
-
-      int tuned_note = board_state->client.offset_by_cable[2] + (column * 3) + (row * 4);
-      enum NoteType tuned_note_type = get_type_for_note(tuned_note);
-
-      uint8_t velocity = 0; // Black / Unlit
-
-      // We have to paint the first column black because there are also
-      // controls we use there.
-      if (column) {
-        if (board_state->held_note_velocities[tuned_note] > 0) {
-          velocity = 79; // Blue
-        }
-        else {
-          if (tuned_note_type == C_NATURAL) {
-            velocity = 120; // Red
-          }
-          else if (tuned_note_type == NON_C_NATURAL) {
-            velocity = 3; // White
-          }
-        }
-      }
+  return sink;
+}
 
-      uint8_t note_on_message[3] = {
-        MIDI_CIN_NOTE_ON << 4, launchpad_note, velocity
-      };
+uint8_t pad_colour_for_note(struct board_state *board_state, const uint8_t *colours, int tuned_note) {
+  if (tuned_note < 0 || tuned_note > 127) {
+    return colours[SHARP_OR_FLAT];
+  }
 
-      // The virtual port for the MK3 should be cable 2.
-      tud_midi_stream_write(2, note_on_message, sizeof(note_on_message));
-    }
+  if (board_state->held_note_velocities[tuned_note] > 0) {
+    // Only an exact match is a chord, so every held note is part of it.
+    return colours[chords_recognised(&board_state->chords) ? CHORD_NOTE_COLOUR : HELD_NOTE_COLOUR];
   }
-}
 
-void paint_host_launchpad(struct board_state *board_state) {
-    if (board_state->host.launchpad_version == MK1) {
-        paint_mk1_host_launchpad(board_state);
-    }
-    else if (board_state->host.launchpad_version == MK2) {
-        paint_mk2_host_launchpad(board_state);
-    }
-    else if (board_state->host.launchpad_version == MK3) {
-        paint_mk3_host_launchpad(board_state);
-    }
+  return colours[note_type_for_note[tuned_note]];
 }
 
-// TODO: When we figure out sending sysex to the host's client device, we can simplify this.
-void paint_mk1_host_launchpad(struct board_state *board_state) {
-  // We use a different strategy here because the MK1 units skip notes between rows.
-  for (int row = 0; row < 8; row++) {
-      for (int column = 0; column < 8; column++) {
-        int launchpad_note = (row * 16) + column;
+// Shadow frame functions, which keep track of what each Launchpad is
+// (supposed to be) showing, so that we only send the pads that change.
 
-        uint8_t velocity = 0x0C; // Black
+void invalidate_frame(struct pad_frame *frame) {
+  frame->is_valid = false;
+}
 
-        int tuned_note = board_state->host.offset + (column * 3) + (row * 4);
+void invalidate_client_frames(struct board_state *board_state) {
+  for (int cable = 0; cable < 3; cable++) {
+    invalidate_frame(&board_state->client.frame_by_cable[cable]);
+  }
 
+  board_state->is_dirty = true;
+}
 
-        if (board_state->held_note_velocities[tuned_note] > 0) {
-          velocity = 0x3C; // Green
-        }
-        else {
-          enum NoteType tuned_note_type = get_type_for_note(tuned_note);
+void invalidate_host_frame(struct board_state *board_state, uint8_t idx) {
+  invalidate_frame(&board_state->host_by_idx[idx].frame);
 
-          if (tuned_note_type == C_NATURAL) {
-            velocity = 0x0F; // Red
-          }
-          else if (tuned_note_type == NON_C_NATURAL) {
-            velocity = 0x3E; // Yellow
-          }
-        }
+  board_state->is_dirty = true;
+}
 
-        uint8_t note_on_message[3] = {
-          MIDI_CIN_NOTE_ON << 4, launchpad_note, velocity
-        };
+void invalidate_host_frames(struct board_state *board_state) {
+  for (int idx = 0; idx < MAX_HOST_LAUNCHPADS; idx++) {
+    invalidate_host_frame(board_state, idx);
+  }
+}
 
-        tuh_midi_stream_write(board_state->host.client_idx, 0, note_on_message, sizeof(note_on_message));
-      }
+// Set the colour we want a pad to show, and flag it if that's not what was
+// last sent.
+void set_pad_colour(struct pad_frame *frame, uint8_t pad, uint8_t colour) {
+  if (!frame->is_valid || frame->colours[pad] != colour) {
+    frame->colours[pad] = colour;
+    frame->dirty_pads[pad >> 5] |= 1u << (pad & 31);
   }
 }
 
-// TODO: When we figure out sending sysex to the host's client device, we can simplify this.
-void paint_mk2_host_launchpad(struct board_state *board_state) {
-    // Write note messages for the host side until we figure out sysex there.
-    for (int launchpad_note = 10; launchpad_note < 89; launchpad_note++) {
-        int column = launchpad_note % 10;
-        int row = ((launchpad_note - column)/10) - 1;
+// Call once everything in a frame has been sent in bulk.
+static void mark_frame_painted(struct pad_frame *frame) {
+  memset(frame->dirty_pads, 0, sizeof(frame->dirty_pads));
+  frame->is_valid = true;
+}
 
-        uint8_t velocity = 0;
+// Work out what a Launchpad should be showing. If nothing has been painted
+// yet (or the offset has changed), we look at every pad, otherwise only at the
+// pads for the notes that have been pressed or released since the last pass.
+// Either way, only pads whose colour actually changes are flagged.
+//
+// This is inlined into each model's functions, so that the profile's tables
+// are constants there.
+static inline __attribute__((always_inline)) void update_frame(struct board_state *board_state, struct pad_frame *frame, struct note_pads *note_pads, uint8_t offset, const struct device_profile *profile) {
+  bool check_all_pads = !frame->is_valid;
+
+  if (!note_pads_are_current(note_pads, &board_state->layout, offset)) {
+    build_note_pads(note_pads, &board_state->layout, offset, profile->cell_for_pad, profile->painted_pads);
+    check_all_pads = true;
+  }
 
-        // Skip the first column as we need to keep those black for controls.
-        if (column) {
-          int tuned_note = (board_state->host.offset) + (column * 3) + (row * 4);
+  if (check_all_pads) {
+    for (int word = 0; word < 4; word++) {
+      uint32_t pad_bits = profile->painted_pads[word];
 
-          if (tuned_note < 128) {
+      while (pad_bits) {
+        uint8_t pad = (word << 5) + __builtin_ctz(pad_bits);
+        pad_bits &= pad_bits - 1;
 
-            if (board_state->held_note_velocities[tuned_note] > 0) {
-              velocity = 79; // Blue
-            }
-            else {
-              enum NoteType tuned_note_type = get_type_for_note(tuned_note);
+        int tuned_note = tuned_note_for_pad(&board_state->layout, profile->cell_for_pad, offset, pad);
+        set_pad_colour(frame, pad, pad_colour_for_note(board_state, profile->colours, tuned_note));
+      }
+    }
 
-              if (tuned_note_type == C_NATURAL) {
-                velocity = 120; // Red
-              }
-              else if (tuned_note_type == NON_C_NATURAL) {
-                velocity = 3; // White
-              }
-            }
-         }
+    return;
+  }
+
+  for (int word = 0; word < 4; word++) {
+    uint32_t note_bits = board_state->repaint_notes[word];
 
-        uint8_t note_on_message[3] = {
-          MIDI_CIN_NOTE_ON << 4, launchpad_note, velocity
-        };
+    while (note_bits) {
+      uint8_t note = (word << 5) + __builtin_ctz(note_bits);
+      note_bits &= note_bits - 1;
 
-        // tuh_midi_stream_write(board_state->host.client_idx, 1, note_on_message, sizeof(note_on_message));
-        tuh_midi_stream_write(0, 1, note_on_message, sizeof(note_on_message));
+      uint8_t colour = pad_colour_for_note(board_state, profile->colours, note);
+      for (int a = note_pads->first_pad[note]; a < note_pads->first_pad[note + 1]; a++) {
+        set_pad_colour(frame, note_pads->pads[a], colour);
       }
     }
+  }
 }
 
-// TODO: When we figure out sending sysex to the host's client device, we can
-// simplify this by using their sysex strategy (see the client implementation).
-// TODO: Don't paint the left column of (non square pad) buttons.
-
-void paint_mk3_host_launchpad(struct board_state *board_state) {
-  for (int row = 0; row < 8; row++) {
-    for (int column = 0; column < 10; column++) {
-      // Offset the row by one to skip the very lowest row of buttons and paint the square pads.
-      int launchpad_note = ((row + 1) * 10) + column;
-
-      int tuned_note = board_state->host.offset + (column * 3) + (row * 4);
-      enum NoteType tuned_note_type = get_type_for_note(tuned_note);
-
-      uint8_t velocity = 0; // Black / Unlit
-
-      // We have to paint the first column black because there are also
-      // controls we use there.
-      if (column) {
-        if (board_state->held_note_velocities[tuned_note] > 0) {
-          velocity = 79; // Blue
-        }
-        else {
-          if (tuned_note_type == C_NATURAL) {
-            velocity = 120; // Red
-          }
-          else if (tuned_note_type == NON_C_NATURAL) {
-            velocity = 3; // White
-          }
-        }
-      }
+int count_dirty_pads(const struct pad_frame *frame) {
+  return __builtin_popcount(frame->dirty_pads[0]) + __builtin_popcount(frame->dirty_pads[1]) +
+    __builtin_popcount(frame->dirty_pads[2]) + __builtin_popcount(frame->dirty_pads[3]);
+}
+
+bool frame_needs_paint(const struct pad_frame *frame) {
+  return !frame->is_valid || count_dirty_pads(frame) > 0;
+}
 
+// Send a note on for each pad whose colour has changed. Every model we support
+// accepts this, although the MK1 uses its own note numbers and colours (which
+// are already accounted for in the frame). Anything we fail to send is left
+// flagged for the next pass.
+void paint_dirty_pads(struct pad_frame *frame, const struct launchpad_sink *sink) {
+  for (int word = 0; word < 4; word++) {
+    uint32_t dirty_bits = frame->dirty_pads[word];
+
+    while (dirty_bits) {
+      int bit = __builtin_ctz(dirty_bits);
+      dirty_bits &= dirty_bits - 1;
+
+      uint8_t pad = (word << 5) + bit;
       uint8_t note_on_message[3] = {
-        MIDI_CIN_NOTE_ON << 4, launchpad_note, velocity
+        MIDI_CIN_NOTE_ON << 4, pad, frame->colours[pad]
       };
 
-      // The MK3 wants data on the first cable, i.e. "MIDI" and not "DIN" or "DAW"
-      tuh_midi_stream_write(board_state->host.client_idx, 0, note_on_message, sizeof(note_on_message));
+      if (write_to_sink(sink, note_on_message, sizeof(note_on_message)) != sizeof(note_on_message)) {
+        return;
+      }
+
+      frame->dirty_pads[word] &= ~(1u << bit);
     }
   }
+
+  frame->is_valid = true;
 }
 
-void process_incoming_host_packet(uint8_t *incoming_packet, struct board_state *board_state) {
-    if (board_state->host.launchpad_version == MK1) {
-        process_incoming_mk1_packet(incoming_packet, board_state, HOST);
-    }
-    else if (board_state->host.launchpad_version == MK2) {
-        process_incoming_mk2_packet(incoming_packet, board_state, HOST);
-    }
-    else if (board_state->host.launchpad_version == MK3) {
-        process_incoming_mk3_packet(incoming_packet, board_state, HOST);
+// Send every flagged pad in a single "set LEDs" sysex, i.e. the header from
+// the profile, then each LED (optionally preceded by a lighting type of 0, for
+// a static colour) and its palette colour.
+void paint_frame_sysex(const struct device_profile *profile, struct pad_frame *frame, const struct launchpad_sink *sink) {
+  uint8_t set_leds_sysex[8 + (3 * 128)] = {
+    0xF0, 0x00, 0x20, 0x29, 0x02, profile->sysex_device_id, profile->sysex_set_leds
+  };
+
+  int length = 7;
+
+  for (int word = 0; word < 4; word++) {
+    uint32_t dirty_bits = frame->dirty_pads[word];
+
+    while (dirty_bits) {
+      uint8_t pad = (word << 5) + __builtin_ctz(dirty_bits);
+      dirty_bits &= dirty_bits - 1;
+
+      if (profile->sysex_lighting_type) {
+        set_leds_sysex[length++] = 0;
+      }
+
+      set_leds_sysex[length++] = pad;
+      set_leds_sysex[length++] = frame->colours[pad];
     }
+  }
+
+  set_leds_sysex[length++] = 0xF7;
+
+  // If this doesn't all go through, we can't tell which pads made it, so
+  // paint everything next time.
+  if (write_to_sink(sink, set_leds_sysex, length) == (uint32_t) length) {
+    mark_frame_painted(frame);
+  }
+  else {
+    invalidate_frame(frame);
+  }
 }
 
-void process_incoming_client_packet(uint8_t *incoming_packet, struct board_state *board_state) {
-    uint8_t cable = (incoming_packet[0] >> 4) & 0xf;
+// There is a wacky mode for note on messages on channel 3 where the note is
+// one colour for one pad and the velocity is the colour for the next pad. You
+// blaze through them in sequnce from the top-left corner, which is also the
+// order the MK1 numbers its pads in.
+static void paint_frame_rapid_update(struct pad_frame *frame, const struct launchpad_sink *sink) {
+  // We send the whole update as one write, so that it either all goes out
+  // (or into the queue), or none of it does.
+  uint8_t bulk_update[3 + (32 * 3)] = {
+    // An initial (out of range) note to force any existing bulk update mode
+    // to end.
+    MIDI_CIN_NOTE_ON << 4, 127, 0
+  };
 
-    // MK1
-    if (cable == 0) {
-      process_incoming_mk1_packet(incoming_packet, board_state, CLIENT);
-    }
-    // MK2
-    else if (cable == 1) {
-      process_incoming_mk2_packet(incoming_packet, board_state, CLIENT);
-    }
-    // MK3
-    else if (cable == 2) {
-      process_incoming_mk3_packet(incoming_packet, board_state, CLIENT);
-    }
-    // Passthrough "notes" channel
-    else if (cable == 3) {
-      process_incoming_external_packet(incoming_packet, board_state);
+  int length = 3;
+  for (int launchpad_row = 0; launchpad_row < 8; launchpad_row++) {
+    for (int launchpad_column = 0; launchpad_column < 8; launchpad_column += 2) {
+      uint8_t first_note = (launchpad_row * 16) + launchpad_column;
+
+      bulk_update[length++] = 0x92;
+      bulk_update[length++] = frame->colours[first_note];
+      bulk_update[length++] = frame->colours[first_note + 1];
     }
+  }
+
+  if (write_to_sink(sink, bulk_update, length) == (uint32_t) length) {
+    mark_frame_painted(frame);
+  }
 }
 
-void increment_offset(struct board_state *board_state, enum HostOrClient hostOrClient, int cable, int increment) {
-  if (hostOrClient == HOST) {
-    board_state -> host.offset += increment;
+// Host Launchpads have an offset (and pads) per index, client Launchpads one
+// per cable.
+static uint8_t *offset_for_sink(struct board_state *board_state, const struct launchpad_sink *sink) {
+  if (sink->host_or_client == HOST) {
+    return &board_state->host_by_idx[sink->idx].offset;
+  }
+
+  return &board_state->client.offset_by_cable[sink->cable];
+}
+
+static struct pad_holds *pad_holds_for_sink(struct board_state *board_state, const struct launchpad_sink *sink) {
+  if (sink->host_or_client == HOST) {
+    return &board_state->host_by_idx[sink->idx].pad_holds;
+  }
+
+  return &board_state->client.pad_holds_by_cable[sink->cable];
+}
+
+// The generic engine, which DEFINE_DEVICE_ENGINE turns into a set of functions
+// for a single profile.
+
+static inline __attribute__((always_inline)) void paint_launchpad(const struct device_profile *profile, struct board_state *board_state, struct pad_frame *frame, struct note_pads *note_pads, uint8_t offset, const struct launchpad_sink *sink) {
+  update_frame(board_state, frame, note_pads, offset, profile);
+
+  if (profile->bulk_paint == BULK_PAINT_NONE || (frame->is_valid && count_dirty_pads(frame) < profile->bulk_paint_threshold)) {
+    paint_dirty_pads(frame, sink);
+  }
+  else if (profile->bulk_paint == BULK_PAINT_RAPID_UPDATE) {
+    paint_frame_rapid_update(frame, sink);
   }
   else {
-    board_state -> client.offset_by_cable[cable] += increment;
+    paint_frame_sysex(profile, frame, sink);
   }
 }
 
-// Respond to MK1 (Launchpad S) controls
-void process_incoming_mk1_packet (uint8_t *incoming_packet, struct board_state *board_state, enum HostOrClient hostOrClient) {
+static inline __attribute__((always_inline)) void process_incoming_packet(const struct device_profile *profile, enum LaunchpadVersion family, uint8_t *incoming_packet, struct board_state *board_state, const struct launchpad_sink *sink) {
   uint8_t data[3];
   memcpy(data, incoming_packet + 1, 3);
 
-  int offset = hostOrClient == HOST ? board_state -> host.offset : board_state->client.offset_by_cable[0]; 
+  uint8_t *offset = offset_for_sink(board_state, sink);
+  struct pad_holds *pad_holds = pad_holds_for_sink(board_state, sink);
 
   // Start with the message type
   int type = data[0] >> 4;
 
-  // Handle square pads (notes) and relevant round pads (outside columns)
-  if (type == MIDI_CIN_NOTE_ON || type == MIDI_CIN_NOTE_OFF || type == MIDI_CIN_CONTROL_CHANGE || type == MIDI_CIN_POLY_KEYPRESS) {
-    if (data[1] >=11 && data[1] <= 89) {
-      // The Launchpad S has a weird layout, i.e. each row has 16 columns, 8
-      // square pads, 1 circular pad, and 7 unused columns. It also has note
-      // zero in the top row, which is the opposite of other Launchpad.  We're
-      // also offset by one column, i.e. our column 0 is everyone else's column
-      // 1.
-      int column = (data[1] % 16 + 1);
-      int row = 7 - trunc(data[1]/16);
+  // Handle square pads (notes) and, where they play notes, the round pads
+  // around the grid (control changes).
+  if (type == MIDI_CIN_NOTE_ON || type == MIDI_CIN_NOTE_OFF || type == MIDI_CIN_POLY_KEYPRESS || (profile->control_changes_play_notes && type == MIDI_CIN_CONTROL_CHANGE)) {
+    uint8_t pad = data[1] & 0x7F;
+
+    // Pass the velocity through the family's velocity curve. Pressure is
+    // left alone, the curves are for how hard a pad is hit, and a fixed curve
+    // would flatten all of it.
+    const uint8_t *velocity_table = board_state->velocity_curves.table_by_family[family];
+    uint8_t velocity = data[2] & 0x7F;
+    if (type == MIDI_CIN_NOTE_OFF) {
+      velocity = 0;
+    }
+    else if (type != MIDI_CIN_POLY_KEYPRESS) {
+      velocity = velocity_table[velocity];
+    }
 
-      // Calculate the note from the row and ofset (our column zero is column
-      // one everywhere else, so adjust that as well).
-      //       int first_tuned_note = board_state->client.offset_by_cable[0] + (column * 3) + (row * 4);
+    // A pad that's already down keeps the note it started with, whatever the
+    // offset is now.
+    if (pad_holds->held_pads[pad >> 5] & (1u << (pad & 31))) {
+      if (velocity) {
+        set_held_note_velocity(board_state, pad_holds->note_for_pad[pad], velocity);
+      }
+      else {
+        release_pad(board_state, pad_holds, pad);
+      }
+    }
+    // Pressure on its own doesn't start a note.
+    else if (velocity && type != MIDI_CIN_POLY_KEYPRESS) {
+      int tuned_note = tuned_note_for_pad(&board_state->layout, profile->cell_for_pad, *offset, pad);
+
+      if (tuned_note >= 0) {
+        hold_pad(board_state, pad_holds, pad, tuned_note);
+        set_held_note_velocity(board_state, tuned_note, velocity);
+      }
+    }
+  }
+
+  // The sustain button works like a pedal, i.e. only while it's held down.
+  if (type == MIDI_CIN_CONTROL_CHANGE && data[1] == profile->sustain_control) {
+    uint8_t source = sink->host_or_client == HOST ? SUSTAIN_SOURCE_HOST(sink->idx) : SUSTAIN_SOURCE_CLIENT(sink->cable);
+    set_sustain_pedal(board_state, source, data[2] != 0);
+  }
 
-      int tuned_note = offset + (column * 3) + (row * 4);
+  // Only react when a control is changed to a non-zero value, i.e. when it's
+  // pressed, and not when it's released.
+  if (type == MIDI_CIN_CONTROL_CHANGE && data[2]) {
+    int increment = 0;
 
-      if (tuned_note < 128) {
-        // Store our velocity in board_state->held_note_velocities
-        board_state->held_note_velocities[tuned_note] = data[2];
+    // The arrows move the layout by a row or a column, as long as the offset
+    // stays a note.
+    int row_interval = board_state->layout.row_interval;
+    int column_interval = board_state->layout.column_interval;
 
-        board_state->is_dirty = true;
+    if (data[1] == profile->arrows[ARROW_UP] && *offset + row_interval <= 127) {
+      increment = row_interval;
+    }
+    else if (data[1] == profile->arrows[ARROW_DOWN] && *offset >= row_interval) {
+      increment = -row_interval;
+    }
+    else if (data[1] == profile->arrows[ARROW_LEFT] && *offset >= column_interval) {
+      increment = -column_interval;
+    }
+    else if (data[1] == profile->arrows[ARROW_RIGHT] && *offset + column_interval <= 127) {
+      increment = column_interval;
+    }
+
+    if (increment) {
+      *offset += increment;
+      board_state->is_dirty = true;
+
+      if (board_state->transpose_mode == TRANSPOSE_RELEASES_NOTES) {
+        release_held_pads(board_state, pad_holds);
       }
     }
+
+    if (data[1] == profile->velocity_curve_control) {
+      velocity_curves_cycle(&board_state->velocity_curves, family);
+    }
+
+    // The layout is shared by every Launchpad.
+    if (data[1] == profile->layout_control) {
+      layout_cycle(&board_state->layout);
+      apply_layout_change(board_state);
+    }
   }
+}
 
-  if (type == MIDI_CIN_CONTROL_CHANGE) {
-    // Only react when a control is changed to a non-zero value, i.e. when it's
-    // pressed, and not when it's released.
-    if (data[2]) {
-      switch(data[1]) {
-        // Upward arrow
-        case 104:
-          if (offset <= 123) {
-            increment_offset(board_state, hostOrClient, 0, 4);
-            board_state->is_dirty = true;
-            clear_all_notes(board_state);
-          }
-          break;
-        // Downward arrow
-        case 105:
-          if (offset >= 4) {
-            increment_offset(board_state, hostOrClient, 0, -4);
-            board_state->is_dirty = true;
-            clear_all_notes(board_state);
-          }
-          break;
-        // Left Arrow
-        case 106:
-          if (offset >= 3) {
-            increment_offset(board_state, hostOrClient, 0, -3);
-            board_state->is_dirty = true;
-            clear_all_notes(board_state);
-          }
-          break;
-        // Right Arrow
-        case 107:
-          if (offset <= 124) {
-            increment_offset(board_state, hostOrClient, 0, 3);
-            board_state->is_dirty = true;
-            clear_all_notes(board_state);
-          }
-          break;
-        // Ignore everything else
-        default:
-          break;
-      }
+#define DEFINE_DEVICE_ENGINE(name, family) \
+  void initialise_##name##_launchpad(const struct launchpad_sink *sink) { \
+    write_to_sink(sink, name##_profile.initialise_messages, name##_profile.initialise_length); \
+  } \
+  void paint_##name##_launchpad(struct board_state *board_state, struct pad_frame *frame, struct note_pads *note_pads, uint8_t offset, const struct launchpad_sink *sink) { \
+    paint_launchpad(&name##_profile, board_state, frame, note_pads, offset, sink); \
+  } \
+  static void update_##name##_frame(struct board_state *board_state, struct pad_frame *frame, struct note_pads *note_pads, uint8_t offset) { \
+    update_frame(board_state, frame, note_pads, offset, &name##_profile); \
+  } \
+  void process_incoming_##name##_packet(uint8_t *incoming_packet, struct board_state *board_state, const struct launchpad_sink *sink) { \
+    process_incoming_packet(&name##_profile, family, incoming_packet, board_state, sink); \
+  }
+
+#define DEVICE_ENGINE(name) { \
+    &name##_profile, \
+    initialise_##name##_launchpad, \
+    paint_##name##_launchpad, \
+    update_##name##_frame, \
+    process_incoming_##name##_packet \
+  }
+
+DEFINE_DEVICE_ENGINE(mk1, MK1)
+DEFINE_DEVICE_ENGINE(mk2, MK2)
+DEFINE_DEVICE_ENGINE(mk3, MK3)
+
+// One entry per LaunchpadVersion. We pick the entry once per Launchpad per
+// pass, everything per pad happens inside the model's own functions.
+struct device_engine {
+  const struct device_profile *profile;
+  void (*initialise)(const struct launchpad_sink*);
+  void (*paint)(struct board_state*, struct pad_frame*, struct note_pads*, uint8_t, const struct launchpad_sink*);
+  void (*update)(struct board_state*, struct pad_frame*, struct note_pads*, uint8_t);
+  void (*process)(uint8_t*, struct board_state*, const struct launchpad_sink*);
+};
+
+static const struct device_engine device_engines[] = {
+  [MK1] = DEVICE_ENGINE(mk1),
+  [MK2] = DEVICE_ENGINE(mk2),
+  [MK3] = DEVICE_ENGINE(mk3)
+};
+
+#define DEVICE_ENGINE_COUNT (sizeof(device_engines) / sizeof(device_engines[0]))
+
+static const struct device_engine *engine_for_version(enum LaunchpadVersion launchpad_version) {
+  if ((unsigned) launchpad_version >= DEVICE_ENGINE_COUNT || !device_engines[launchpad_version].profile) {
+    return NULL;
+  }
+
+  return &device_engines[launchpad_version];
+}
+
+// Each client cable is used by a single model.
+static const struct device_engine *engine_for_cable(uint8_t cable) {
+  for (unsigned a = 0; a < DEVICE_ENGINE_COUNT; a++) {
+    if (device_engines[a].profile && device_engines[a].profile->client_cable == cable) {
+      return &device_engines[a];
     }
   }
+
+  return NULL;
 }
 
-// Respond to MK2 controls
-void process_incoming_mk2_packet (uint8_t *incoming_packet, struct board_state *board_state, enum HostOrClient hostOrClient) {
-  uint8_t data[3];
-  memcpy(data, incoming_packet + 1, 3);
-  
-  int offset = hostOrClient == HOST ? board_state -> host.offset : board_state->client.offset_by_cable[1]; 
+const struct device_profile *profile_for_version(enum LaunchpadVersion launchpad_version) {
+  const struct device_engine *engine = engine_for_version(launchpad_version);
+  return engine ? engine->profile : NULL;
+}
 
-  // Start with the message type
-  int type = data[0] >> 4;
+struct launchpad_sink host_sink(struct board_state *board_state, uint8_t idx) {
+  const struct device_profile *profile = profile_for_version(board_state->host_by_idx[idx].launchpad_version);
+
+  struct launchpad_sink sink = {
+    HOST,
+    idx,
+    profile ? profile->host_cable : 0,
+    &board_state->host_by_idx[idx].queue
+  };
 
-  // Handle square pads (notes) and relevant round pads (outside columns)
-  if (type == MIDI_CIN_NOTE_ON || type == MIDI_CIN_NOTE_OFF || type == MIDI_CIN_POLY_KEYPRESS || type == MIDI_CIN_CONTROL_CHANGE) {
-    uint8_t launchpad_note = data[1];
+  return sink;
+}
 
-    if (launchpad_note >=10 && launchpad_note <= 89) {
-      int column = launchpad_note % 10;
-      int row = ((launchpad_note - column)/10) - 1;
+void initialise_client_launchpads(struct board_state *board_state) {
+  // Whatever was on the Launchpads before, we need to paint everything again.
+  invalidate_client_frames(board_state);
 
-      // Calculate the note from the row and ofset
-      int tuned_note = offset + (column * 3) + (row * 4);
+  for (int cable = 0; cable < 3; cable++) {
+    outbound_queue_clear(&board_state->client.queue_by_cable[cable]);
 
-      if (tuned_note < 128) {
-        // Store our velocity in board_state->held_note_velocities
-        board_state->held_note_velocities[tuned_note] = data[2];
+    // A sustain button that was down when the computer went away is never
+    // going to be let go.
+    set_sustain_pedal(board_state, SUSTAIN_SOURCE_CLIENT(cable), false);
 
-        board_state->is_dirty = true;
-      }
-    }    
-  }
-
-  if (type == MIDI_CIN_CONTROL_CHANGE) {
-    // Only react when a control is changed to a non-zero value, i.e. when it's pressed, and not when it's released.
-    if (data[2]) {
-      switch(data[1]) {
-        // Upward arrow
-        case 91:
-          if (offset <= 123) {
-            increment_offset(board_state, hostOrClient, 1, 4);
-            board_state->is_dirty = true;
-            clear_all_notes(board_state);
-          }
-          break;
-        // Downward arrow
-        case 92:
-          if (offset >= 4) {
-            increment_offset(board_state, hostOrClient, 1, -4);
-            board_state->is_dirty = true;
-            clear_all_notes(board_state);
-          }
-          break;
-        // Left Arrow
-        case 93:
-          if (offset >= 3) {
-            increment_offset(board_state, hostOrClient, 1, -3);
-            board_state->is_dirty = true;
-            clear_all_notes(board_state);
-          }
-          break;
-        // Right Arrow
-        case 94:
-          if (offset <= 124) {
-            increment_offset(board_state, hostOrClient, 1, 3);
-            board_state->is_dirty = true;
-            clear_all_notes(board_state);
-          }
-          break;
-        // Ignore everything else
-        default:
-          break;
-      }
+    const struct device_engine *engine = engine_for_cable(cable);
+    if (engine) {
+      struct launchpad_sink sink = client_sink(board_state, cable);
+      engine->initialise(&sink);
     }
   }
 }
 
-// Respond to MK3 controls
-void process_incoming_mk3_packet (uint8_t *incoming_packet, struct board_state *board_state, enum HostOrClient hostOrClient) {
-  uint8_t data[3];
-  memcpy(data, incoming_packet + 1, 3);
+void initialise_host_launchpad(struct board_state *board_state, uint8_t idx) {
+  invalidate_host_frame(board_state, idx);
 
-  int offset = hostOrClient == HOST ? board_state -> host.offset : board_state->client.offset_by_cable[2]; 
+  // Whatever was waiting was meant for whatever was connected before.
+  outbound_queue_clear(&board_state->host_by_idx[idx].queue);
 
-  // Start with the message type
-  int type = data[0] >> 4;
+  const struct device_engine *engine = engine_for_version(board_state->host_by_idx[idx].launchpad_version);
+  if (engine) {
+    struct launchpad_sink sink = host_sink(board_state, idx);
+    engine->initialise(&sink);
+  }
+}
 
-  // Handle square pads (notes) and relevant round pads (outside columns)
-  if (type == MIDI_CIN_NOTE_ON || type == MIDI_CIN_NOTE_OFF || type == MIDI_CIN_POLY_KEYPRESS || type == MIDI_CIN_CONTROL_CHANGE) {
-    if (data[1] >=11 && data[1] <= 89) {
-      int column = data[1] % 10;
+void paint_client_launchpads(struct board_state *board_state) {
+  for (int cable = 0; cable < 3; cable++) {
+    paint_client_launchpad(board_state, cable);
+  }
+}
 
-      // Skip the first column, which we have to use as controls.
-      if (column) {
-        // Offset the row by one to skip the very lowest row of buttons and paint the square pads.
-        int row = ((data[1] - column)/10) - 1;
+void paint_client_launchpad(struct board_state *board_state, uint8_t cable) {
+  const struct device_engine *engine = engine_for_cable(cable);
+  if (engine) {
+    struct launchpad_sink sink = client_sink(board_state, cable);
+    engine->paint(board_state, &board_state->client.frame_by_cable[cable], &board_state->client.note_pads_by_cable[cable], board_state->client.offset_by_cable[cable], &sink);
+  }
+}
 
+// Each Launchpad on the host port has its own offset and frame, so a wall of
+// them can each show a different part of the tonnetz.
+void paint_host_launchpads(struct board_state *board_state) {
+  for (int idx = 0; idx < MAX_HOST_LAUNCHPADS; idx++) {
+    if (board_state->host_by_idx[idx].launchpad_version != UNkNOWN && tuh_midi_mounted(idx)) {
+      paint_host_launchpad(board_state, idx);
+    }
+  }
+}
 
-        // Calculate the note from the row and ofset
-        int tuned_note = offset + (column * 3) + (row * 4);
+void paint_host_launchpad(struct board_state *board_state, uint8_t idx) {
+  struct host_state *host = &board_state->host_by_idx[idx];
 
-        if (tuned_note < 128) {
-          // Store our velocity in board_state -> held_note_velocities
-          board_state->held_note_velocities[tuned_note] = data[2];
+  const struct device_engine *engine = engine_for_version(host->launchpad_version);
+  if (engine) {
+    struct launchpad_sink sink = host_sink(board_state, idx);
+    engine->paint(board_state, &host->frame, &host->note_pads, host->offset, &sink);
+  }
+}
 
-          board_state->is_dirty = true;
-        }
-      }
-    }    
-  }
-
-  if (type == MIDI_CIN_CONTROL_CHANGE) {
-    // Only react when a control is changed to a non-zero value, i.e. when it's pressed, and not when it's released.
-    if (data[2]) {
-      switch(data[1]) {
-        // Upward arrow
-        case 80:
-          if (offset <= 123) {
-            increment_offset(board_state, hostOrClient, 2, 4);
-            board_state->is_dirty = true;
-            clear_all_notes(board_state);
-          }
-          break;
-        // Downward arrow
-        case 70:
-          if (offset >= 4) {
-            increment_offset(board_state, hostOrClient, 2, -4);
-            board_state->is_dirty = true;
-            clear_all_notes(board_state);
-          }
-          break;
-        // Left Arrow
-        case 91:
-          if (offset >= 3) {
-            increment_offset(board_state, hostOrClient, 2, -3);
-            board_state->is_dirty = true;
-            clear_all_notes(board_state);
-          }
-          break;
-        // Right Arrow
-        case 92:
-          if (offset <= 124) {
-            increment_offset(board_state, hostOrClient, 2, 3);
-            board_state->is_dirty = true;
-            clear_all_notes(board_state);
-          }
-          break;
-        // Ignore everything else
-        default:
-          break;
-      }
-    }
+// Bring a frame up to date without sending anything, for a Launchpad that
+// isn't due a paint yet (see paint_scheduler.c). The changes stay flagged in
+// the frame until it is next painted.
+void update_client_launchpad_frame(struct board_state *board_state, uint8_t cable) {
+  const struct device_engine *engine = engine_for_cable(cable);
+  if (engine) {
+    engine->update(board_state, &board_state->client.frame_by_cable[cable], &board_state->client.note_pads_by_cable[cable], board_state->client.offset_by_cable[cable]);
+  }
+}
+
+void update_host_launchpad_frame(struct board_state *board_state, uint8_t idx) {
+  struct host_state *host = &board_state->host_by_idx[idx];
+
+  const struct device_engine *engine = engine_for_version(host->launchpad_version);
+  if (engine) {
+    engine->update(board_state, &host->frame, &host->note_pads, host->offset);
+  }
+}
+
+void process_incoming_host_packet(uint8_t *incoming_packet, struct board_state *board_state, uint8_t idx) {
+  const struct device_engine *engine = engine_for_version(board_state->host_by_idx[idx].launchpad_version);
+  if (engine) {
+    struct launchpad_sink sink = host_sink(board_state, idx);
+    engine->process(incoming_packet, board_state, &sink);
+  }
+}
+
+void process_incoming_client_packet(uint8_t *incoming_packet, struct board_state *board_state) {
+  uint8_t cable = (incoming_packet[0] >> 4) & 0xf;
+
+  // Passthrough "notes" channel
+  if (cable == 3) {
+    process_incoming_external_packet(incoming_packet, board_state);
+    return;
+  }
+
+  const struct device_engine *engine = engine_for_cable(cable);
+  if (engine) {
+    struct launchpad_sink sink = client_sink(board_state, cable);
+    engine->process(incoming_packet, board_state, &sink);
   }
 }
 
 void process_incoming_external_packet(uint8_t *incoming_packet, struct board_state *board_state) {
+  uint8_t cin = incoming_packet[0] & 0x0F;
+
+  if (cin >= MIDI_CIN_SYSEX_START && cin <= MIDI_CIN_SYSEX_END_3BYTE) {
+    uint8_t length = sysex_buffer_add_packet(&board_state->client_sysex, incoming_packet);
+    if (length) {
+      process_sysex_command(board_state, board_state->client_sysex.data, length);
+    }
+    return;
+  }
+
   uint8_t data[3];
   memcpy(data, incoming_packet + 1, 3);
 
@@ -665,36 +891,34 @@ void process_incoming_external_packet(uint8_t *incoming_packet, struct board_sta
 
   if (type == MIDI_CIN_NOTE_ON || type == MIDI_CIN_POLY_KEYPRESS) {
     // Store our velocity in board_state -> held_note_velocities
-    board_state->held_note_velocities[data[1]] = data[2];
-    board_state->is_dirty = true;
+    set_held_note_velocity(board_state, data[1], data[2]);
   } 
   else if (type == MIDI_CIN_NOTE_OFF) {
     // Store our velocity in board_state -> held_note_velocities
-    board_state->held_note_velocities[data[1]] = 0;
-    board_state->is_dirty = true;
+    set_held_note_velocity(board_state, data[1], 0);
   } 
+  else if (type == MIDI_CIN_CONTROL_CHANGE && data[1] == 64) {
+    // The sustain pedal, which is down from 64 up.
+    set_sustain_pedal(board_state, SUSTAIN_SOURCE_CC, data[2] >= 64);
+  }
 
 }
 
 
 enum LaunchpadVersion get_launchpad_version (uint16_t idVendor, uint16_t idProduct) {
-  enum LaunchpadVersion launchpad_version;
-
   // TODO: For whatever reason this is not detected properly. It may also be why
   // the Launchpad S doesn't work in host mode.
-  launchpad_version = MK3;
+  enum LaunchpadVersion launchpad_version = MK3;
 
   if (idVendor == 0x1235) {
-    if (idProduct == 0x000E) {
-      launchpad_version = MK1;
-    }
-    else if (idProduct >= 0x0051 && idProduct <= 0x0060) {
-      launchpad_version = MK2;
-    }
-    else if (idProduct >= 0x0123 && idProduct <= 0x0132) {
-      launchpad_version = MK3;
+    for (unsigned a = 0; a < DEVICE_ENGINE_COUNT; a++) {
+      const struct device_profile *profile = device_engines[a].profile;
+
+      if (profile && idProduct >= profile->first_product_id && idProduct <= profile->last_product_id) {
+        launchpad_version = a;
+      }
     }
   }
 
   return launchpad_version;
-}
\ No newline at end of file
+}
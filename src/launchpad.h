@@ -6,6 +6,19 @@ extern "C" {
 #endif
 
 #include <stdbool.h>
+#include <stdint.h>
+
+#include "aftertouch.h"
+#include "arpeggiator.h"
+#include "chords.h"
+#include "device_profile.h"
+#include "latency.h"
+#include "layout.h"
+#include "midi_packets.h"
+#include "mpe.h"
+#include "outbound_queue.h"
+#include "sustain.h"
+#include "velocity_curves.h"
 
 enum NoteType {
     C_NATURAL,
@@ -20,15 +33,63 @@ enum LaunchpadVersion {
   MK3
 };
 
+// What we last asked a single Launchpad to show, indexed by the note number
+// the Launchpad itself uses for each pad. Pads whose colour has changed but
+// has not been sent yet are flagged in `dirty_pads`.
+struct pad_frame {
+    uint8_t colours[128];
+    uint32_t dirty_pads[4];
+
+    // False until a full frame has been sent, for example after the device is
+    // (re)connected.
+    bool is_valid;
+};
+
+// Which note each pad is holding down, so that releasing a pad always
+// releases the note it started, even if the offset has changed since.
+struct pad_holds {
+    uint32_t held_pads[4];
+    uint8_t note_for_pad[128];
+};
+
+// What happens to held notes when a Launchpad's offset (or the layout)
+// changes.
+enum TransposeMode {
+    // Held notes keep sounding until their pad is released.
+    TRANSPOSE_KEEPS_NOTES,
+
+    // Everything held on that Launchpad is released.
+    TRANSPOSE_RELEASES_NOTES
+};
+
+// How many Launchpads we track on the host port, which should match
+// CFG_TUH_MIDI in tusb_config.h (i.e. four, behind a hub).
+#define MAX_HOST_LAUNCHPADS 4
+
+// One of these per TinyUSB MIDI host index. A slot is free when its
+// `launchpad_version` is UNkNOWN.
 struct host_state {
     uint8_t offset;
 
-    uint8_t client_idx;
     enum LaunchpadVersion launchpad_version;
+
+    struct pad_frame frame;
+    struct note_pads note_pads;
+
+    struct pad_holds pad_holds;
+
+    struct outbound_queue queue;
 };
 
 struct client_state {
     uint8_t offset_by_cable[3];
+
+    struct pad_frame frame_by_cable[3];
+    struct note_pads note_pads_by_cable[3];
+
+    struct pad_holds pad_holds_by_cable[3];
+
+    struct outbound_queue queue_by_cable[3];
 };
 
 struct board_state {
@@ -38,11 +99,51 @@ struct board_state {
     // What notes are already playing
     uint8_t playing_note_velocities[128];
 
+    // Notes whose held velocity has changed since they were last sent, one
+    // bit per note (see set_held_note_velocity).
+    uint32_t pending_notes[4];
+
+    // Notes that have been pressed or released since the last repaint.
+    uint32_t repaint_notes[4];
+
+    // How many pads (on every Launchpad) are holding each note, see
+    // struct pad_holds.
+    uint8_t holds_by_note[128];
+
+    enum TransposeMode transpose_mode;
+
     // Whether we need to redraw (for example, when the tuning changes or a pad is held/released).
     bool is_dirty;
 
-    struct host_state host;
+    struct host_state host_by_idx[MAX_HOST_LAUNCHPADS];
     struct client_state client;
+
+    struct latency_stats latency;
+
+    // How pad velocities are mapped for each family (see velocity_curves.h).
+    struct velocity_curves velocity_curves;
+
+    // How notes are laid out on the pads (see layout.h).
+    struct layout layout;
+
+    // How often pressure changes are sent (see aftertouch.h).
+    struct aftertouch_coalescer aftertouch;
+
+    // Whether notes go out on a single channel or with MPE (see mpe.h).
+    struct mpe_output mpe;
+
+    // The chord being held, if any (see chords.h).
+    struct chord_tracker chords;
+
+    // Notes that keep sounding once they're released (see sustain.h).
+    struct sustain sustain;
+
+    // Plays the sounding notes one at a time, when it's on (see
+    // arpeggiator.h).
+    struct arpeggiator arpeggiator;
+
+    // Sysex arriving on the "notes" cable (see sysex_commands.h).
+    struct sysex_buffer client_sysex;
 };
 
 enum HostOrClient {
@@ -50,31 +151,86 @@ enum HostOrClient {
     CLIENT
 };
 
-void initialise_client_launchpads(void);
+// Where to send messages for a single Launchpad.
+struct launchpad_sink {
+    enum HostOrClient host_or_client;
+    uint8_t idx;
+    uint8_t cable;
 
-void initialise_mk1_client_launchpads(void);
-void initialise_mk2_client_launchpads(void);
-void initialise_mk3_client_launchpads(void);
+    // Where to keep anything TinyUSB can't take yet. If this is NULL, short
+    // writes are left to the caller.
+    struct outbound_queue *queue;
+};
 
-void paint_client_launchpads(struct board_state*);
+void set_held_note_velocity(struct board_state*, uint8_t, uint8_t);
+
+// Press or release the sustain pedal for a source (see sustain.h), and stop
+// whatever it was keeping going.
+void set_sustain_pedal(struct board_state*, uint8_t, bool);
+
+void set_hold_mode(struct board_state*, uint8_t);
+
+// Release every note held by the pads of a single Launchpad.
+void release_held_pads(struct board_state*, struct pad_holds*);
+
+// Call after changing board_state->layout.
+void apply_layout_change(struct board_state*);
+
+void initialise_client_launchpads(struct board_state*);
+
+struct launchpad_sink client_sink(struct board_state*, uint8_t);
+struct launchpad_sink host_sink(struct board_state*, uint8_t);
 
-void paint_mk1_client_launchpads(struct board_state*);
-void paint_mk2_client_launchpads(struct board_state*);
-void paint_mk3_client_launchpads(struct board_state*);
+void flush_outbound_queues(struct board_state*);
+void initialise_host_launchpad(struct board_state*, uint8_t);
+
+void initialise_mk1_launchpad(const struct launchpad_sink*);
+void initialise_mk2_launchpad(const struct launchpad_sink*);
+void initialise_mk3_launchpad(const struct launchpad_sink*);
+
+void invalidate_frame(struct pad_frame*);
+void invalidate_client_frames(struct board_state*);
+void invalidate_host_frame(struct board_state*, uint8_t);
+void invalidate_host_frames(struct board_state*);
+
+void set_pad_colour(struct pad_frame*, uint8_t, uint8_t);
+
+extern const uint8_t mk1_colours[5];
+extern const uint8_t palette_colours[5];
+
+uint8_t pad_colour_for_note(struct board_state*, const uint8_t*, int);
+
+int count_dirty_pads(const struct pad_frame*);
+bool frame_needs_paint(const struct pad_frame*);
+
+void paint_dirty_pads(struct pad_frame*, const struct launchpad_sink*);
+void paint_frame_sysex(const struct device_profile*, struct pad_frame*, const struct launchpad_sink*);
+
+// The profile for a model, or NULL for UNkNOWN.
+const struct device_profile *profile_for_version(enum LaunchpadVersion);
+
+// These are generated from each model's profile, see DEFINE_DEVICE_ENGINE.
+
+void paint_mk1_launchpad(struct board_state*, struct pad_frame*, struct note_pads*, uint8_t, const struct launchpad_sink*);
+void paint_mk2_launchpad(struct board_state*, struct pad_frame*, struct note_pads*, uint8_t, const struct launchpad_sink*);
+void paint_mk3_launchpad(struct board_state*, struct pad_frame*, struct note_pads*, uint8_t, const struct launchpad_sink*);
+
+void paint_client_launchpads(struct board_state*);
+void paint_client_launchpad(struct board_state*, uint8_t);
 
-void paint_host_launchpad(struct board_state*);
+void update_client_launchpad_frame(struct board_state*, uint8_t);
+void update_host_launchpad_frame(struct board_state*, uint8_t);
 
-void paint_mk1_host_launchpad(struct board_state*);
-void paint_mk2_host_launchpad(struct board_state*);
-void paint_mk3_host_launchpad(struct board_state*);
+void paint_host_launchpads(struct board_state*);
+void paint_host_launchpad(struct board_state*, uint8_t);
 
-void process_incoming_host_packet(uint8_t*, struct board_state*);
+void process_incoming_host_packet(uint8_t*, struct board_state*, uint8_t);
 
 void process_incoming_client_packet(uint8_t *, struct board_state*);
 
-void process_incoming_mk1_packet (uint8_t*, struct board_state*, enum HostOrClient);
-void process_incoming_mk2_packet (uint8_t*, struct board_state*, enum HostOrClient);
-void process_incoming_mk3_packet (uint8_t*, struct board_state*, enum HostOrClient);
+void process_incoming_mk1_packet (uint8_t*, struct board_state*, const struct launchpad_sink*);
+void process_incoming_mk2_packet (uint8_t*, struct board_state*, const struct launchpad_sink*);
+void process_incoming_mk3_packet (uint8_t*, struct board_state*, const struct launchpad_sink*);
 void process_incoming_external_packet(uint8_t*, struct board_state*);
 
 enum LaunchpadVersion get_launchpad_version (uint16_t, uint16_t);
@@ -0,0 +1,189 @@
+#include <string.h>
+#include "launchpad.h"
+#include "layout.h"
+
+// The Launchpad S (MK1) numbers its pads from the top-left corner, with 16
+// notes per row: eight square pads, then a round pad. Our column zero is
+// everyone else's column one, so that the square pads align on all units.
+#define MK1_ROW(row) \
+  [((7 - (row)) * 16) + 0] = CELL(1, row), \
+  [((7 - (row)) * 16) + 1] = CELL(2, row), \
+  [((7 - (row)) * 16) + 2] = CELL(3, row), \
+  [((7 - (row)) * 16) + 3] = CELL(4, row), \
+  [((7 - (row)) * 16) + 4] = CELL(5, row), \
+  [((7 - (row)) * 16) + 5] = CELL(6, row), \
+  [((7 - (row)) * 16) + 6] = CELL(7, row), \
+  [((7 - (row)) * 16) + 7] = CELL(8, row), \
+  [((7 - (row)) * 16) + 8] = CELL(9, row)
+
+// The MK2 and MK3 number their pads from the bottom-left, with ten notes per
+// row, starting from the row of buttons below the square pads.
+#define PRO_ROW(row, plays_first_column) \
+  [(((row) + 1) * 10) + 0] = (plays_first_column) ? CELL(0, row) : 0, \
+  [(((row) + 1) * 10) + 1] = CELL(1, row), \
+  [(((row) + 1) * 10) + 2] = CELL(2, row), \
+  [(((row) + 1) * 10) + 3] = CELL(3, row), \
+  [(((row) + 1) * 10) + 4] = CELL(4, row), \
+  [(((row) + 1) * 10) + 5] = CELL(5, row), \
+  [(((row) + 1) * 10) + 6] = CELL(6, row), \
+  [(((row) + 1) * 10) + 7] = CELL(7, row), \
+  [(((row) + 1) * 10) + 8] = CELL(8, row), \
+  [(((row) + 1) * 10) + 9] = CELL(9, row)
+
+const uint8_t mk1_cell_for_pad[128] = {
+  MK1_ROW(0), MK1_ROW(1), MK1_ROW(2), MK1_ROW(3),
+  MK1_ROW(4), MK1_ROW(5), MK1_ROW(6), MK1_ROW(7)
+};
+
+const uint8_t mk2_cell_for_pad[128] = {
+  PRO_ROW(0, true), PRO_ROW(1, true), PRO_ROW(2, true), PRO_ROW(3, true),
+  PRO_ROW(4, true), PRO_ROW(5, true), PRO_ROW(6, true), PRO_ROW(7, true)
+};
+
+// The first column of the MK3 is used for controls.
+const uint8_t mk3_cell_for_pad[128] = {
+  PRO_ROW(0, false), PRO_ROW(1, false), PRO_ROW(2, false), PRO_ROW(3, false),
+  PRO_ROW(4, false), PRO_ROW(5, false), PRO_ROW(6, false), PRO_ROW(7, false)
+};
+
+// The square pads on the MK1, i.e. the first eight notes of every row of 16.
+const uint32_t mk1_painted_pads[4] = {
+  0x00FF00FF, 0x00FF00FF, 0x00FF00FF, 0x00FF00FF
+};
+
+// Notes 10 to 89 on the MK2 and MK3. The controls in the first column of the
+// MK3 don't play notes, so they're painted black.
+const uint32_t mk2_painted_pads[4] = {
+  0xFFFFFC00, 0xFFFFFFFF, 0x03FFFFFF, 0
+};
+
+const uint32_t mk3_painted_pads[4] = {
+  0xFFFFFC00, 0xFFFFFFFF, 0x03FFFFFF, 0
+};
+
+// The column and row intervals for each Layout, apart from LAYOUT_CUSTOM.
+static const uint8_t intervals_for_layout[LAYOUT_COUNT][2] = {
+  [LAYOUT_TONNETZ] = { 3, 4 },
+  [LAYOUT_WICKI_HAYDEN] = { 2, 5 },
+  [LAYOUT_HARMONIC_TABLE] = { 4, 7 },
+  [LAYOUT_JANKO] = { 2, 1 }
+};
+
+static void build_intervals(struct layout *layout, uint8_t column_interval, uint8_t row_interval) {
+  layout->column_interval = column_interval;
+  layout->row_interval = row_interval;
+
+  memset(layout->interval_for_cell, 0, sizeof(layout->interval_for_cell));
+  for (int row = 0; row < LAYOUT_ROWS; row++) {
+    for (int column = 0; column < LAYOUT_COLUMNS; column++) {
+      layout->interval_for_cell[CELL_INDEX(CELL(column, row))] = (column * column_interval) + (row * row_interval);
+    }
+  }
+
+  layout->generation++;
+}
+
+void layout_init(struct layout *layout) {
+  memset(layout, 0, sizeof(*layout));
+
+  layout->custom_column_interval = intervals_for_layout[LAYOUT_TONNETZ][0];
+  layout->custom_row_interval = intervals_for_layout[LAYOUT_TONNETZ][1];
+
+  layout_select(layout, LAYOUT_TONNETZ);
+}
+
+void layout_select(struct layout *layout, enum Layout selected) {
+  if (selected >= LAYOUT_COUNT) {
+    return;
+  }
+
+  layout->selected = selected;
+
+  if (selected == LAYOUT_CUSTOM) {
+    build_intervals(layout, layout->custom_column_interval, layout->custom_row_interval);
+  }
+  else {
+    build_intervals(layout, intervals_for_layout[selected][0], intervals_for_layout[selected][1]);
+  }
+}
+
+enum Layout layout_cycle(struct layout *layout) {
+  layout_select(layout, (layout->selected + 1) % LAYOUT_COUNT);
+  return layout->selected;
+}
+
+bool layout_set_custom(struct layout *layout, uint8_t column_interval, uint8_t row_interval) {
+  if (column_interval == 0 || row_interval == 0 ||
+      ((LAYOUT_COLUMNS - 1) * column_interval) + ((LAYOUT_ROWS - 1) * row_interval) > LAYOUT_MAX_INTERVAL) {
+    return false;
+  }
+
+  layout->custom_column_interval = column_interval;
+  layout->custom_row_interval = row_interval;
+
+  if (layout->selected == LAYOUT_CUSTOM) {
+    build_intervals(layout, column_interval, row_interval);
+  }
+
+  return true;
+}
+
+#define OCTAVE_NOTE_TYPES \
+  C_NATURAL, SHARP_OR_FLAT, NON_C_NATURAL, SHARP_OR_FLAT, NON_C_NATURAL, NON_C_NATURAL, \
+  SHARP_OR_FLAT, NON_C_NATURAL, SHARP_OR_FLAT, NON_C_NATURAL, SHARP_OR_FLAT, NON_C_NATURAL
+
+const uint8_t note_type_for_note[128] = {
+  OCTAVE_NOTE_TYPES, OCTAVE_NOTE_TYPES, OCTAVE_NOTE_TYPES, OCTAVE_NOTE_TYPES,
+  OCTAVE_NOTE_TYPES, OCTAVE_NOTE_TYPES, OCTAVE_NOTE_TYPES, OCTAVE_NOTE_TYPES,
+  OCTAVE_NOTE_TYPES, OCTAVE_NOTE_TYPES,
+  // The last eight notes, from C9 to G9.
+  C_NATURAL, SHARP_OR_FLAT, NON_C_NATURAL, SHARP_OR_FLAT, NON_C_NATURAL, NON_C_NATURAL,
+  SHARP_OR_FLAT, NON_C_NATURAL
+};
+
+// A counting sort of the painted pads by the note they play.
+void build_note_pads(struct note_pads *note_pads, const struct layout *layout, uint8_t offset, const uint8_t *cell_for_pad, const uint32_t *painted_pads) {
+  uint8_t pad_counts[128] = { 0 };
+
+  for (int word = 0; word < 4; word++) {
+    uint32_t pad_bits = painted_pads[word];
+
+    while (pad_bits) {
+      uint8_t pad = (word << 5) + __builtin_ctz(pad_bits);
+      pad_bits &= pad_bits - 1;
+
+      int tuned_note = tuned_note_for_pad(layout, cell_for_pad, offset, pad);
+      if (tuned_note >= 0) {
+        pad_counts[tuned_note]++;
+      }
+    }
+  }
+
+  note_pads->first_pad[0] = 0;
+  for (int note = 0; note < 128; note++) {
+    note_pads->first_pad[note + 1] = note_pads->first_pad[note] + pad_counts[note];
+  }
+
+  // Reuse the counts as the position of the next pad for each note.
+  for (int note = 0; note < 128; note++) {
+    pad_counts[note] = note_pads->first_pad[note];
+  }
+
+  for (int word = 0; word < 4; word++) {
+    uint32_t pad_bits = painted_pads[word];
+
+    while (pad_bits) {
+      uint8_t pad = (word << 5) + __builtin_ctz(pad_bits);
+      pad_bits &= pad_bits - 1;
+
+      int tuned_note = tuned_note_for_pad(layout, cell_for_pad, offset, pad);
+      if (tuned_note >= 0) {
+        note_pads->pads[pad_counts[tuned_note]++] = pad;
+      }
+    }
+  }
+
+  note_pads->offset = offset;
+  note_pads->layout_generation = layout->generation;
+  note_pads->is_valid = true;
+}
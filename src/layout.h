@@ -0,0 +1,129 @@
+#ifndef _LAYOUT_H_
+#define _LAYOUT_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Lookup tables that describe how notes are laid out on the pads, so that
+// decoding and painting don't have to do any arithmetic per pad.
+//
+// Every model is mapped onto the same grid of ten columns and eight rows,
+// with row zero at the bottom. A "cell" is a position on that grid, with the
+// top bit set so that zero can mean "not a pad we play notes with".
+
+#define CELL_IS_PAD 0x80
+
+#define CELL(column, row) (CELL_IS_PAD | ((row) << 4) | (column))
+#define CELL_INDEX(cell) ((cell) & 0x7F)
+
+#define LAYOUT_COLUMNS 10
+#define LAYOUT_ROWS 8
+
+// The note number each model sends for a pad, mapped to the cell it plays.
+extern const uint8_t mk1_cell_for_pad[128];
+extern const uint8_t mk2_cell_for_pad[128];
+extern const uint8_t mk3_cell_for_pad[128];
+
+// The pads we paint on each model, one bit per note number.
+extern const uint32_t mk1_painted_pads[4];
+extern const uint32_t mk2_painted_pads[4];
+extern const uint32_t mk3_painted_pads[4];
+
+// The isomorphic layouts we can play with, i.e. how many semitones each step
+// to the right (a column) and each step up (a row) moves. The layouts that are
+// usually drawn on a hexagonal grid are sheared onto the Launchpad's square
+// one, i.e. "up and to the right" becomes "up".
+enum Layout {
+    // Minor thirds across and major thirds up, i.e. the Tonnetz.
+    LAYOUT_TONNETZ,
+
+    // Whole tones across and fourths up.
+    LAYOUT_WICKI_HAYDEN,
+
+    // Major thirds across and fifths up.
+    LAYOUT_HARMONIC_TABLE,
+
+    // Whole tones across and semitones up.
+    LAYOUT_JANKO,
+
+    // Set over sysex (see sysex_commands.h).
+    LAYOUT_CUSTOM,
+
+    LAYOUT_COUNT
+};
+
+// Every cell has to play a note below 128 with an offset of zero, i.e.
+// (9 * column interval) + (7 * row interval) must be at most 127.
+#define LAYOUT_MAX_INTERVAL 127
+
+struct layout {
+    uint8_t selected;
+
+    uint8_t column_interval;
+    uint8_t row_interval;
+
+    // Changed whenever the intervals change, so that anything built from
+    // them (see struct note_pads) knows to rebuild.
+    uint32_t generation;
+
+    // How far above the offset each cell is. This is only rebuilt when the
+    // layout changes, so that decoding a pad is still a single lookup.
+    uint8_t interval_for_cell[128];
+
+    uint8_t custom_column_interval;
+    uint8_t custom_row_interval;
+};
+
+// Everything starts with the Tonnetz, and a custom layout that's the same.
+void layout_init(struct layout*);
+
+void layout_select(struct layout*, enum Layout);
+
+// Move on to the next layout, and return it.
+enum Layout layout_cycle(struct layout*);
+
+// Change the intervals used by LAYOUT_CUSTOM. Returns false (and changes
+// nothing) if they're zero or too big (see LAYOUT_MAX_INTERVAL).
+bool layout_set_custom(struct layout*, uint8_t, uint8_t);
+
+// The NoteType of every MIDI note.
+extern const uint8_t note_type_for_note[128];
+
+// Which pads show each note, for a given offset. This is only rebuilt when the
+// offset (or the layout) changes, so that we can repaint just the pads for notes that change.
+// The pads for `note` are pads[first_pad[note]] up to pads[first_pad[note + 1]].
+struct note_pads {
+    uint8_t offset;
+    uint32_t layout_generation;
+    bool is_valid;
+
+    uint8_t first_pad[129];
+    uint8_t pads[128];
+};
+
+void build_note_pads(struct note_pads*, const struct layout*, uint8_t, const uint8_t*, const uint32_t*);
+
+static inline bool note_pads_are_current(const struct note_pads *note_pads, const struct layout *layout, uint8_t offset) {
+  return note_pads->is_valid && note_pads->offset == offset && note_pads->layout_generation == layout->generation;
+}
+
+// The note a pad plays at a given offset, or -1 if it doesn't play one.
+static inline int tuned_note_for_pad(const struct layout *layout, const uint8_t *cell_for_pad, int offset, uint8_t pad) {
+  uint8_t cell = cell_for_pad[pad & 0x7F];
+  if (!cell) {
+    return -1;
+  }
+
+  int tuned_note = offset + layout->interval_for_cell[CELL_INDEX(cell)];
+  return tuned_note < 128 ? tuned_note : -1;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _LAYOUT_H_ */
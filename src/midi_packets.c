@@ -0,0 +1,155 @@
+#include <string.h>
+#include "midi_packets.h"
+#include "tusb.h"
+
+// How many packets we convert at a time when writing to the host port.
+#define HOST_PACKET_CHUNK 16
+
+uint32_t midi_stream_to_packets(uint8_t cable, const uint8_t *stream, uint32_t length, uint8_t (*packets)[4], uint32_t max_packets, uint32_t *consumed) {
+  uint32_t packet_count = 0;
+  uint32_t i = 0;
+
+  // Where the current sysex message ends (i.e. its F7h, or the end of the
+  // stream), so that we only look for it once per message.
+  uint32_t sysex_end = 0;
+  bool sysex_end_known = false;
+
+  while (i < length && packet_count < max_packets) {
+    uint8_t status = stream[i];
+    uint8_t *packet = packets[packet_count];
+
+    // Sysex, which may be the start, middle or end of the message.
+    if (status == 0xF0 || status < 0x80 || status == 0xF7) {
+      if (!sysex_end_known || sysex_end < i) {
+        sysex_end = i;
+        while (sysex_end < length && stream[sysex_end] != 0xF7) {
+          sysex_end++;
+        }
+        sysex_end_known = true;
+      }
+
+      // We can't see the end of the message yet (for example, when resuming a
+      // short write, see outbound_queue.c). We can still send three bytes at a
+      // time, as long as we have three bytes.
+      if (sysex_end == length && length - i < 3) {
+        break;
+      }
+
+      uint32_t remaining = sysex_end == length ? length - i + 1 : sysex_end - i + 1;
+      uint8_t chunk_length = remaining > 3 ? 3 : remaining;
+      uint8_t cin = remaining > 3 ? MIDI_CIN_SYSEX_START : MIDI_CIN_SYSEX_START + chunk_length;
+
+      packet[0] = (cable << 4) | cin;
+      packet[1] = stream[i];
+      packet[2] = chunk_length > 1 ? stream[i + 1] : 0;
+      packet[3] = chunk_length > 2 ? stream[i + 2] : 0;
+
+      i += chunk_length;
+    }
+    // Channel messages, program change and channel pressure only have one
+    // data byte.
+    else if (status < 0xF0) {
+      uint8_t cin = status >> 4;
+      uint8_t message_length = (cin == MIDI_CIN_PROGRAM_CHANGE || cin == MIDI_CIN_CHANNEL_PRESSURE) ? 2 : 3;
+
+      if (i + message_length > length) {
+        break;
+      }
+
+      packet[0] = (cable << 4) | cin;
+      packet[1] = status;
+      packet[2] = stream[i + 1];
+      packet[3] = message_length > 2 ? stream[i + 2] : 0;
+
+      i += message_length;
+    }
+    // We don't send any other system messages, so skip them.
+    else {
+      i++;
+      continue;
+    }
+
+    packet_count++;
+  }
+
+  *consumed = i;
+  return packet_count;
+}
+
+uint8_t midi_packet_length(const uint8_t *packet) {
+  switch (packet[0] & 0x0F) {
+    case MIDI_CIN_SYSEX_END_1BYTE:
+    case MIDI_CIN_1BYTE_DATA:
+      return 1;
+    case MIDI_CIN_SYSCOM_2BYTE:
+    case MIDI_CIN_SYSEX_END_2BYTE:
+    case MIDI_CIN_PROGRAM_CHANGE:
+    case MIDI_CIN_CHANNEL_PRESSURE:
+      return 2;
+    case MIDI_CIN_MISC:
+    case MIDI_CIN_CABLE_EVENT:
+      return 0;
+    default:
+      return 3;
+  }
+}
+
+uint8_t sysex_buffer_add_packet(struct sysex_buffer *sysex, const uint8_t *packet) {
+  uint8_t cin = packet[0] & 0x0F;
+  uint8_t length = midi_packet_length(packet);
+
+  // A new message, throw away anything left over from the last one.
+  if (packet[1] == 0xF0) {
+    sysex->length = 0;
+    sysex->overflowed = false;
+  }
+
+  if (sysex->length + length > SYSEX_BUFFER_SIZE) {
+    sysex->overflowed = true;
+  }
+  else {
+    memcpy(sysex->data + sysex->length, packet + 1, length);
+    sysex->length += length;
+  }
+
+  if (cin == MIDI_CIN_SYSEX_START) {
+    return 0;
+  }
+
+  uint8_t message_length = (!sysex->overflowed && sysex->data[0] == 0xF0) ? sysex->length : 0;
+  sysex->length = 0;
+  sysex->overflowed = false;
+
+  return message_length;
+}
+
+uint32_t host_stream_write(uint8_t idx, uint8_t cable, const uint8_t *stream, uint32_t length) {
+  uint32_t bytes_written = 0;
+
+  while (bytes_written < length) {
+    uint32_t chunk_start = bytes_written;
+    uint8_t packets[HOST_PACKET_CHUNK][4];
+    uint32_t consumed = 0;
+
+    uint32_t packet_count = midi_stream_to_packets(cable, stream + bytes_written, length - bytes_written, packets, HOST_PACKET_CHUNK, &consumed);
+    if (packet_count == 0) {
+      break;
+    }
+
+    for (uint32_t a = 0; a < packet_count; a++) {
+      if (!tuh_midi_packet_write(idx, packets[a])) {
+        tuh_midi_write_flush(idx);
+        return bytes_written;
+      }
+
+      bytes_written += midi_packet_length(packets[a]);
+    }
+
+    // Account for anything we skipped along the way.
+    bytes_written = chunk_start + consumed;
+  }
+
+  tuh_midi_write_flush(idx);
+
+  return bytes_written;
+}
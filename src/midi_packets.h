@@ -0,0 +1,48 @@
+#ifndef _MIDI_PACKETS_H_
+#define _MIDI_PACKETS_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Converting MIDI byte streams into 4-byte USB-MIDI event packets ourselves,
+// so that we can send sysex to the Launchpad connected to the host port.
+
+// Split a stream of complete MIDI messages into packets for a given cable.
+// Sysex is sent three bytes at a time (CIN 0x4), with the last packet using
+// CIN 0x5, 0x6 or 0x7 depending on how many bytes are left. Returns the number
+// of packets written (at most `max_packets`), and sets `consumed` to the
+// number of stream bytes those packets cover.
+uint32_t midi_stream_to_packets(uint8_t, const uint8_t*, uint32_t, uint8_t (*)[4], uint32_t, uint32_t*);
+
+// The number of MIDI bytes carried by a packet.
+uint8_t midi_packet_length(const uint8_t*);
+
+// Reassembles a (short) incoming sysex message from its packets.
+#define SYSEX_BUFFER_SIZE 32
+
+struct sysex_buffer {
+    uint8_t data[SYSEX_BUFFER_SIZE];
+    uint8_t length;
+
+    // Set if the message was too long to keep, in which case it's dropped.
+    bool overflowed;
+};
+
+// Add a sysex packet (CIN 0x4 to 0x7) to the buffer. When the packet completes
+// a message that fits, returns its length (the message is in `data`),
+// otherwise returns zero.
+uint8_t sysex_buffer_add_packet(struct sysex_buffer*, const uint8_t*);
+
+// Write a stream of MIDI messages to a device on the host port, one packet at
+// a time. Returns the number of stream bytes that were written.
+uint32_t host_stream_write(uint8_t, uint8_t, const uint8_t*, uint32_t);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _MIDI_PACKETS_H_ */
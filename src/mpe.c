@@ -0,0 +1,147 @@
+#include <string.h>
+#include "mpe.h"
+
+#define MPE_FREE_SLOTS (MPE_MAX_MEMBERS + 1)
+
+static void push_free_voice(struct mpe_allocator *allocator, uint8_t voice) {
+  allocator->free_voices[allocator->free_tail] = voice;
+  allocator->free_tail = (allocator->free_tail + 1) % MPE_FREE_SLOTS;
+}
+
+static uint8_t pop_free_voice(struct mpe_allocator *allocator) {
+  if (allocator->free_head == allocator->free_tail) {
+    return MPE_NO_VOICE;
+  }
+
+  uint8_t voice = allocator->free_voices[allocator->free_head];
+  allocator->free_head = (allocator->free_head + 1) % MPE_FREE_SLOTS;
+  return voice;
+}
+
+// Add a voice to the newest end of the playing list.
+static void link_voice(struct mpe_allocator *allocator, uint8_t voice) {
+  allocator->older[voice] = allocator->newest;
+  allocator->newer[voice] = MPE_NO_VOICE;
+
+  if (allocator->newest == MPE_NO_VOICE) {
+    allocator->oldest = voice;
+  }
+  else {
+    allocator->newer[allocator->newest] = voice;
+  }
+
+  allocator->newest = voice;
+}
+
+static void unlink_voice(struct mpe_allocator *allocator, uint8_t voice) {
+  uint8_t older = allocator->older[voice];
+  uint8_t newer = allocator->newer[voice];
+
+  if (older == MPE_NO_VOICE) {
+    allocator->oldest = newer;
+  }
+  else {
+    allocator->newer[older] = newer;
+  }
+
+  if (newer == MPE_NO_VOICE) {
+    allocator->newest = older;
+  }
+  else {
+    allocator->older[newer] = older;
+  }
+}
+
+uint8_t mpe_manager_channel(const struct mpe_config *config) {
+  return config->zone == MPE_UPPER_ZONE ? 15 : 0;
+}
+
+static void reset_allocator(struct mpe_allocator *allocator, const struct mpe_config *config) {
+  memset(allocator, 0, sizeof(*allocator));
+  memset(allocator->voice_for_note, MPE_NO_VOICE, sizeof(allocator->voice_for_note));
+
+  allocator->member_count = config->member_count;
+  allocator->oldest = MPE_NO_VOICE;
+  allocator->newest = MPE_NO_VOICE;
+
+  for (uint8_t voice = 0; voice < allocator->member_count; voice++) {
+    allocator->channel_for_voice[voice] = config->zone == MPE_UPPER_ZONE ? 14 - voice : 1 + voice;
+    allocator->note_for_voice[voice] = MPE_NO_VOICE;
+    push_free_voice(allocator, voice);
+  }
+}
+
+void mpe_init(struct mpe_output *output) {
+  memset(output, 0, sizeof(*output));
+
+  output->active.mode = OUTPUT_SINGLE_CHANNEL;
+  output->active.zone = MPE_LOWER_ZONE;
+  output->active.member_count = MPE_MAX_MEMBERS;
+  output->requested = output->active;
+
+  reset_allocator(&output->allocator, &output->active);
+}
+
+void mpe_configure(struct mpe_output *output, const struct mpe_config *config) {
+  output->requested = *config;
+
+  if (output->requested.member_count < 1) {
+    output->requested.member_count = 1;
+  }
+  else if (output->requested.member_count > MPE_MAX_MEMBERS) {
+    output->requested.member_count = MPE_MAX_MEMBERS;
+  }
+
+  output->reconfigure_pending = true;
+}
+
+void mpe_apply_config(struct mpe_output *output) {
+  output->active = output->requested;
+  output->reconfigure_pending = false;
+
+  reset_allocator(&output->allocator, &output->active);
+}
+
+uint8_t mpe_allocate(struct mpe_allocator *allocator, uint8_t note, uint8_t *stolen_note) {
+  note &= 0x7F;
+  *stolen_note = MPE_NO_VOICE;
+
+  // A note only ever needs one voice.
+  if (allocator->voice_for_note[note] != MPE_NO_VOICE) {
+    return allocator->channel_for_voice[allocator->voice_for_note[note]];
+  }
+
+  uint8_t voice = pop_free_voice(allocator);
+
+  if (voice == MPE_NO_VOICE) {
+    voice = allocator->oldest;
+    unlink_voice(allocator, voice);
+
+    *stolen_note = allocator->note_for_voice[voice];
+    allocator->voice_for_note[*stolen_note] = MPE_NO_VOICE;
+    allocator->steals++;
+  }
+
+  allocator->voice_for_note[note] = voice;
+  allocator->note_for_voice[voice] = note;
+  link_voice(allocator, voice);
+  allocator->allocations++;
+
+  return allocator->channel_for_voice[voice];
+}
+
+uint8_t mpe_release(struct mpe_allocator *allocator, uint8_t note) {
+  note &= 0x7F;
+
+  uint8_t voice = allocator->voice_for_note[note];
+  if (voice == MPE_NO_VOICE) {
+    return MPE_NO_VOICE;
+  }
+
+  unlink_voice(allocator, voice);
+  allocator->voice_for_note[note] = MPE_NO_VOICE;
+  allocator->note_for_voice[voice] = MPE_NO_VOICE;
+  push_free_voice(allocator, voice);
+
+  return allocator->channel_for_voice[voice];
+}
@@ -0,0 +1,116 @@
+#ifndef _MPE_H_
+#define _MPE_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// MIDI Polyphonic Expression output on the "notes" cable. Each note gets a
+// member channel of its own, so that its pressure can go out as channel
+// pressure, which is all many MPE synths listen to.
+//
+// Channels are handed out by a fixed-size allocator: released channels wait
+// in a queue (so that a note's release tail gets as long as possible before
+// its channel is reused), and when every channel is busy the note that
+// started longest ago is stolen. Every operation is constant time, i.e.
+// nothing ever looks at all 128 notes.
+
+// Channels are numbered from zero here, i.e. channel 1 is 0.
+#define MPE_MAX_MEMBERS 15
+#define MPE_NO_VOICE 0xFF
+
+enum OutputMode {
+    // Everything on channel 1, with pressure as poly aftertouch.
+    OUTPUT_SINGLE_CHANNEL,
+
+    OUTPUT_MPE
+};
+
+enum MpeZone {
+    // The manager is channel 1, and the members count up from channel 2.
+    MPE_LOWER_ZONE,
+
+    // The manager is channel 16, and the members count down from channel 15.
+    MPE_UPPER_ZONE
+};
+
+struct mpe_config {
+    uint8_t mode;
+    uint8_t zone;
+
+    // 1 to MPE_MAX_MEMBERS.
+    uint8_t member_count;
+};
+
+struct mpe_allocator {
+    uint8_t member_count;
+    uint8_t channel_for_voice[MPE_MAX_MEMBERS];
+
+    // Which voice (i.e. member) is playing each note, and the reverse.
+    uint8_t voice_for_note[128];
+    uint8_t note_for_voice[MPE_MAX_MEMBERS];
+
+    // Voices that aren't playing anything, oldest release first. One spare
+    // slot, so that a full ring can be told apart from an empty one.
+    uint8_t free_voices[MPE_MAX_MEMBERS + 1];
+    uint8_t free_head;
+    uint8_t free_tail;
+
+    // Voices that are playing, as a list from the oldest note on to the
+    // newest, so that the oldest can be stolen.
+    uint8_t older[MPE_MAX_MEMBERS];
+    uint8_t newer[MPE_MAX_MEMBERS];
+    uint8_t oldest;
+    uint8_t newest;
+
+    uint32_t allocations;
+    uint32_t steals;
+};
+
+struct mpe_output {
+    // What we're sending with now, and what we've been asked to switch to
+    // (see mpe_configure).
+    struct mpe_config active;
+    struct mpe_config requested;
+    bool reconfigure_pending;
+
+    struct mpe_allocator allocator;
+};
+
+// Everything starts on a single channel, with a lower zone of fifteen
+// members ready for when MPE is turned on.
+void mpe_init(struct mpe_output*);
+
+// Ask for a new mode or zone. Nothing changes until sync_playing_notes has
+// room to stop the notes that are playing and announce the new zone.
+void mpe_configure(struct mpe_output*, const struct mpe_config*);
+
+// Start using the requested configuration, with every voice free.
+void mpe_apply_config(struct mpe_output*);
+
+// The manager channel for a zone.
+uint8_t mpe_manager_channel(const struct mpe_config*);
+
+// Give a note a voice. If every voice was busy, the oldest note loses its
+// voice, and is returned in `stolen_note` (otherwise that's MPE_NO_VOICE).
+// Returns the voice's channel.
+uint8_t mpe_allocate(struct mpe_allocator*, uint8_t, uint8_t*);
+
+// Give a note's voice back. Returns the channel it was using, or
+// MPE_NO_VOICE if it didn't have one (i.e. it was stolen).
+uint8_t mpe_release(struct mpe_allocator*, uint8_t);
+
+// The channel a note is playing on, or MPE_NO_VOICE.
+static inline uint8_t mpe_channel_for_note(const struct mpe_allocator *allocator, uint8_t note) {
+  uint8_t voice = allocator->voice_for_note[note & 0x7F];
+  return voice == MPE_NO_VOICE ? MPE_NO_VOICE : allocator->channel_for_voice[voice];
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _MPE_H_ */
@@ -0,0 +1,75 @@
+#include "outbound_queue.h"
+
+static void append(struct outbound_queue *queue, const uint8_t *message, uint32_t length) {
+  for (uint32_t a = 0; a < length; a++) {
+    queue->buffer[(queue->head + a) & (OUTBOUND_QUEUE_SIZE - 1)] = message[a];
+  }
+
+  queue->head += length;
+
+  uint32_t depth = outbound_queue_depth(queue);
+  if (depth > queue->high_watermark) {
+    queue->high_watermark = depth;
+  }
+}
+
+uint32_t outbound_queue_write(struct outbound_queue *queue, outbound_write_fn write, uint8_t idx, uint8_t cable, const uint8_t *message, uint32_t length) {
+  if (length > OUTBOUND_QUEUE_SIZE) {
+    queue->overflows++;
+    return 0;
+  }
+
+  // Anything already waiting has to go first.
+  outbound_queue_flush(queue, write, idx, cable);
+
+  if (outbound_queue_depth(queue) == 0) {
+    uint32_t written = write(idx, cable, message, length);
+
+    if (written == length) {
+      return length;
+    }
+
+    // The rest always fits, as the queue is empty.
+    queue->stalls++;
+    append(queue, message + written, length - written);
+    return length;
+  }
+
+  if (length > OUTBOUND_QUEUE_SIZE - outbound_queue_depth(queue)) {
+    queue->overflows++;
+    return 0;
+  }
+
+  append(queue, message, length);
+  return length;
+}
+
+void outbound_queue_flush(struct outbound_queue *queue, outbound_write_fn write, uint8_t idx, uint8_t cable) {
+  while (outbound_queue_depth(queue)) {
+    // Copy a chunk out, so that a message that wraps around the end of the
+    // buffer is still written in one piece.
+    uint8_t chunk[OUTBOUND_FLUSH_CHUNK];
+    uint32_t length = outbound_queue_depth(queue);
+    if (length > sizeof(chunk)) {
+      length = sizeof(chunk);
+    }
+
+    for (uint32_t a = 0; a < length; a++) {
+      chunk[a] = queue->buffer[(queue->tail + a) & (OUTBOUND_QUEUE_SIZE - 1)];
+    }
+
+    // A chunk may end part of the way through a message, in which case only
+    // the messages before it are taken, and we carry on from there.
+    uint32_t written = write(idx, cable, chunk, length);
+    queue->tail += written;
+
+    if (written == 0) {
+      queue->stalls++;
+      return;
+    }
+  }
+}
+
+void outbound_queue_clear(struct outbound_queue *queue) {
+  queue->tail = queue->head;
+}
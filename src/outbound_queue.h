@@ -0,0 +1,60 @@
+#ifndef _OUTBOUND_QUEUE_H_
+#define _OUTBOUND_QUEUE_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Messages for a single Launchpad that TinyUSB couldn't take yet. Whatever
+// doesn't fit in the TX FIFO is kept here and sent on a later pass of the main
+// loop, starting from wherever the last write stopped, so that a short write
+// never leaves half a message (or a missing pad) behind.
+
+// Enough for two full frames from the largest encoder (see
+// paint_frame_sysex with the MK3 profile). Must be a power of two.
+#define OUTBOUND_QUEUE_SIZE 512
+
+// How much we hand to TinyUSB at a time when emptying the queue.
+#define OUTBOUND_FLUSH_CHUNK 64
+
+struct outbound_queue {
+    uint8_t buffer[OUTBOUND_QUEUE_SIZE];
+
+    // Free-running, i.e. the number of bytes in the queue is head - tail.
+    uint32_t head;
+    uint32_t tail;
+
+    uint32_t high_watermark;
+
+    // Writes that TinyUSB only took some (or none) of.
+    uint32_t stalls;
+
+    // Messages we had to turn away because the queue was full.
+    uint32_t overflows;
+};
+
+// Writes up to the given number of bytes, and returns how many were taken.
+typedef uint32_t (*outbound_write_fn)(uint8_t, uint8_t, const uint8_t*, uint32_t);
+
+// Write a complete message (of at most OUTBOUND_QUEUE_SIZE bytes), queueing
+// whatever can't be written straight away. Returns the length of the
+// message, or zero if it was turned away, in which case nothing was written.
+uint32_t outbound_queue_write(struct outbound_queue*, outbound_write_fn, uint8_t, uint8_t, const uint8_t*, uint32_t);
+
+// Send as much of the queue as TinyUSB will take.
+void outbound_queue_flush(struct outbound_queue*, outbound_write_fn, uint8_t, uint8_t);
+
+void outbound_queue_clear(struct outbound_queue*);
+
+static inline uint32_t outbound_queue_depth(const struct outbound_queue *queue) {
+  return queue->head - queue->tail;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _OUTBOUND_QUEUE_H_ */
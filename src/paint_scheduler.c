@@ -0,0 +1,103 @@
+#include <string.h>
+#include "boot_timeline.h"
+#include "paint_scheduler.h"
+#include "tusb.h"
+
+void paint_scheduler_init(struct paint_scheduler *scheduler, uint32_t frame_interval_us) {
+  memset(scheduler, 0, sizeof(*scheduler));
+
+  scheduler->frame_interval_us = frame_interval_us;
+
+  // A full repaint of the MK1 takes 33 messages, so it gets every other frame.
+  scheduler->client_budgets[0].min_interval_us = 2 * frame_interval_us;
+}
+
+// Returns true if the budget allows a paint at `now_us`, and if so, starts the
+// next interval.
+static bool take_budget(struct paint_budget *budget, uint64_t now_us) {
+  if (now_us < budget->next_paint_us) {
+    budget->frames_skipped++;
+    return false;
+  }
+
+  budget->next_paint_us = now_us + budget->min_interval_us;
+  budget->frames_painted++;
+  return true;
+}
+
+void paint_scheduler_task(struct paint_scheduler *scheduler, struct board_state *board_state, uint64_t now_us) {
+  // We take over is_dirty here, so that if it's set again before the frame is
+  // painted, we know that more changes have been merged into it.
+  if (board_state->is_dirty) {
+    if (scheduler->frame_pending) {
+      scheduler->frames_merged++;
+    }
+
+    scheduler->frame_pending = true;
+    board_state->is_dirty = false;
+  }
+
+  if (!scheduler->frame_pending || now_us < scheduler->next_frame_us) {
+    return;
+  }
+
+  bool skipped = false;
+  bool unfinished = false;
+
+  for (int cable = 0; cable < 3; cable++) {
+    if (take_budget(&scheduler->client_budgets[cable], now_us)) {
+      paint_client_launchpad(board_state, cable);
+
+      // Frames are painted before the computer has set us up, but nobody's
+      // listening then.
+      if (!frame_needs_paint(&board_state->client.frame_by_cable[cable])) {
+        if (boot_timeline_read(BOOT_DEVICE_MOUNTED)) {
+          boot_timeline_mark(BOOT_CLIENT_PAINTED);
+        }
+      }
+      else {
+        unfinished = true;
+      }
+    }
+    else {
+      update_client_launchpad_frame(board_state, cable);
+      skipped = true;
+    }
+  }
+
+  for (int idx = 0; idx < MAX_HOST_LAUNCHPADS; idx++) {
+    if (board_state->host_by_idx[idx].launchpad_version == UNkNOWN || !tuh_midi_mounted(idx)) {
+      continue;
+    }
+
+    if (take_budget(&scheduler->host_budgets[idx], now_us)) {
+      paint_host_launchpad(board_state, idx);
+      if (!frame_needs_paint(&board_state->host_by_idx[idx].frame)) {
+        boot_timeline_mark(BOOT_HOST_PAINTED);
+      }
+      else {
+        unfinished = true;
+      }
+    }
+    else {
+      update_host_launchpad_frame(board_state, idx);
+      skipped = true;
+    }
+  }
+
+  // Every frame has seen these now, whether or not it was sent.
+  memset(board_state->repaint_notes, 0, sizeof(board_state->repaint_notes));
+
+  // Anything held back (or that didn't fit in its outbound queue) is still
+  // flagged in its frame, so we need to come back for it.
+  scheduler->frame_pending = skipped || unfinished;
+  scheduler->next_frame_us = now_us + scheduler->frame_interval_us;
+
+  scheduler->frames_painted++;
+  if (skipped) {
+    scheduler->frames_skipped++;
+  }
+  if (unfinished) {
+    scheduler->frames_retried++;
+  }
+}
@@ -0,0 +1,67 @@
+#ifndef _PAINT_SCHEDULER_H_
+#define _PAINT_SCHEDULER_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "launchpad.h"
+
+// Changes to the board are collected and painted at most once per frame, so
+// that a run of pad presses (or a burst of aftertouch) results in a single
+// repaint rather than one per message.
+
+// 8 ms, i.e. 125 LED frames a second.
+#define DEFAULT_FRAME_INTERVAL_US 8000
+
+// How often a single Launchpad may be painted. A Launchpad that isn't due yet
+// keeps its changes until a later frame.
+struct paint_budget {
+    // Zero means every frame.
+    uint32_t min_interval_us;
+    uint64_t next_paint_us;
+
+    uint32_t frames_painted;
+
+    // Frames where this Launchpad had to wait for its budget.
+    uint32_t frames_skipped;
+};
+
+struct paint_scheduler {
+    uint32_t frame_interval_us;
+    uint64_t next_frame_us;
+
+    // Whether there are changes that haven't been painted yet.
+    bool frame_pending;
+
+    struct paint_budget client_budgets[3];
+    struct paint_budget host_budgets[MAX_HOST_LAUNCHPADS];
+
+    uint32_t frames_painted;
+
+    // Passes of the main loop whose changes were folded into a frame that was
+    // already waiting to be painted.
+    uint32_t frames_merged;
+
+    // Frames where at least one Launchpad was held back by its budget.
+    uint32_t frames_skipped;
+
+    // Frames where at least one Launchpad couldn't take everything (see
+    // outbound_queue.h), and so has to be painted again.
+    uint32_t frames_retried;
+};
+
+void paint_scheduler_init(struct paint_scheduler*, uint32_t);
+
+// Paint whatever has changed, if a frame is due at `now_us` (a reading of the
+// microsecond timer).
+void paint_scheduler_task(struct paint_scheduler*, struct board_state*, uint64_t);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _PAINT_SCHEDULER_H_ */
@@ -5,7 +5,11 @@
 #include <string.h>
 
 #include "hardware/clocks.h"
+#include "hardware/flash.h"
+#include "hardware/sync.h"
+#include "hardware/timer.h"
 #include "pico/stdlib.h"
+#include "pico/flash.h"
 #include "pico/multicore.h"
 #include "pico/bootrom.h"
 
@@ -43,7 +47,10 @@
 
 #include "midi_device_multistream.h"
 
+#include "boot_timeline.h"
 #include "launchpad.h"
+#include "settings.h"
+#include "tonnetz.h"
 
 static struct board_state board_state = {
       // Fairly sure this is implied.
@@ -56,25 +63,99 @@ static struct board_state board_state = {
         .offset_by_cable = { 45, 45, 45 }
       },
 
-      .host = {
-        .offset = 45,
-        .launchpad_version = MK3
+      // Slots are filled in as Launchpads are mounted.
+      .host_by_idx = {
+        { .offset = 45 }, { .offset = 45 }, { .offset = 45 }, { .offset = 45 }
       }
 };
 
+// Written by core1 (the USB host), read by core0.
+static struct host_event_queue host_events;
+
+static struct paint_scheduler paint_scheduler;
+
 // End state variables
 
-void midi_client_task(void);
+// Used for the latency histograms, see latency.h.
+uint32_t latency_now_us(void) {
+  return time_us_32();
+}
+
+// The settings log (see settings.h) is in the last few sectors of flash.
+#define SETTINGS_FLASH_OFFSET (PICO_FLASH_SIZE_BYTES - SETTINGS_STORE_SIZE)
+
+// How long to wait for core1 to get out of the way before giving up on a
+// save. This doesn't limit how long core1 then stays parked, which is however
+// long the page takes to program (see settings.h).
+#define SETTINGS_FLASH_TIMEOUT_MS 10
+
+const uint8_t *settings_flash_contents(void) {
+  return (const uint8_t *) (XIP_BASE + SETTINGS_FLASH_OFFSET);
+}
+
+struct settings_page_write {
+  uint32_t offset;
+  const uint8_t *page;
+};
+
+static void program_settings_page(void *context) {
+  const struct settings_page_write *write = context;
+  flash_range_program(SETTINGS_FLASH_OFFSET + write->offset, write->page, FLASH_PAGE_SIZE);
+}
+
+// Nothing can run from flash while it's being programmed, so core1 is parked
+// in RAM (see flash_safe_execute_core_init in core1_main) for the length of
+// a single page.
+bool settings_flash_program(uint32_t offset, const uint8_t *page) {
+  struct settings_page_write write = { offset, page };
+  return flash_safe_execute(program_settings_page, &write, SETTINGS_FLASH_TIMEOUT_MS) == PICO_OK;
+}
+
+// This is only called at boot, before core1 (or the device stack) is
+// started, so there's nothing else to stop.
+bool settings_flash_erase(uint32_t offset) {
+  uint32_t interrupts = save_and_disable_interrupts();
+  flash_range_erase(SETTINGS_FLASH_OFFSET + offset, FLASH_SECTOR_SIZE);
+  restore_interrupts(interrupts);
+  return true;
+}
+
+// The arpeggiator's alarm (see arpeggiator.h). It's claimed (and its
+// interrupt set up) on core0 in main, so that it fires on core0 along with
+// everything else that touches the board state.
+static int arpeggiator_alarm_num = -1;
+
+static void on_arpeggiator_alarm(__attribute__((unused)) uint alarm_num) {
+  arpeggiator_alarm_fired(time_us_32());
+}
+
+bool arpeggiator_alarm_set(uint32_t target_us) {
+  // The arpeggiator works with the lower 32 bits, which wrap every 71
+  // minutes, so the target is taken as being within 35 minutes of now.
+  uint64_t now_us = time_us_64();
+  uint64_t target = now_us + (int32_t) (target_us - (uint32_t) now_us);
+
+  // This returns true if the target has already gone.
+  return !hardware_alarm_set_target(arpeggiator_alarm_num, from_us_since_boot(target));
+}
 
-void sync_playing_notes(void);
+void arpeggiator_alarm_cancel(void) {
+  if (arpeggiator_alarm_num >= 0) {
+    hardware_alarm_cancel(arpeggiator_alarm_num);
+  }
+}
 
 void core1_main() {
-  sleep_ms(10);
+  // Let core0 pause us while it saves the settings.
+  flash_safe_execute_core_init();
 
+  // The host stack starts straight away, while the computer is still
+  // enumerating the device side (see main).
   pio_usb_configuration_t pio_cfg = PIO_USB_CONFIG;
   tuh_configure(1, TUH_CFGID_RPI_PIO_USB_CONFIGURATION, &pio_cfg);
 
   tuh_init(BOARD_TUH_RHPORT);
+  boot_timeline_mark(BOOT_HOST_STARTED);
 
   while (true) {
     tuh_task();
@@ -82,6 +163,8 @@ void core1_main() {
 }
 
 int main() {
+  boot_timeline_mark(BOOT_MAIN);
+
   // TODO: Make this depend on the board type and make the port configurable
  
   // Enable USB power for client devices, nicked from OGX MINI:
@@ -96,79 +179,46 @@ int main() {
   // the sysclock should be multiple of 12MHz.
   set_sys_clock_khz(120000, true);
 
-  // Give the client side a brief chance to start up.
-  sleep_ms(10);
+  paint_scheduler_init(&paint_scheduler, DEFAULT_FRAME_INTERVAL_US);
 
-  multicore_reset_core1();
-  multicore_launch_core1(core1_main);
-
-  // Start the device stack on the native USB port.
-  tud_init(0);
+  arpeggiator_alarm_num = hardware_alarm_claim_unused(true);
+  hardware_alarm_set_callback(arpeggiator_alarm_num, on_arpeggiator_alarm);
 
-  while (true)
-  {
-    tud_task(); // tinyusb device task
+  velocity_curves_init(&board_state.velocity_curves);
+  layout_init(&board_state.layout);
+  aftertouch_init(&board_state.aftertouch);
+  mpe_init(&board_state.mpe);
+  chords_init(&board_state.chords);
+  sustain_init(&board_state.sustain);
+  arpeggiator_init(&board_state.arpeggiator);
 
-    midi_client_task();
+  // Any erasing has to happen before core1 starts the USB host, see
+  // settings.h.
+  settings_load(&board_state);
+  boot_timeline_mark(BOOT_STATE_READY);
 
-    if (board_state.is_dirty) {
-      paint_client_launchpads(&board_state);
+  settings_prepare();
+  boot_timeline_mark(BOOT_SETTINGS_PREPARED);
 
-      if (tuh_midi_mounted(board_state.host.client_idx)) {
-        paint_host_launchpad(&board_state);
-      }
+  // Start the device stack on the native USB port before anything else, as
+  // the computer takes the longest of anything to get round to us. Everything
+  // else (starting the host stack, and painting) happens while it's
+  // enumerating, rather than one after the other.
+  tud_init(0);
+  boot_timeline_mark(BOOT_DEVICE_STARTED);
 
-      board_state.is_dirty = false;
-    }
+  multicore_reset_core1();
+  multicore_launch_core1(core1_main);
 
-    sync_playing_notes();
-  }
-}
+  while (true)
+  {
+    tud_task(); // tinyusb device task
 
-void sync_playing_notes (void) {
-  for (int a = 0; a < 128; a++) {
-    uint32_t bytes_written = 0;
-
-    uint8_t held_velocity = board_state.held_note_velocities[a];
-    uint8_t playing_velocity = board_state.playing_note_velocities[a];
-
-    if (playing_velocity && !held_velocity) {
-      uint8_t note_off_message[3] = {
-          MIDI_CIN_NOTE_OFF << 4, a, held_velocity
-      };
-
-      // This should use cable 3.
-      bytes_written = tud_midi_stream_write(3, note_off_message, sizeof note_off_message);
-    }
-
-    // Play a new note
-    else if (playing_velocity == 0 && held_velocity) {
-      uint8_t note_on_message[3] = {
-        MIDI_CIN_NOTE_ON << 4, a, held_velocity
-      };
-
-      // This should use cable 3.
-      bytes_written = tud_midi_stream_write(3, note_on_message, sizeof note_on_message);
-    }
-
-    // Time to indicate that the note's velocity has changed.
-    else if (playing_velocity != held_velocity) {
-      uint8_t poly_message[3] = {
-        MIDI_CIN_POLY_KEYPRESS << 4, a, held_velocity
-      };
-
-      // This should use cable 3.
-      bytes_written = tud_midi_stream_write(3, poly_message, sizeof poly_message);
-    }
-
-    // If we failed to send the message this time, leave it for the next pass.
-    if (bytes_written > 0) {
-      board_state.playing_note_velocities[a] = held_velocity;
-    }
+    // Frames are timed using the 64-bit hardware timer.
+    tonnetz_task(&board_state, &host_events, &paint_scheduler, time_us_64());
   }
 }
 
-
 //--------------------------------------------------------------------+
 // Device callbacks
 //--------------------------------------------------------------------+
@@ -177,7 +227,12 @@ void sync_playing_notes (void) {
 
 // Invoked when device is mounted
 void tud_mount_cb(void) {
-    initialise_client_launchpads();
+    // Plugging back in starts the clock again for the steps after this.
+    boot_timeline_restart(BOOT_DEVICE_MOUNTED);
+    boot_timeline_restart(BOOT_CLIENT_PAINTED);
+    boot_timeline_mark(BOOT_DEVICE_MOUNTED);
+
+    initialise_client_launchpads(&board_state);
 }
 
 // Invoked when device is unmounted
@@ -211,8 +266,6 @@ CFG_TUH_MEM_SECTION struct {
 
 // Invoked when device with MIDI interface is mounted.
 void tuh_midi_mount_cb(uint8_t idx, __attribute__((unused)) const tuh_midi_mount_cb_t* mount_cb_data) {
-  board_state.host.client_idx = idx;
-
   // printf("MIDI Interface Index = %u, Address = %u, Number of RX cables = %u, Number of TX cables = %u\r\n",
   // idx, mount_cb_data->daddr, mount_cb_data->rx_cable_count, mount_cb_data->tx_cable_count);
 
@@ -220,26 +273,57 @@ void tuh_midi_mount_cb(uint8_t idx, __attribute__((unused)) const tuh_midi_mount
 
   // Adapted from: https://github.com/hathach/tinyusb/blob/master/examples/host/device_info/src/main.c
 
-  // tusb_xfer_result_t tuh_descriptor_get_device_sync(uint8_t daddr, void* buffer, uint16_t len) {
-  tuh_descriptor_get_device_sync(mount_cb_data->daddr, &desc.device, 18);
+  // The stack already has the device descriptor from enumerating it, so we
+  // only ask the device again (which blocks core1 for a round trip) if it
+  // somehow doesn't.
+  uint16_t vid, pid;
+  if (!tuh_vid_pid_get(mount_cb_data->daddr, &vid, &pid)) {
+    // tusb_xfer_result_t tuh_descriptor_get_device_sync(uint8_t daddr, void* buffer, uint16_t len) {
+    tuh_descriptor_get_device_sync(mount_cb_data->daddr, &desc.device, 18);
+    vid = desc.device.idVendor;
+    pid = desc.device.idProduct;
+  }
+
+  // printf("Device %u: ID %04x:%04x SN ", daddr, vid, pid);
+  struct host_event mount_event = {
+    .type = HOST_EVENT_MOUNT,
+    .idx = idx,
+    .launchpad_version = get_launchpad_version(vid, pid)
+  };
 
-  // printf("Device %u: ID %04x:%04x SN ", daddr, desc.device.idVendor, desc.device.idProduct);
-  board_state.host.launchpad_version = get_launchpad_version(desc.device.idVendor, desc.device.idProduct);
+  // We can't afford to lose this one, and core0 is always draining the queue.
+  while (!host_event_queue_push(&host_events, &mount_event)) {
+    tight_loop_contents();
+  }
 }
 
 // Invoked when device with MIDI interface is un-mounted
-void tuh_midi_umount_cb(__attribute__((unused)) uint8_t idx) {
-  board_state.host.client_idx = 0;
+void tuh_midi_umount_cb(uint8_t idx) {
+  struct host_event unmount_event = {
+    .type = HOST_EVENT_UNMOUNT,
+    .idx = idx
+  };
+
+  while (!host_event_queue_push(&host_events, &unmount_event)) {
+    tight_loop_contents();
+  }
 }
 
+// This runs on core1, so we only queue the packets, core0 does the rest.
 void tuh_midi_rx_cb(uint8_t idx, uint32_t xferred_bytes) {
   if (xferred_bytes == 0) {
     return;
   }
 
-  uint8_t incoming_packet[4];
-  while (tuh_midi_packet_read(idx, incoming_packet)) {
-    process_incoming_host_packet(incoming_packet, &board_state);
+  struct host_event packet_event = {
+    .type = HOST_EVENT_PACKET,
+    .idx = idx,
+    .timestamp_us = latency_now_us()
+  };
+
+  while (tuh_midi_packet_read(idx, packet_event.packet)) {
+    // If the queue is full, the packet is dropped and counted in host_events.overflows.
+    host_event_queue_push(&host_events, &packet_event);
   }
 }
 
@@ -249,19 +333,3 @@ void tuh_midi_tx_cb(uint8_t idx, uint32_t xferred_bytes) {
 }
 
 // End TinyUSB Callbacks
-
-//--------------------------------------------------------------------+
-// MIDI Tasks
-//--------------------------------------------------------------------+
-void midi_client_task(void)
-{
-  while (tud_midi_available()) {
-    uint8_t incoming_packet[4];
-    tud_midi_packet_read(incoming_packet);
-
-    // Temporarily "loopback" internally.
-    // tud_midi_packet_write(incoming_packet);
-
-    process_incoming_client_packet(incoming_packet, &board_state);
-  }
-}
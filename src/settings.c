@@ -0,0 +1,469 @@
+#include <string.h>
+#include "settings.h"
+
+// Each record is:
+//
+// <magic, 2 bytes> <format> <payload length> <sequence, 4 bytes>
+// <payload> ... <CRC-32 of everything before it, 4 bytes>
+//
+// Erased flash reads as FFh, so a slot whose magic is still FFh FFh hasn't
+// been written. Numbers are little-endian.
+#define RECORD_MAGIC_0 0x54
+#define RECORD_MAGIC_1 0x4C
+#define RECORD_FORMAT SETTINGS_PAYLOAD_FORMAT
+
+#define RECORD_HEADER_SIZE 8
+#define RECORD_CRC_OFFSET (SETTINGS_RECORD_SIZE - 4)
+#define PAYLOAD_MAX_SIZE SETTINGS_PAYLOAD_MAX_SIZE
+
+#define SLOT_COUNT (SETTINGS_SECTORS * SETTINGS_RECORDS_PER_SECTOR)
+#define NO_SLOT 0xFFFFFFFF
+
+static struct settings_stats stats;
+
+static bool loaded = false;
+
+// Where the next record goes, and its sequence number.
+static uint32_t write_slot = 0;
+static uint32_t next_sequence = 1;
+
+// Nothing useful was found, so everything gets erased (see settings_prepare).
+static bool needs_full_erase = false;
+
+// Sectors we know to be erased, one bit each. Nothing is written to the
+// start of a sector unless it's in here.
+static uint32_t blank_sectors = 0;
+
+// Whether we've run out of erased sectors until the next boot.
+static bool out_of_room = false;
+
+// What's in the newest record, and what the settings were when we last
+// looked (and since when).
+static uint8_t saved_payload[PAYLOAD_MAX_SIZE];
+static uint8_t candidate_payload[PAYLOAD_MAX_SIZE];
+static uint64_t candidate_since_us = 0;
+static uint64_t last_check_us = 0;
+
+// See settings_save_now.
+static bool save_requested = false;
+
+// CRC-32 (as used by zlib), half a byte at a time so that the table stays
+// small.
+static const uint32_t crc_table[16] = {
+  0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+  0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+};
+
+static uint32_t crc32(const uint8_t *data, uint32_t length) {
+  uint32_t crc = 0xFFFFFFFF;
+
+  for (uint32_t a = 0; a < length; a++) {
+    crc = (crc >> 4) ^ crc_table[(crc ^ data[a]) & 0x0F];
+    crc = (crc >> 4) ^ crc_table[(crc ^ (data[a] >> 4)) & 0x0F];
+  }
+
+  return ~crc;
+}
+
+static uint32_t get_u32(const uint8_t *data) {
+  return data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t) data[3] << 24);
+}
+
+static void put_u32(uint8_t *data, uint32_t value) {
+  data[0] = value;
+  data[1] = value >> 8;
+  data[2] = value >> 16;
+  data[3] = value >> 24;
+}
+
+static const uint8_t *slot_contents(uint32_t slot) {
+  return settings_flash_contents() + (slot * SETTINGS_RECORD_SIZE);
+}
+
+static bool slot_is_empty(uint32_t slot) {
+  const uint8_t *record = slot_contents(slot);
+  return record[0] == 0xFF && record[1] == 0xFF;
+}
+
+static bool slot_has_magic(uint32_t slot) {
+  const uint8_t *record = slot_contents(slot);
+  return record[0] == RECORD_MAGIC_0 && record[1] == RECORD_MAGIC_1;
+}
+
+static bool slot_is_valid(uint32_t slot) {
+  const uint8_t *record = slot_contents(slot);
+
+  return slot_has_magic(slot) && record[2] == RECORD_FORMAT && record[3] <= PAYLOAD_MAX_SIZE &&
+    crc32(record, RECORD_CRC_OFFSET) == get_u32(record + RECORD_CRC_OFFSET);
+}
+
+// Slots are written in order, so the used ones are at the start of each
+// sector, and the first empty one can be found with a binary search.
+static uint32_t used_slots_in_sector(uint32_t sector) {
+  uint32_t first = sector * SETTINGS_RECORDS_PER_SECTOR;
+  uint32_t low = 0;
+  uint32_t high = SETTINGS_RECORDS_PER_SECTOR;
+
+  while (low < high) {
+    uint32_t middle = (low + high) / 2;
+
+    if (slot_is_empty(first + middle)) {
+      high = middle;
+    }
+    else {
+      low = middle + 1;
+    }
+  }
+
+  return low;
+}
+
+static bool sector_is_blank(uint32_t sector) {
+  const uint8_t *contents = settings_flash_contents() + (sector * SETTINGS_SECTOR_SIZE);
+
+  for (uint32_t a = 0; a < SETTINGS_SECTOR_SIZE; a++) {
+    if (contents[a] != 0xFF) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+// Everything we keep. The order only ever changes along with RECORD_FORMAT.
+uint8_t settings_encode(const struct board_state *board_state, uint8_t *payload) {
+  uint8_t *position = payload;
+
+  for (int cable = 0; cable < 3; cable++) {
+    *position++ = board_state->client.offset_by_cable[cable];
+  }
+
+  for (int idx = 0; idx < MAX_HOST_LAUNCHPADS; idx++) {
+    *position++ = board_state->host_by_idx[idx].offset;
+  }
+
+  *position++ = board_state->transpose_mode;
+
+  *position++ = board_state->layout.selected;
+  *position++ = board_state->layout.custom_column_interval;
+  *position++ = board_state->layout.custom_row_interval;
+
+  const struct velocity_curves *curves = &board_state->velocity_curves;
+  for (int family = 0; family < VELOCITY_CURVE_FAMILIES; family++) {
+    *position++ = curves->curve_by_family[family];
+  }
+  *position++ = curves->fixed_velocity;
+  *position++ = curves->custom_point_count;
+  memcpy(position, curves->custom_points, sizeof(curves->custom_points));
+  position += sizeof(curves->custom_points);
+
+  put_u32(position, board_state->aftertouch.interval_us);
+  position += 4;
+  *position++ = board_state->aftertouch.deadband;
+
+  *position++ = board_state->mpe.requested.mode;
+  *position++ = board_state->mpe.requested.zone;
+  *position++ = board_state->mpe.requested.member_count;
+
+  *position++ = board_state->chords.output;
+  *position++ = board_state->chords.cc_channel;
+
+  *position++ = board_state->sustain.mode;
+
+  const struct arp_config *arp_config = &board_state->arpeggiator.requested;
+  *position++ = arp_config->mode;
+  *position++ = arp_config->rate;
+  *position++ = arp_config->rate >> 8;
+  *position++ = arp_config->gate;
+  *position++ = arp_config->octaves;
+
+  return position - payload;
+}
+
+// Everything goes back through the same functions as a sysex message would,
+// so that anything out of range is dealt with the same way.
+bool settings_apply(struct board_state *board_state, const uint8_t *payload, uint8_t length) {
+  uint8_t defaults[PAYLOAD_MAX_SIZE];
+  uint8_t expected_length = settings_encode(board_state, defaults);
+
+  if (length != expected_length) {
+    return false;
+  }
+
+  const uint8_t *position = payload;
+
+  for (int cable = 0; cable < 3; cable++) {
+    board_state->client.offset_by_cable[cable] = *position++ & 0x7F;
+  }
+
+  for (int idx = 0; idx < MAX_HOST_LAUNCHPADS; idx++) {
+    board_state->host_by_idx[idx].offset = *position++ & 0x7F;
+  }
+
+  board_state->transpose_mode = *position++ ? TRANSPOSE_RELEASES_NOTES : TRANSPOSE_KEEPS_NOTES;
+
+  uint8_t layout = *position++;
+  layout_set_custom(&board_state->layout, position[0], position[1]);
+  position += 2;
+  layout_select(&board_state->layout, layout);
+
+  struct velocity_curves *curves = &board_state->velocity_curves;
+  const uint8_t *curve_by_family = position;
+  position += VELOCITY_CURVE_FAMILIES;
+  velocity_curves_set_fixed(curves, *position++);
+  uint8_t point_count = *position++;
+  velocity_curves_set_custom(curves, position, point_count);
+  position += sizeof(curves->custom_points);
+  for (int family = 0; family < VELOCITY_CURVE_FAMILIES; family++) {
+    velocity_curves_select(curves, family, curve_by_family[family]);
+  }
+
+  uint32_t interval_us = get_u32(position);
+  position += 4;
+  aftertouch_configure(&board_state->aftertouch, interval_us, *position++);
+
+  struct mpe_config mpe_config = { position[0], position[1], position[2] };
+  position += 3;
+  if (mpe_config.mode == OUTPUT_MPE) {
+    mpe_configure(&board_state->mpe, &mpe_config);
+  }
+
+  if (position[0] <= CHORD_OUTPUT_CC) {
+    chords_configure(&board_state->chords, position[0], position[1]);
+  }
+  position += 2;
+
+  if (*position <= HOLD_MODE_LATCH) {
+    set_hold_mode(board_state, *position);
+  }
+  position++;
+
+  struct arp_config arp_config = { position[0], position[1] | (position[2] << 8), position[3], position[4] };
+  if (arp_config.mode < ARP_MODE_COUNT) {
+    arpeggiator_configure(&board_state->arpeggiator, &arp_config);
+  }
+
+  board_state->is_dirty = true;
+  return true;
+}
+
+// The slot before this one, going back round the log, or NO_SLOT once we're
+// back where we started.
+static uint32_t previous_used_slot(uint32_t slot, uint32_t head_sector) {
+  if (slot % SETTINGS_RECORDS_PER_SECTOR) {
+    return slot - 1;
+  }
+
+  uint32_t sector = ((slot / SETTINGS_RECORDS_PER_SECTOR) + SETTINGS_SECTORS - 1) % SETTINGS_SECTORS;
+  uint32_t used = used_slots_in_sector(sector);
+
+  if (sector == head_sector || used == 0) {
+    return NO_SLOT;
+  }
+
+  return (sector * SETTINGS_RECORDS_PER_SECTOR) + used - 1;
+}
+
+void settings_load(struct board_state *board_state) {
+  uint32_t newest_slot = NO_SLOT;
+  uint32_t newest_sequence = 0;
+  uint32_t head_sector = 0;
+  bool any_used = false;
+
+  // The newest record is the last one in one of the sectors. If the last one
+  // was only partly written, we look at the one before it.
+  for (uint32_t sector = 0; sector < SETTINGS_SECTORS; sector++) {
+    uint32_t used = used_slots_in_sector(sector);
+    any_used |= used > 0;
+
+    for (uint32_t a = used; a > 0; a--) {
+      uint32_t slot = (sector * SETTINGS_RECORDS_PER_SECTOR) + a - 1;
+      if (!slot_has_magic(slot)) {
+        continue;
+      }
+
+      uint32_t sequence = get_u32(slot_contents(slot) + 4);
+      if (newest_slot == NO_SLOT || sequence > newest_sequence) {
+        newest_slot = slot;
+        newest_sequence = sequence;
+        head_sector = sector;
+      }
+      break;
+    }
+  }
+
+  uint8_t payload_length = 0;
+  const uint8_t *payload = NULL;
+
+  for (uint32_t slot = newest_slot; slot != NO_SLOT; slot = previous_used_slot(slot, head_sector)) {
+    if (slot_is_valid(slot)) {
+      payload = slot_contents(slot) + RECORD_HEADER_SIZE;
+      payload_length = slot_contents(slot)[3];
+      stats.loaded_sequence = get_u32(slot_contents(slot) + 4);
+      break;
+    }
+
+    stats.bad_records++;
+  }
+
+  if (payload) {
+    settings_apply(board_state, payload, payload_length);
+  }
+
+  if (newest_slot == NO_SLOT) {
+    // Either a fresh log, or something else's data, which gets erased.
+    needs_full_erase = any_used;
+    write_slot = 0;
+  }
+  else {
+    uint32_t used = used_slots_in_sector(head_sector);
+    write_slot = ((head_sector * SETTINGS_RECORDS_PER_SECTOR) + used) % SLOT_COUNT;
+    next_sequence = newest_sequence + 1;
+
+    // The rest of the head sector (if there is any) is ours to use.
+    if (used < SETTINGS_RECORDS_PER_SECTOR) {
+      blank_sectors |= 1u << head_sector;
+    }
+  }
+
+  settings_encode(board_state, saved_payload);
+  memcpy(candidate_payload, saved_payload, sizeof(candidate_payload));
+  loaded = true;
+}
+
+static void erase_sector(uint32_t sector) {
+  if (!sector_is_blank(sector)) {
+    settings_flash_erase(sector * SETTINGS_SECTOR_SIZE);
+    stats.erases++;
+  }
+
+  blank_sectors |= 1u << sector;
+}
+
+void settings_prepare(void) {
+  if (needs_full_erase) {
+    for (uint32_t sector = 0; sector < SETTINGS_SECTORS; sector++) {
+      erase_sector(sector);
+    }
+
+    needs_full_erase = false;
+    return;
+  }
+
+  // Everything up to (but not including) the sector before the head, which
+  // keeps the oldest records in case the newer ones turn out to be bad.
+  uint32_t head_sector = (write_slot / SETTINGS_RECORDS_PER_SECTOR) % SETTINGS_SECTORS;
+  if (write_slot % SETTINGS_RECORDS_PER_SECTOR == 0) {
+    erase_sector(head_sector);
+  }
+
+  for (uint32_t a = 1; a < SETTINGS_SECTORS - 1; a++) {
+    erase_sector((head_sector + a) % SETTINGS_SECTORS);
+  }
+}
+
+static void save(const uint8_t *payload, uint8_t length) {
+
+  uint32_t sector = write_slot / SETTINGS_RECORDS_PER_SECTOR;
+  if (!(blank_sectors & (1u << sector))) {
+    out_of_room = true;
+    stats.out_of_room++;
+    return;
+  }
+
+  uint8_t record[SETTINGS_RECORD_SIZE];
+  memset(record, 0xFF, sizeof(record));
+  record[0] = RECORD_MAGIC_0;
+  record[1] = RECORD_MAGIC_1;
+  record[2] = RECORD_FORMAT;
+  record[3] = length;
+  put_u32(record + 4, next_sequence);
+  memcpy(record + RECORD_HEADER_SIZE, payload, length);
+  put_u32(record + RECORD_CRC_OFFSET, crc32(record, RECORD_CRC_OFFSET));
+
+  // The rest of the page is left erased, i.e. programming it changes
+  // nothing.
+  uint32_t record_offset = write_slot * SETTINGS_RECORD_SIZE;
+  uint32_t page_offset = record_offset - (record_offset % SETTINGS_PAGE_SIZE);
+
+  uint8_t page[SETTINGS_PAGE_SIZE];
+  memset(page, 0xFF, sizeof(page));
+  memcpy(page + (record_offset - page_offset), record, sizeof(record));
+
+  bool programmed = settings_flash_program(page_offset, page);
+
+  // Once a sector is full, it isn't erased any more.
+  uint32_t slot = write_slot;
+  write_slot = (write_slot + 1) % SLOT_COUNT;
+  if (write_slot % SETTINGS_RECORDS_PER_SECTOR == 0) {
+    blank_sectors &= ~(1u << sector);
+  }
+
+  if (!programmed || memcmp(slot_contents(slot), record, sizeof(record)) != 0) {
+    // Try again in the next slot, next time round.
+    stats.failed_saves++;
+    return;
+  }
+
+  next_sequence++;
+  memcpy(saved_payload, payload, length);
+  stats.saves++;
+}
+
+// Programming a page parks core1, and with it the host port (see
+// settings.h).
+static bool host_port_in_use(const struct board_state *board_state) {
+  for (int idx = 0; idx < MAX_HOST_LAUNCHPADS; idx++) {
+    if (board_state->host_by_idx[idx].launchpad_version != UNkNOWN) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+void settings_save_now(void) {
+  save_requested = true;
+}
+
+void settings_task(struct board_state *board_state, uint64_t now_us) {
+  if (!loaded || out_of_room) {
+    return;
+  }
+
+  if (!save_requested && now_us - last_check_us < SETTINGS_CHECK_INTERVAL_US) {
+    return;
+  }
+
+  last_check_us = now_us;
+
+  uint8_t payload[PAYLOAD_MAX_SIZE];
+  uint8_t length = settings_encode(board_state, payload);
+
+  // Someone asked, so they've decided a few missed frames on the host port
+  // are worth it.
+  if (save_requested) {
+    save_requested = false;
+    memcpy(candidate_payload, payload, length);
+    candidate_since_us = now_us;
+
+    if (memcmp(payload, saved_payload, length) != 0) {
+      save(payload, length);
+    }
+    return;
+  }
+
+  if (memcmp(payload, candidate_payload, length) != 0) {
+    memcpy(candidate_payload, payload, length);
+    candidate_since_us = now_us;
+    return;
+  }
+
+  if (memcmp(candidate_payload, saved_payload, length) != 0 && now_us - candidate_since_us >= SETTINGS_STABLE_US && !host_port_in_use(board_state)) {
+    save(candidate_payload, length);
+  }
+}
+
+const struct settings_stats *settings_stats(void) {
+  return &stats;
+}
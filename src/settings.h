@@ -0,0 +1,123 @@
+#ifndef _SETTINGS_H_
+#define _SETTINGS_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "launchpad.h"
+
+// Keeps the settings (offsets, layout, velocity curves and so on) across
+// power cycles, in a log of records at the end of flash.
+//
+// Records are only ever appended, working through the sectors in turn, so
+// that every sector wears at the same rate and a sector is only erased once
+// per trip round the log. The newest record with a good CRC wins. Finding it
+// takes a binary search per sector and a single CRC, so loading at boot
+// takes microseconds.
+//
+// Erasing a sector takes tens of milliseconds, which is long enough to upset
+// the USB host on core1, so it only ever happens at boot (see
+// settings_prepare), before either USB stack has started. While running, a
+// save programs a single page, and core1 is parked for as long as that takes,
+// however long core0 was prepared to wait for it to park. That's typically
+// 0.4 to 0.8 milliseconds, but flash datasheets allow up to 3 (we haven't
+// measured the worst case on a real board). The PIO USB host on core1 has to
+// start a frame every millisecond, and a device that sees no frames for 3
+// milliseconds suspends itself, so a save could cost a Launchpad on the host
+// port a few frames at best and a suspend at worst. Saves therefore wait
+// until nothing is mounted on the host port, unless one is asked for (see
+// settings_save_now), which is the only way a rig that always has a
+// Launchpad on the host port gets its settings saved.
+//
+// Settings are only saved once they've stopped changing for
+// SETTINGS_STABLE_US, and if the log runs out of erased sectors, saves wait
+// until the next boot.
+
+#define SETTINGS_SECTOR_SIZE 4096
+#define SETTINGS_SECTORS 4
+#define SETTINGS_STORE_SIZE (SETTINGS_SECTOR_SIZE * SETTINGS_SECTORS)
+
+// The smallest amount of flash that can be programmed at once.
+#define SETTINGS_PAGE_SIZE 256
+
+#define SETTINGS_RECORD_SIZE 128
+#define SETTINGS_RECORDS_PER_SECTOR (SETTINGS_SECTOR_SIZE / SETTINGS_RECORD_SIZE)
+
+// The settings themselves, as they're kept in each record. The format only
+// changes when what's in them does.
+#define SETTINGS_PAYLOAD_FORMAT 2
+#define SETTINGS_PAYLOAD_MAX_SIZE (SETTINGS_RECORD_SIZE - 12)
+
+// How often we look for changes, and how long they have to stay the same
+// before they're saved.
+#define SETTINGS_CHECK_INTERVAL_US 100000
+#define SETTINGS_STABLE_US 5000000
+
+struct settings_stats {
+    // Where the settings came from at boot, i.e. the record's sequence number
+    // (zero if nothing was loaded), and records skipped for a bad CRC.
+    uint32_t loaded_sequence;
+    uint32_t bad_records;
+
+    // Sectors erased at boot.
+    uint32_t erases;
+
+    uint32_t saves;
+
+    // Saves that didn't read back correctly (and were tried again in the
+    // next slot), and saves waiting for the next boot because there was no
+    // erased space left.
+    uint32_t failed_saves;
+    uint32_t out_of_room;
+};
+
+// Restore the settings from the newest good record, if there is one. Call
+// after everything in the board state has been initialised, so that anything
+// not in the record keeps its default.
+void settings_load(struct board_state*);
+
+// Erase the sectors the next saves will go in, if they aren't already. Only
+// call this before the USB stacks start (see above).
+void settings_prepare(void);
+
+// Called once per pass of the main loop. Does nothing until settings_load has
+// been called, and doesn't save anything while there's a Launchpad on the
+// host port unless it's been asked to (see above).
+void settings_task(struct board_state*, uint64_t);
+
+// Save any changes in the next settings_task, without waiting for them to
+// settle, and whatever is on the host port (see SYSEX_SAVE_SETTINGS).
+void settings_save_now(void);
+
+const struct settings_stats *settings_stats(void);
+
+// Write the current settings as a payload (of at most
+// SETTINGS_PAYLOAD_MAX_SIZE bytes), and return its length. A capture starts
+// with these (see capture.h), so that a replay starts from the same place.
+uint8_t settings_encode(const struct board_state*, uint8_t*);
+
+// Restore the settings from a payload. Returns false (and changes nothing)
+// if it isn't the length the current format expects.
+bool settings_apply(struct board_state*, const uint8_t*, uint8_t);
+
+// Provided by the platform (pico-launchpad-tonnetz.c, or platform_stub.c on
+// Linux). Offsets are from the start of the log.
+
+// The whole log, i.e. SETTINGS_STORE_SIZE bytes of memory-mapped flash.
+const uint8_t *settings_flash_contents(void);
+
+// Program a page (SETTINGS_PAGE_SIZE bytes, at a page boundary).
+bool settings_flash_program(uint32_t, const uint8_t*);
+
+// Erase a sector (at a sector boundary).
+bool settings_flash_erase(uint32_t);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _SETTINGS_H_ */
@@ -0,0 +1,316 @@
+#include <string.h>
+#include "stress.h"
+#include "capture.h"
+#include "client_packets.h"
+#include "device_profile.h"
+#include "latency.h"
+#include "tusb.h"
+
+// The pad numbers each family sends for its 8x8 grid of square pads.
+static uint8_t pad_note(enum LaunchpadVersion version, int row, int column) {
+  if (version == MK1) {
+    return (row * 16) + column;
+  }
+
+  return ((row + 1) * 10) + column + 1;
+}
+
+static void add_launchpad(struct stress_generator *generator, uint8_t source, uint8_t idx, enum LaunchpadVersion version) {
+  const struct device_profile *profile = profile_for_version(version);
+  if (!profile || generator->launchpad_count >= STRESS_MAX_LAUNCHPADS) {
+    return;
+  }
+
+  struct stress_launchpad *launchpad = &generator->launchpads[generator->launchpad_count++];
+  launchpad->source = source;
+  launchpad->idx = idx;
+  launchpad->cable = source == CAPTURE_HOST_PACKET ? profile->host_cable : profile->client_cable;
+  launchpad->held = 0;
+
+  for (int pad = 0; pad < STRESS_PADS; pad++) {
+    launchpad->pads[pad] = pad_note(version, pad / 8, pad % 8);
+  }
+}
+
+void stress_init(struct stress_generator *generator, const struct stress_config *config) {
+  memset(generator, 0, sizeof(*generator));
+  generator->config = *config;
+
+  for (enum LaunchpadVersion version = MK1; version <= MK3; version++) {
+    uint8_t cable = profile_for_version(version)->client_cable;
+    if (config->client_cables & (1 << cable)) {
+      add_launchpad(generator, CAPTURE_CLIENT_PACKET, cable, version);
+    }
+  }
+
+  for (int idx = 0; idx < MAX_HOST_LAUNCHPADS; idx++) {
+    if (config->host_versions[idx] != UNkNOWN) {
+      add_launchpad(generator, CAPTURE_HOST_PACKET, idx, config->host_versions[idx]);
+    }
+  }
+}
+
+static void emit_pad(struct stress_launchpad *launchpad, uint8_t cin, int pad, uint8_t value, uint32_t now_us, stress_emit_fn emit, void *context) {
+  uint8_t packet[4] = {
+    (launchpad->cable << 4) | cin, cin << 4, launchpad->pads[pad], value
+  };
+
+  // The Launchpads send a note on with no velocity when a pad is let go.
+  if (cin == MIDI_CIN_NOTE_ON) {
+    if (value) {
+      launchpad->held |= 1ull << pad;
+    }
+    else {
+      launchpad->held &= ~(1ull << pad);
+    }
+  }
+
+  emit(context, launchpad->source, launchpad->idx, packet, now_us);
+}
+
+static void emit_note(struct stress_generator *generator, uint8_t note, bool on, uint32_t now_us, stress_emit_fn emit, void *context) {
+  uint8_t cin = on ? MIDI_CIN_NOTE_ON : MIDI_CIN_NOTE_OFF;
+  uint8_t packet[4] = {
+    (3 << 4) | cin, cin << 4, note, on ? 100 : 0
+  };
+
+  if (on) {
+    generator->playing_notes[note >> 5] |= 1u << (note & 31);
+  }
+  else {
+    generator->playing_notes[note >> 5] &= ~(1u << (note & 31));
+  }
+
+  emit(context, CAPTURE_CLIENT_PACKET, 0, packet, now_us);
+}
+
+// Take the whole events that are due from `owed`, up to STRESS_MAX_BURST.
+static uint32_t take_due(struct stress_generator *generator, uint64_t *owed, uint32_t rate, uint32_t elapsed_us) {
+  *owed += (uint64_t) rate * elapsed_us;
+
+  uint64_t due = *owed / 1000000;
+  *owed %= 1000000;
+
+  if (due > STRESS_MAX_BURST) {
+    generator->stats.behind += due - STRESS_MAX_BURST;
+    due = STRESS_MAX_BURST;
+  }
+
+  return due;
+}
+
+// Events are spread evenly over the time since the last call, as they would
+// have been if they'd been arriving all along.
+static uint32_t spread(uint32_t last_us, uint32_t elapsed_us, uint32_t event, uint32_t due) {
+  return last_us + (uint32_t) (((uint64_t) elapsed_us * (event + 1)) / due);
+}
+
+uint32_t stress_generate(struct stress_generator *generator, uint32_t now_us, stress_emit_fn emit, void *context) {
+  uint32_t count = generator->launchpad_count;
+  uint32_t generated = 0;
+
+  if (!generator->started) {
+    generator->started = true;
+    generator->last_us = now_us;
+    return 0;
+  }
+
+  uint32_t last_us = generator->last_us;
+  uint32_t elapsed_us = now_us - last_us;
+  generator->last_us = now_us;
+
+  if (count) {
+    uint32_t pressure_due = take_due(generator, &generator->pressure_owed, generator->config.pressure_rate * count, elapsed_us);
+    for (uint32_t event = 0; event < pressure_due; event++) {
+      uint32_t position = generator->pressure_position++;
+      struct stress_launchpad *launchpad = &generator->launchpads[position % count];
+      int pad = (position / count) % STRESS_PADS;
+
+      // Every round over the pads moves each pad to a different pressure.
+      uint8_t value = 1 + ((((position / count) / STRESS_PADS) * 37) + (pad * 11)) % 127;
+
+      // The first round presses every pad, after that a pad that the pad
+      // presses let go of is pressed again, so that the load stays the same.
+      uint8_t cin = (launchpad->held & (1ull << pad)) ? MIDI_CIN_POLY_KEYPRESS : MIDI_CIN_NOTE_ON;
+      emit_pad(launchpad, cin, pad, value, spread(last_us, elapsed_us, event, pressure_due), emit, context);
+      generator->stats.pressure_events++;
+      generated++;
+    }
+
+    uint32_t pad_due = take_due(generator, &generator->pad_owed, generator->config.pad_rate * count, elapsed_us);
+    for (uint32_t event = 0; event < pad_due; event++) {
+      uint32_t position = generator->pad_position++;
+      struct stress_launchpad *launchpad = &generator->launchpads[position % count];
+      int pad = (position / count) % STRESS_PADS;
+
+      uint8_t velocity = (launchpad->held & (1ull << pad)) ? 0 : 1 + ((pad * 5) + (position * 17)) % 127;
+      emit_pad(launchpad, MIDI_CIN_NOTE_ON, pad, velocity, spread(last_us, elapsed_us, event, pad_due), emit, context);
+      generator->stats.pad_events++;
+      generated++;
+    }
+  }
+
+  // Alternate note ons and offs, working up through five octaves.
+  uint32_t note_due = take_due(generator, &generator->note_owed, generator->config.note_rate, elapsed_us);
+  for (uint32_t event = 0; event < note_due; event++) {
+    uint32_t position = generator->note_position++;
+    uint8_t note = 36 + ((position / 2) % 60);
+
+    emit_note(generator, note, (position & 1) == 0, spread(last_us, elapsed_us, event, note_due), emit, context);
+    generator->stats.note_events++;
+    generated++;
+  }
+
+  return generated;
+}
+
+void stress_release(struct stress_generator *generator, uint32_t now_us, stress_emit_fn emit, void *context) {
+  for (uint32_t a = 0; a < generator->launchpad_count; a++) {
+    struct stress_launchpad *launchpad = &generator->launchpads[a];
+
+    while (launchpad->held) {
+      int pad = __builtin_ctzll(launchpad->held);
+      emit_pad(launchpad, MIDI_CIN_NOTE_ON, pad, 0, now_us, emit, context);
+    }
+  }
+
+  for (int word = 0; word < 4; word++) {
+    while (generator->playing_notes[word]) {
+      int bit = __builtin_ctz(generator->playing_notes[word]);
+      emit_note(generator, (word << 5) + bit, false, now_us, emit, context);
+    }
+  }
+}
+
+// There's only one main loop, so only one self-test.
+static struct stress_generator self_test;
+static struct stress_self_test_report self_test_report;
+static uint32_t self_test_end_us = 0;
+static uint32_t self_test_last_pass_us = 0;
+
+// The counters as they were when the test started.
+static uint32_t client_events_before = 0;
+static uint32_t client_rejected_before = 0;
+static uint32_t outbound_overflows_before = 0;
+
+// The device has no queue between the generator and the decoder, so packets
+// are decoded as soon as they're generated.
+static void decode_now(void *context, uint8_t source, uint8_t idx, const uint8_t packet[4], uint32_t timestamp_us) {
+  struct board_state *board_state = context;
+
+  uint8_t incoming_packet[4];
+  memcpy(incoming_packet, packet, 4);
+
+  latency_mark_input(&board_state->latency, timestamp_us, latency_now_us());
+
+  if (source == CAPTURE_HOST_PACKET) {
+    process_incoming_host_packet(incoming_packet, board_state, idx);
+  }
+  else {
+    process_incoming_client_packet(incoming_packet, board_state);
+  }
+}
+
+static uint32_t outbound_overflows(const struct board_state *board_state) {
+  uint32_t overflows = 0;
+
+  for (int cable = 0; cable < 3; cable++) {
+    overflows += board_state->client.queue_by_cable[cable].overflows;
+  }
+
+  for (int idx = 0; idx < MAX_HOST_LAUNCHPADS; idx++) {
+    overflows += board_state->host_by_idx[idx].queue.overflows;
+  }
+
+  return overflows;
+}
+
+// The deepest any outbound queue has been, in bytes.
+static uint32_t outbound_high_watermark(const struct board_state *board_state) {
+  uint32_t high_watermark = 0;
+
+  for (int cable = 0; cable < 3; cable++) {
+    if (board_state->client.queue_by_cable[cable].high_watermark > high_watermark) {
+      high_watermark = board_state->client.queue_by_cable[cable].high_watermark;
+    }
+  }
+
+  for (int idx = 0; idx < MAX_HOST_LAUNCHPADS; idx++) {
+    if (board_state->host_by_idx[idx].queue.high_watermark > high_watermark) {
+      high_watermark = board_state->host_by_idx[idx].queue.high_watermark;
+    }
+  }
+
+  return high_watermark;
+}
+
+static void reset_outbound_high_watermarks(struct board_state *board_state) {
+  for (int cable = 0; cable < 3; cable++) {
+    struct outbound_queue *queue = &board_state->client.queue_by_cable[cable];
+    queue->high_watermark = outbound_queue_depth(queue);
+  }
+
+  for (int idx = 0; idx < MAX_HOST_LAUNCHPADS; idx++) {
+    struct outbound_queue *queue = &board_state->host_by_idx[idx].queue;
+    queue->high_watermark = outbound_queue_depth(queue);
+  }
+}
+
+void stress_self_test_start(struct board_state *board_state, const struct stress_config *config, uint32_t seconds, uint32_t now_us) {
+  if (self_test_report.running) {
+    stress_self_test_stop(board_state, now_us);
+  }
+
+  stress_init(&self_test, config);
+
+  memset(&self_test_report, 0, sizeof(self_test_report));
+  self_test_report.running = true;
+
+  self_test_end_us = now_us + (seconds * 1000000);
+  self_test_last_pass_us = now_us;
+
+  client_events_before = client_packets_stats()->events;
+  client_rejected_before = client_packets_stats()->rejected;
+  outbound_overflows_before = outbound_overflows(board_state);
+  reset_outbound_high_watermarks(board_state);
+}
+
+void stress_self_test_stop(struct board_state *board_state, uint32_t now_us) {
+  if (!self_test_report.running) {
+    return;
+  }
+
+  stress_release(&self_test, now_us, decode_now, board_state);
+  self_test_report.running = false;
+}
+
+void stress_self_test_task(struct board_state *board_state, uint32_t now_us) {
+  if (!self_test_report.running) {
+    return;
+  }
+
+  self_test_report.passes++;
+
+  uint32_t pass_us = now_us - self_test_last_pass_us;
+  if (pass_us > self_test_report.max_pass_us) {
+    self_test_report.max_pass_us = pass_us;
+  }
+  self_test_last_pass_us = now_us;
+
+  if ((int32_t) (now_us - self_test_end_us) >= 0) {
+    stress_self_test_stop(board_state, now_us);
+    return;
+  }
+
+  stress_generate(&self_test, now_us, decode_now, board_state);
+}
+
+void stress_self_test_read(const struct board_state *board_state, struct stress_self_test_report *report) {
+  *report = self_test_report;
+  report->stats = self_test.stats;
+
+  report->client_events = client_packets_stats()->events - client_events_before;
+  report->client_rejected = client_packets_stats()->rejected - client_rejected_before;
+  report->outbound_overflows = outbound_overflows(board_state) - outbound_overflows_before;
+  report->outbound_high_watermark = outbound_high_watermark(board_state);
+}
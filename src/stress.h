@@ -0,0 +1,151 @@
+#ifndef _STRESS_H_
+#define _STRESS_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "launchpad.h"
+
+// A synthetic load, for finding the most the board can take before notes are
+// dropped or held up. The worst case we know of is every pad under poly
+// aftertouch on several Launchpads at once, while the computer plays notes on
+// the "notes" cable as well.
+//
+// The same generator is used by the Linux build (host/stress.c), which feeds
+// it through the real input paths, i.e. the client port's FIFO and the host
+// event queue, and by the self-test mode on the device (see
+// SYSEX_STRESS_START in sysex_commands.h), which decodes it directly.
+
+// Three client cables, plus the host port.
+#define STRESS_MAX_LAUNCHPADS (3 + MAX_HOST_LAUNCHPADS)
+
+// The square pads, i.e. an 8x8 grid.
+#define STRESS_PADS 64
+
+// The most events produced by a single call to stress_generate. If we get
+// further behind than this (i.e. the loop has stalled), the rest are counted
+// as "behind" rather than sent in one huge burst.
+#define STRESS_MAX_BURST 1024
+
+struct stress_config {
+    // Events per second, per Launchpad, of poly aftertouch (going round all
+    // 64 pads, pressing any that aren't already down) and of pad presses and
+    // releases.
+    uint32_t pressure_rate;
+    uint32_t pad_rate;
+
+    // Note ons and offs per second on the "notes" cable, i.e. from the
+    // computer.
+    uint32_t note_rate;
+
+    // Which client Launchpads to pretend to be, one bit per cable.
+    uint8_t client_cables;
+
+    // The model at each index on the host port, or UNkNOWN to leave it alone.
+    uint8_t host_versions[MAX_HOST_LAUNCHPADS];
+};
+
+// Where generated packets go. The source is a CaptureSource (see capture.h),
+// i.e. CAPTURE_CLIENT_PACKET or CAPTURE_HOST_PACKET.
+typedef void (*stress_emit_fn)(void*, uint8_t source, uint8_t idx, const uint8_t packet[4], uint32_t timestamp_us);
+
+struct stress_stats {
+    uint32_t pressure_events;
+    uint32_t pad_events;
+    uint32_t note_events;
+
+    // Events that were due but weren't generated, see STRESS_MAX_BURST.
+    uint32_t behind;
+};
+
+struct stress_launchpad {
+    uint8_t source;
+    uint8_t idx;
+    uint8_t cable;
+    uint8_t pads[STRESS_PADS];
+
+    // The pads we're holding down, one bit per entry in `pads`.
+    uint64_t held;
+};
+
+struct stress_generator {
+    struct stress_config config;
+
+    struct stress_launchpad launchpads[STRESS_MAX_LAUNCHPADS];
+    uint8_t launchpad_count;
+
+    uint32_t last_us;
+    bool started;
+
+    // Events owed, in millionths of an event, so that low rates don't round
+    // down to nothing.
+    uint64_t pressure_owed;
+    uint64_t pad_owed;
+    uint64_t note_owed;
+
+    // Where each kind of event goes next.
+    uint32_t pressure_position;
+    uint32_t pad_position;
+    uint32_t note_position;
+
+    // The external notes we've sent note ons for, one bit per note.
+    uint32_t playing_notes[4];
+
+    struct stress_stats stats;
+};
+
+void stress_init(struct stress_generator*, const struct stress_config*);
+
+// Generate everything that's due between the last call and now (nothing, on
+// the first call). Returns the number of events generated.
+uint32_t stress_generate(struct stress_generator*, uint32_t, stress_emit_fn, void*);
+
+// Release every pad and note the generator is holding, so that nothing is
+// left sounding once it's stopped.
+void stress_release(struct stress_generator*, uint32_t, stress_emit_fn, void*);
+
+// The self-test mode, which runs the generator on the device as part of the
+// main loop, for the given number of seconds. The Launchpads are the three
+// client cables and whatever is connected to the host port when it starts.
+struct stress_self_test_report {
+    struct stress_stats stats;
+
+    // Passes of the main loop while the test was running, and the longest
+    // gap between two of them.
+    uint32_t passes;
+    uint32_t max_pass_us;
+
+    // Packets sent on the client port, and packets that didn't fit in the
+    // client batch, i.e. were held back for a later pass (see
+    // client_packets.h).
+    uint32_t client_events;
+    uint32_t client_rejected;
+
+    // Messages an outbound queue had to turn away, i.e. pads that weren't
+    // painted.
+    uint32_t outbound_overflows;
+
+    // The deepest any outbound queue got, in bytes.
+    uint32_t outbound_high_watermark;
+
+    bool running;
+};
+
+void stress_self_test_start(struct board_state*, const struct stress_config*, uint32_t, uint32_t);
+void stress_self_test_stop(struct board_state*, uint32_t);
+
+// Called once per pass of the main loop, does nothing unless a test is
+// running.
+void stress_self_test_task(struct board_state*, uint32_t);
+
+void stress_self_test_read(const struct board_state*, struct stress_self_test_report*);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _STRESS_H_ */
@@ -0,0 +1,98 @@
+#include <string.h>
+#include "sustain.h"
+
+void sustain_init(struct sustain *sustain) {
+  memset(sustain, 0, sizeof(*sustain));
+  sustain->mode = HOLD_MODE_NORMAL;
+}
+
+bool sustain_note_changed(struct sustain *sustain, uint8_t note, uint8_t velocity) {
+  note &= 0x7F;
+
+  int word = note >> 5;
+  uint32_t bit = 1u << (note & 31);
+  bool is_sounding = (sustain->held[word] | sustain->sustained[word] | sustain->latched[word]) & bit;
+
+  if (velocity) {
+    // Pressure on a note that's already down.
+    if (sustain->held[word] & bit) {
+      return true;
+    }
+
+    sustain->held[word] |= bit;
+    sustain->sustained[word] &= ~bit;
+
+    if (sustain->mode == HOLD_MODE_LATCH) {
+      sustain->latched[word] ^= bit;
+    }
+
+    // A note that's still sounding isn't started again, it just keeps going
+    // while it's held.
+    return !is_sounding;
+  }
+
+  if (!(sustain->held[word] & bit)) {
+    return !is_sounding;
+  }
+
+  sustain->held[word] &= ~bit;
+
+  if (sustain->latched[word] & bit) {
+    return false;
+  }
+
+  if (sustain->pedal_sources) {
+    sustain->sustained[word] |= bit;
+    return false;
+  }
+
+  return true;
+}
+
+void sustain_set_pedal(struct sustain *sustain, uint8_t source, bool is_down, uint32_t released[4]) {
+  memset(released, 0, sizeof(uint32_t) * 4);
+
+  if (is_down) {
+    sustain->pedal_sources |= source;
+    return;
+  }
+
+  sustain->pedal_sources &= ~source;
+  if (sustain->pedal_sources) {
+    return;
+  }
+
+  for (int word = 0; word < 4; word++) {
+    released[word] = sustain->sustained[word] & ~(sustain->held[word] | sustain->latched[word]);
+    sustain->sustained[word] = 0;
+  }
+}
+
+void sustain_set_mode(struct sustain *sustain, uint8_t mode, uint32_t released[4]) {
+  memset(released, 0, sizeof(uint32_t) * 4);
+
+  if (mode == sustain->mode) {
+    return;
+  }
+
+  sustain->mode = mode;
+
+  if (mode == HOLD_MODE_LATCH) {
+    return;
+  }
+
+  // Latched notes that aren't held stop, unless the pedal is down, in which
+  // case they're sustained like anything else that was let go.
+  for (int word = 0; word < 4; word++) {
+    uint32_t unlatched = sustain->latched[word] & ~sustain->held[word];
+
+    if (sustain->pedal_sources) {
+      sustain->sustained[word] |= unlatched;
+    }
+    else {
+      released[word] = unlatched & ~sustain->sustained[word];
+    }
+
+    sustain->latched[word] = 0;
+  }
+}
@@ -0,0 +1,67 @@
+#ifndef _SUSTAIN_H_
+#define _SUSTAIN_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Keeps notes sounding after they're released, either while the sustain
+// pedal is down (a button on any Launchpad, or CC 64 on the "notes" cable),
+// or in latch mode, where each press of a pad turns its note on or off.
+//
+// Each note can be held (a pad or key is down), sustained (released while the
+// pedal was down) and/or latched, and it sounds as long as it's in any of the
+// three. All three are sets of 128 bits, so that releasing the pedal (or
+// leaving latch mode) works out which notes to stop a word at a time, and then
+// only looks at those notes.
+
+enum HoldMode {
+    // Notes stop when they're released, unless the pedal is down.
+    HOLD_MODE_NORMAL,
+
+    // The first press of a pad starts its note, and the next press stops it
+    // (once that pad is released).
+    HOLD_MODE_LATCH
+};
+
+// Everything that can hold the pedal down, one bit each, so that the pedal is
+// only released once all of them have let go.
+#define SUSTAIN_SOURCE_CC 0x01
+#define SUSTAIN_SOURCE_CLIENT(cable) (0x02 << (cable))
+#define SUSTAIN_SOURCE_HOST(idx) (0x10 << (idx))
+
+struct sustain {
+    uint32_t held[4];
+    uint32_t sustained[4];
+    uint32_t latched[4];
+
+    // Which sources are holding the pedal down.
+    uint8_t pedal_sources;
+
+    uint8_t mode;
+};
+
+void sustain_init(struct sustain*);
+
+// Called with every velocity change for a note, before it's passed on.
+// Returns false if the note's velocity should stay as it is, i.e. it's
+// been released but is still sounding, or it was already sounding and has
+// just been pressed again.
+bool sustain_note_changed(struct sustain*, uint8_t, uint8_t);
+
+// Press or release the pedal for a source. Any notes that should stop as a
+// result are set in the last argument (and nothing else is).
+void sustain_set_pedal(struct sustain*, uint8_t, bool, uint32_t[4]);
+
+// Change the HoldMode. As above, any notes that should stop are set in the
+// last argument.
+void sustain_set_mode(struct sustain*, uint8_t, uint32_t[4]);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _SUSTAIN_H_ */
@@ -0,0 +1,491 @@
+#include "sysex_commands.h"
+#include "boot_timeline.h"
+#include "capture.h"
+#include "client_packets.h"
+#include "latency.h"
+#include "settings.h"
+#include "stress.h"
+#include "velocity_curves.h"
+#include "tusb.h"
+
+// Five 7-bit bytes are enough for any 32-bit value.
+static uint8_t *put_septets(uint8_t *buffer, uint32_t value) {
+  for (int shift = 28; shift >= 0; shift -= 7) {
+    *buffer++ = (value >> shift) & 0x7F;
+  }
+
+  return buffer;
+}
+
+// Eight bytes are sent for every seven, i.e. the top bits of the next (up to)
+// seven bytes, followed by the bytes themselves without them.
+static uint8_t *put_packed(uint8_t *buffer, const uint8_t *data, uint32_t length) {
+  for (uint32_t group = 0; group < length; group += 7) {
+    uint8_t *top_bits = buffer++;
+    *top_bits = 0;
+
+    for (uint32_t a = 0; a < 7 && group + a < length; a++) {
+      *top_bits |= (data[group + a] >> 7) << a;
+      *buffer++ = data[group + a] & 0x7F;
+    }
+  }
+
+  return buffer;
+}
+
+// How many records go in each dump message.
+#define CAPTURE_DUMP_RECORDS 8
+
+static bool capture_dumping = false;
+static uint32_t capture_dump_position = 0;
+
+// Returns false if there wasn't room to send the next message yet.
+static bool send_capture_dump_message(void) {
+  uint8_t reply[3 + 5 + 1 + (((CAPTURE_DUMP_RECORDS * CAPTURE_RECORD_SIZE) * 8 + 6) / 7) + 1] = {
+    0xF0, SYSEX_MANUFACTURER_ID, SYSEX_CAPTURE_DUMP
+  };
+
+  // Wait until the whole message fits in this pass's batch.
+  if (CLIENT_PACKETS_SIZE - client_packets_depth() < (sizeof(reply) + 2) / 3) {
+    return false;
+  }
+
+  struct capture_record records[CAPTURE_DUMP_RECORDS];
+  uint32_t count = capture_read(capture_dump_position, records, CAPTURE_DUMP_RECORDS);
+
+  uint8_t encoded[CAPTURE_DUMP_RECORDS * CAPTURE_RECORD_SIZE];
+  for (uint32_t a = 0; a < count; a++) {
+    capture_record_encode(&records[a], encoded + (a * CAPTURE_RECORD_SIZE));
+  }
+
+  uint8_t *position = put_septets(reply + 3, capture_dump_position);
+  *position++ = count;
+
+  if (count) {
+    position = put_packed(position, encoded, count * CAPTURE_RECORD_SIZE);
+  }
+  else {
+    *position++ = capture_overflowed() ? 1 : 0;
+    capture_dumping = false;
+  }
+
+  *position++ = 0xF7;
+
+  client_packets_stream_write(3, reply, position - reply);
+
+  capture_dump_position += count;
+  return true;
+}
+
+// Queries whose reply didn't fit in this pass's batch, one bit per command.
+// They're answered (with whatever the numbers are by then) from
+// sysex_commands_task once there's room.
+static uint32_t deferred_queries = 0;
+
+// Returns false, and sends nothing, if the whole reply doesn't fit in this
+// pass's batch, as half a sysex message would never be finished.
+static bool send_reply(const uint8_t *reply, size_t length) {
+  if (CLIENT_PACKETS_SIZE - client_packets_depth() < (length + 2) / 3) {
+    return false;
+  }
+
+  client_packets_stream_write(3, reply, length);
+  return true;
+}
+
+static bool send_latency_report(struct board_state *board_state) {
+  uint8_t reply[3 + (LATENCY_STAGE_COUNT * 4 * 5) + 1] = {
+    0xF0, SYSEX_MANUFACTURER_ID, SYSEX_LATENCY_QUERY
+  };
+
+  uint8_t *position = reply + 3;
+  for (int stage = 0; stage < LATENCY_STAGE_COUNT; stage++) {
+    const struct latency_histogram *histogram = &board_state->latency.histograms[stage];
+
+    position = put_septets(position, histogram->count);
+    position = put_septets(position, latency_percentile(histogram, 50));
+    position = put_septets(position, latency_percentile(histogram, 99));
+    position = put_septets(position, histogram->max_us);
+  }
+
+  *position++ = 0xF7;
+
+  return send_reply(reply, position - reply);
+}
+
+static bool send_packet_stats(void) {
+  uint8_t reply[3 + (6 * 5) + 1] = {
+    0xF0, SYSEX_MANUFACTURER_ID, SYSEX_PACKET_STATS_QUERY
+  };
+
+  const struct client_packet_stats *stats = client_packets_stats();
+
+  uint8_t *position = reply + 3;
+  position = put_septets(position, stats->flushes);
+  position = put_septets(position, stats->writes);
+  position = put_septets(position, stats->events);
+  position = put_septets(position, stats->max_events_per_flush);
+  position = put_septets(position, stats->short_writes);
+  position = put_septets(position, stats->rejected);
+
+  *position++ = 0xF7;
+
+  return send_reply(reply, position - reply);
+}
+
+static bool send_stress_report(struct board_state *board_state) {
+  uint8_t reply[3 + (11 * 5) + 1] = {
+    0xF0, SYSEX_MANUFACTURER_ID, SYSEX_STRESS_QUERY
+  };
+
+  struct stress_self_test_report report;
+  stress_self_test_read(board_state, &report);
+
+  uint8_t *position = reply + 3;
+  position = put_septets(position, report.stats.pressure_events);
+  position = put_septets(position, report.stats.pad_events);
+  position = put_septets(position, report.stats.note_events);
+  position = put_septets(position, report.stats.behind);
+  position = put_septets(position, report.passes);
+  position = put_septets(position, report.max_pass_us);
+  position = put_septets(position, report.client_events);
+  position = put_septets(position, report.client_rejected);
+  position = put_septets(position, report.outbound_overflows);
+  position = put_septets(position, report.outbound_high_watermark);
+  position = put_septets(position, report.running);
+
+  *position++ = 0xF7;
+
+  return send_reply(reply, position - reply);
+}
+
+static bool send_boot_timeline(void) {
+  uint8_t reply[3 + (BOOT_EVENT_COUNT * 5) + 1] = {
+    0xF0, SYSEX_MANUFACTURER_ID, SYSEX_BOOT_TIMELINE_QUERY
+  };
+
+  uint8_t *position = reply + 3;
+  for (int event = 0; event < BOOT_EVENT_COUNT; event++) {
+    position = put_septets(position, boot_timeline_read(event));
+  }
+
+  *position++ = 0xF7;
+
+  return send_reply(reply, position - reply);
+}
+
+static bool send_arpeggiator_report(const struct arpeggiator *arpeggiator) {
+  uint8_t reply[3 + ((2 + (2 * 4)) * 5) + 1] = {
+    0xF0, SYSEX_MANUFACTURER_ID, SYSEX_ARPEGGIATOR_QUERY
+  };
+
+  uint8_t *position = reply + 3;
+  position = put_septets(position, arpeggiator->steps);
+  position = put_septets(position, arpeggiator->missed_steps);
+
+  // A reset the alarm hasn't got round to yet still counts.
+  static const struct latency_histogram empty_histogram;
+  const struct latency_histogram *alarm_lateness = arpeggiator->alarm_lateness_reset_pending ? &empty_histogram : &arpeggiator->alarm_lateness;
+
+  const struct latency_histogram *histograms[2] = { alarm_lateness, &arpeggiator->note_lateness };
+  for (int a = 0; a < 2; a++) {
+    position = put_septets(position, histograms[a]->count);
+    position = put_septets(position, latency_percentile(histograms[a], 50));
+    position = put_septets(position, latency_percentile(histograms[a], 99));
+    position = put_septets(position, histograms[a]->max_us);
+  }
+
+  *position++ = 0xF7;
+
+  return send_reply(reply, position - reply);
+}
+
+// Send the reply to a query, or leave it for sysex_commands_task if there's
+// no room.
+static void answer_query(struct board_state *board_state, uint8_t command) {
+  bool is_sent = true;
+
+  switch (command) {
+    case SYSEX_LATENCY_QUERY:
+      is_sent = send_latency_report(board_state);
+      break;
+    case SYSEX_PACKET_STATS_QUERY:
+      is_sent = send_packet_stats();
+      break;
+    case SYSEX_STRESS_QUERY:
+      is_sent = send_stress_report(board_state);
+      break;
+    case SYSEX_BOOT_TIMELINE_QUERY:
+      is_sent = send_boot_timeline();
+      break;
+    case SYSEX_ARPEGGIATOR_QUERY:
+      is_sent = send_arpeggiator_report(&board_state->arpeggiator);
+      break;
+    default:
+      break;
+  }
+
+  if (is_sent) {
+    deferred_queries &= ~(1u << command);
+  }
+  else {
+    deferred_queries |= 1u << command;
+  }
+}
+
+void sysex_commands_task(struct board_state *board_state) {
+  uint32_t queries = deferred_queries;
+
+  while (queries) {
+    uint8_t command = __builtin_ctz(queries);
+    queries &= queries - 1;
+
+    answer_query(board_state, command);
+  }
+
+  if (capture_dumping) {
+    send_capture_dump_message();
+  }
+}
+
+// Three 7-bit bytes, most significant first.
+static uint32_t get_rate(const uint8_t *data) {
+  return (data[0] << 14) | (data[1] << 7) | data[2];
+}
+
+static void start_stress_test(struct board_state *board_state, const uint8_t *message, uint8_t length) {
+  // F0h 7Dh 0Ah <seconds> <pressure rate> <pad rate> <note rate> F7h
+  if (length < 14) {
+    return;
+  }
+
+  uint8_t seconds = message[3];
+  if (seconds == 0) {
+    stress_self_test_stop(board_state, latency_now_us());
+    return;
+  }
+
+  // Every client Launchpad, and whatever is on the host port right now.
+  struct stress_config config = {
+    .pressure_rate = get_rate(message + 4),
+    .pad_rate = get_rate(message + 7),
+    .note_rate = get_rate(message + 10),
+    .client_cables = 0x07
+  };
+
+  for (int idx = 0; idx < MAX_HOST_LAUNCHPADS; idx++) {
+    config.host_versions[idx] = board_state->host_by_idx[idx].launchpad_version;
+  }
+
+  stress_self_test_start(board_state, &config, seconds, latency_now_us());
+}
+
+// A capture starts with everything a replay needs to be in the same place we
+// are now, i.e. the settings, and whatever is already on the host port.
+static void start_capture(struct board_state *board_state) {
+  uint32_t now_us = latency_now_us();
+
+  capture_start();
+
+  uint8_t payload[SETTINGS_PAYLOAD_MAX_SIZE];
+  uint8_t length = settings_encode(board_state, payload);
+  capture_add_settings(now_us, SETTINGS_PAYLOAD_FORMAT, payload, length);
+
+  for (int idx = 0; idx < MAX_HOST_LAUNCHPADS; idx++) {
+    enum LaunchpadVersion version = board_state->host_by_idx[idx].launchpad_version;
+    if (version != UNkNOWN) {
+      uint8_t version_packet[4] = { version };
+      capture_add(now_us, CAPTURE_HOST_MOUNT, idx, version_packet);
+    }
+  }
+}
+
+static void select_velocity_curve(struct board_state *board_state, const uint8_t *message, uint8_t length) {
+  // F0h 7Dh 04h <family> <curve> F7h
+  if (length < 6) {
+    return;
+  }
+
+  uint8_t family = message[3];
+  enum VelocityCurve curve = message[4];
+
+  if (curve == VELOCITY_CURVE_FIXED && length >= 7) {
+    velocity_curves_set_fixed(&board_state->velocity_curves, message[5]);
+  }
+
+  if (family == 0) {
+    for (family = MK1; family < VELOCITY_CURVE_FAMILIES; family++) {
+      velocity_curves_select(&board_state->velocity_curves, family, curve);
+    }
+  }
+  else {
+    velocity_curves_select(&board_state->velocity_curves, family, curve);
+  }
+}
+
+static void select_layout(struct board_state *board_state, const uint8_t *message, uint8_t length) {
+  // F0h 7Dh 0Ch <layout> [<column interval> <row interval>] F7h
+  if (length < 5) {
+    return;
+  }
+
+  enum Layout layout = message[3];
+  if (layout >= LAYOUT_COUNT) {
+    return;
+  }
+
+  if (layout == LAYOUT_CUSTOM && length >= 7 && !layout_set_custom(&board_state->layout, message[4], message[5])) {
+    return;
+  }
+
+  layout_select(&board_state->layout, layout);
+  apply_layout_change(board_state);
+}
+
+static void configure_aftertouch(struct board_state *board_state, const uint8_t *message, uint8_t length) {
+  // F0h 7Dh 0Dh <updates per second> <deadband> F7h
+  if (length < 7) {
+    return;
+  }
+
+  uint32_t updates_per_second = (message[3] << 7) | message[4];
+  uint32_t interval_us = updates_per_second ? 1000000 / updates_per_second : 0;
+
+  aftertouch_configure(&board_state->aftertouch, interval_us, message[5]);
+}
+
+static void select_output_mode(struct board_state *board_state, const uint8_t *message, uint8_t length) {
+  // F0h 7Dh 0Eh <mode> [<zone> <member channels>] F7h
+  if (length < 5 || message[3] > OUTPUT_MPE) {
+    return;
+  }
+
+  struct mpe_config config = {
+    .mode = message[3],
+    .zone = MPE_LOWER_ZONE,
+    .member_count = MPE_MAX_MEMBERS
+  };
+
+  if (length >= 7) {
+    config.zone = message[4] ? MPE_UPPER_ZONE : MPE_LOWER_ZONE;
+    config.member_count = message[5];
+  }
+
+  mpe_configure(&board_state->mpe, &config);
+}
+
+static void configure_arpeggiator(struct board_state *board_state, const uint8_t *message, uint8_t length) {
+  // F0h 7Dh 12h <mode> [<rate> <gate> <octaves>] F7h
+  if (length < 5 || message[3] >= ARP_MODE_COUNT) {
+    return;
+  }
+
+  struct arp_config config = board_state->arpeggiator.requested;
+  config.mode = message[3];
+
+  if (length >= 9) {
+    config.rate = (message[4] << 7) | message[5];
+    config.gate = message[6];
+    config.octaves = message[7];
+  }
+
+  arpeggiator_configure(&board_state->arpeggiator, &config);
+}
+
+void process_sysex_command(struct board_state *board_state, const uint8_t *message, uint8_t length) {
+  // The shortest command is F0h 7Dh <command> F7h.
+  if (length < 4 || message[1] != SYSEX_MANUFACTURER_ID) {
+    return;
+  }
+
+  switch (message[2]) {
+    case SYSEX_LATENCY_QUERY:
+      answer_query(board_state, message[2]);
+      break;
+    case SYSEX_LATENCY_RESET:
+      latency_reset(&board_state->latency);
+      arpeggiator_reset_stats(&board_state->arpeggiator);
+      break;
+    case SYSEX_LOOPBACK:
+      if (length >= 5) {
+        board_state->latency.loopback = message[3] != 0;
+      }
+      break;
+    case SYSEX_VELOCITY_CURVE:
+      select_velocity_curve(board_state, message, length);
+      break;
+    case SYSEX_VELOCITY_CUSTOM:
+      // Everything between the command and the F7h.
+      velocity_curves_set_custom(&board_state->velocity_curves, message + 3, (length - 4) / 2);
+      break;
+    case SYSEX_PACKET_STATS_QUERY:
+      answer_query(board_state, message[2]);
+      break;
+    case SYSEX_CAPTURE:
+      if (length >= 5) {
+        if (message[3]) {
+          start_capture(board_state);
+        }
+        else {
+          capture_stop();
+        }
+      }
+      break;
+    case SYSEX_CAPTURE_DUMP:
+      // Stop recording, so that we don't record the dump being read.
+      capture_stop();
+      capture_dumping = true;
+      capture_dump_position = 0;
+      break;
+    case SYSEX_STRESS_START:
+      start_stress_test(board_state, message, length);
+      break;
+    case SYSEX_STRESS_QUERY:
+      answer_query(board_state, message[2]);
+      break;
+    case SYSEX_LAYOUT:
+      select_layout(board_state, message, length);
+      break;
+    case SYSEX_AFTERTOUCH:
+      configure_aftertouch(board_state, message, length);
+      break;
+    case SYSEX_MPE:
+      select_output_mode(board_state, message, length);
+      break;
+    case SYSEX_HOLD:
+      // F0h 7Dh 10h <mode> [<pedal>] F7h
+      if (length >= 5 && message[3] <= HOLD_MODE_LATCH) {
+        set_hold_mode(board_state, message[3]);
+
+        if (length >= 6) {
+          set_sustain_pedal(board_state, SUSTAIN_SOURCE_CC, message[4] != 0);
+        }
+      }
+      break;
+    case SYSEX_CHORDS:
+      // F0h 7Dh 0Fh <output> [<channel>] F7h
+      if (length >= 5 && message[3] <= CHORD_OUTPUT_CC) {
+        chords_configure(&board_state->chords, message[3], length >= 6 ? message[4] : 15);
+      }
+      break;
+    case SYSEX_BOOT_TIMELINE_QUERY:
+      answer_query(board_state, message[2]);
+      break;
+    case SYSEX_ARPEGGIATOR:
+      configure_arpeggiator(board_state, message, length);
+      break;
+    case SYSEX_ARPEGGIATOR_QUERY:
+      answer_query(board_state, message[2]);
+      break;
+    case SYSEX_TRANSPOSE_MODE:
+      if (length >= 5) {
+        board_state->transpose_mode = message[3] ? TRANSPOSE_RELEASES_NOTES : TRANSPOSE_KEEPS_NOTES;
+      }
+      break;
+    case SYSEX_SAVE_SETTINGS:
+      settings_save_now();
+      break;
+    default:
+      break;
+  }
+}
@@ -0,0 +1,175 @@
+#ifndef _SYSEX_COMMANDS_H_
+#define _SYSEX_COMMANDS_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#include "launchpad.h"
+
+// Sysex messages sent to the "notes" cable (cable 3) are used to query and
+// configure the device. They all look like:
+//
+// F0h 7Dh <command> <data>* F7h
+//
+// 7Dh is the ID set aside for non-commercial use. Replies are sent on the same
+// cable and start with the same three bytes.
+
+#define SYSEX_MANUFACTURER_ID 0x7D
+
+enum SysexCommand {
+    // Reply with the latency histograms (see latency.h). For each stage, the
+    // count, p50, p99 and max (in microseconds) are sent as five 7-bit bytes
+    // each, most significant first.
+    SYSEX_LATENCY_QUERY = 0x01,
+
+    // Clear the latency histograms (and the arpeggiator's timing, see
+    // SYSEX_ARPEGGIATOR_QUERY).
+    SYSEX_LATENCY_RESET = 0x02,
+
+    // Turn loopback mode on (01h) or off (00h).
+    SYSEX_LOOPBACK = 0x03,
+
+    // Select the velocity curve for a family:
+    //
+    // F0h 7Dh 04h <family> <curve> [<velocity>] F7h
+    //
+    // The family is 01h to 03h for the MK1 to MK3, or 00h for all of them. The
+    // curve is a VelocityCurve (see velocity_curves.h). For the fixed curve,
+    // the velocity to use can be sent as well.
+    SYSEX_VELOCITY_CURVE = 0x04,
+
+    // Set the custom velocity curve from up to 14 (input, output) pairs,
+    // sorted by input:
+    //
+    // F0h 7Dh 05h [<input> <output>]* F7h
+    SYSEX_VELOCITY_CUSTOM = 0x05,
+
+    // Select what happens to held notes when the offset changes, i.e. a
+    // TransposeMode (see launchpad.h):
+    //
+    // F0h 7Dh 06h <mode> F7h
+    SYSEX_TRANSPOSE_MODE = 0x06,
+
+    // Reply with the client packet batch counters (see client_packets.h), i.e.
+    // flushes, writes, events, the most events in a single flush, short writes
+    // and rejected packets, as five 7-bit bytes each.
+    SYSEX_PACKET_STATS_QUERY = 0x07,
+
+    // Start (01h) or stop (00h) recording incoming packets (see capture.h).
+    SYSEX_CAPTURE = 0x08,
+
+    // Read back the last recording. The records are sent a few at a time, one
+    // message per pass of the main loop:
+    //
+    // F0h 7Dh 09h <first record> <count> <records> F7h
+    //
+    // The index of the first record is five 7-bit bytes, as above. The records
+    // (10 bytes each, see capture.h) are packed seven bytes at a time, with a
+    // byte holding the top bit of each of the seven in front. The last message
+    // has a count of zero, followed by 01h if the recording ran out of room
+    // (or 00h if it didn't).
+    SYSEX_CAPTURE_DUMP = 0x09,
+
+    // Run the self-test (see stress.h) for a number of seconds, or stop it
+    // early if that's zero:
+    //
+    // F0h 7Dh 0Ah <seconds> <pressure rate> <pad rate> <note rate> F7h
+    //
+    // The rates are in events per second (per Launchpad, for the first two),
+    // as three 7-bit bytes each, most significant first.
+    SYSEX_STRESS_START = 0x0A,
+
+    // Reply with the results of the last self-test, i.e. the pressure, pad
+    // and note events generated, events it couldn't keep up with, passes of
+    // the main loop, the longest pass (in microseconds), client packets sent,
+    // client packets held back for a later pass, outbound queue overflows,
+    // the deepest outbound queue (in bytes) and whether it's still running,
+    // as five 7-bit bytes each.
+    SYSEX_STRESS_QUERY = 0x0B,
+
+    // Select the layout (see layout.h) for every Launchpad:
+    //
+    // F0h 7Dh 0Ch <layout> [<column interval> <row interval>] F7h
+    //
+    // The layout is a Layout. The intervals (in semitones) are only used with
+    // LAYOUT_CUSTOM, and replace the custom layout's intervals if they're
+    // sent.
+    SYSEX_LAYOUT = 0x0C,
+
+    // Configure the aftertouch coalescer (see aftertouch.h):
+    //
+    // F0h 7Dh 0Dh <updates per second> <deadband> F7h
+    //
+    // The updates per second (per note) are two 7-bit bytes, most significant
+    // first, where zero sends every change.
+    SYSEX_AFTERTOUCH = 0x0D,
+
+    // Select the output mode for notes (see mpe.h):
+    //
+    // F0h 7Dh 0Eh <mode> [<zone> <member channels>] F7h
+    //
+    // The mode is an OutputMode and the zone an MpeZone. Without a zone, MPE
+    // uses the lower zone with all fifteen member channels.
+    SYSEX_MPE = 0x0E,
+
+    // Select where the chord being held (see chords.h) is sent when it
+    // changes, i.e. a ChordOutput, and for CHORD_OUTPUT_CC, the channel (00h
+    // to 0Fh, 0Fh if it's not sent):
+    //
+    // F0h 7Dh 0Fh <output> [<channel>] F7h
+    //
+    // Chords are sent as F0h 7Dh 0Fh <quality> <root> <inversion> F7h, where
+    // the quality is a ChordQuality (00h for no chord) and the root is a
+    // pitch class, 00h for C to 0Bh for B.
+    SYSEX_CHORDS = 0x0F,
+
+    // Select the HoldMode (see sustain.h), and optionally press (01h) or
+    // release (00h) the sustain pedal, as if it were CC 64:
+    //
+    // F0h 7Dh 10h <mode> [<pedal>] F7h
+    SYSEX_HOLD = 0x10,
+
+    // Reply with when each step of starting up happened (see boot_timeline.h),
+    // in BootEvent order, as microseconds since the chip was reset (zero if
+    // it hasn't happened yet), as five 7-bit bytes each.
+    SYSEX_BOOT_TIMELINE_QUERY = 0x11,
+
+    // Configure the arpeggiator (see arpeggiator.h):
+    //
+    // F0h 7Dh 12h <mode> [<rate> <gate> <octaves>] F7h
+    //
+    // The mode is an ArpMode. The rate is in steps per minute, as two 7-bit
+    // bytes, most significant first, and the gate is a percentage of each
+    // step. Without them, the rate, gate and octaves stay as they were.
+    SYSEX_ARPEGGIATOR = 0x12,
+
+    // Reply with the arpeggiator's timing, i.e. the notes it's played and the
+    // steps it missed, then the count, 50th and 99th percentiles and maximum
+    // (in microseconds) of how late the alarm fired, and then the same for
+    // how late each note was written, as five 7-bit bytes each.
+    SYSEX_ARPEGGIATOR_QUERY = 0x13,
+
+    // Save the settings (see settings.h) at the end of this pass, rather than
+    // once they've settled, even with Launchpads on the host port (which may
+    // miss a few frames while the flash is written). Changes made with
+    // something on the host port are otherwise only saved once it's gone.
+    //
+    // F0h 7Dh 14h F7h
+    SYSEX_SAVE_SETTINGS = 0x14
+};
+
+void process_sysex_command(struct board_state*, const uint8_t*, uint8_t);
+
+// Carry on with anything that takes more than one message, i.e. a capture
+// dump, and answer any query whose reply didn't fit in the pass it came in.
+// Called once per pass of the main loop.
+void sysex_commands_task(struct board_state*);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _SYSEX_COMMANDS_H_ */
@@ -0,0 +1,514 @@
+#include <stdint.h>
+#include <string.h>
+#include "boot_timeline.h"
+#include "capture.h"
+#include "client_packets.h"
+#include "settings.h"
+#include "stress.h"
+#include "sysex_commands.h"
+#include "tonnetz.h"
+#include "tusb.h"
+
+void midi_client_task(struct board_state *board_state) {
+  while (tud_midi_available()) {
+    uint8_t incoming_packet[4];
+    tud_midi_packet_read(incoming_packet);
+
+    uint32_t now_us = latency_now_us();
+    latency_mark_input(&board_state->latency, now_us, now_us);
+
+    capture_add(now_us, CAPTURE_CLIENT_PACKET, 0, incoming_packet);
+
+    // In loopback mode, everything but sysex (so that loopback can be turned
+    // off again) on the "notes" cable goes straight back out.
+    uint8_t cin = incoming_packet[0] & 0x0F;
+    if (board_state->latency.loopback && (incoming_packet[0] >> 4) == 3 && (cin < MIDI_CIN_SYSEX_START || cin > MIDI_CIN_SYSEX_END_3BYTE)) {
+      client_packets_write(incoming_packet);
+      continue;
+    }
+
+    process_incoming_client_packet(incoming_packet, board_state);
+  }
+}
+
+// Apply whatever core1 has seen on the host port since the last pass. We
+// only take what was already waiting when we started, so that a flood of
+// incoming packets can't hold up the rest of the loop.
+void host_event_task(struct board_state *board_state, struct host_event_queue *host_events) {
+  uint32_t waiting = host_event_queue_depth(host_events);
+
+  struct host_event event;
+  while (waiting-- && host_event_queue_pop(host_events, &event)) {
+    if (event.idx >= MAX_HOST_LAUNCHPADS) {
+      continue;
+    }
+
+    switch (event.type) {
+      case HOST_EVENT_PACKET: {
+        uint32_t now_us = latency_now_us();
+        latency_record(&board_state->latency, LATENCY_HOST_QUEUE, now_us - event.timestamp_us);
+        latency_mark_input(&board_state->latency, event.timestamp_us, now_us);
+
+        capture_add(event.timestamp_us, CAPTURE_HOST_PACKET, event.idx, event.packet);
+
+        process_incoming_host_packet(event.packet, board_state, event.idx);
+        break;
+      }
+      case HOST_EVENT_MOUNT: {
+        uint8_t version_packet[4] = { event.launchpad_version };
+        capture_add(latency_now_us(), CAPTURE_HOST_MOUNT, event.idx, version_packet);
+
+        boot_timeline_restart(BOOT_HOST_MOUNTED);
+        boot_timeline_restart(BOOT_HOST_PAINTED);
+        boot_timeline_mark(BOOT_HOST_MOUNTED);
+
+        board_state->host_by_idx[event.idx].launchpad_version = event.launchpad_version;
+
+        // Put a newly connected Launchpad in programmer mode, and paint
+        // everything. Its offset is left alone, so that a Launchpad that's
+        // unplugged and plugged back in picks up where it left off.
+        initialise_host_launchpad(board_state, event.idx);
+        break;
+      }
+      case HOST_EVENT_UNMOUNT: {
+        uint8_t empty_packet[4] = { 0 };
+        capture_add(latency_now_us(), CAPTURE_HOST_UNMOUNT, event.idx, empty_packet);
+
+        board_state->host_by_idx[event.idx].launchpad_version = UNkNOWN;
+
+        // Nothing is going to release its pads (or its sustain button) now.
+        release_held_pads(board_state, &board_state->host_by_idx[event.idx].pad_holds);
+        set_sustain_pedal(board_state, SUSTAIN_SOURCE_HOST(event.idx), false);
+        break;
+      }
+      default:
+        break;
+    }
+  }
+}
+
+// Paint everything that's changed straight away, i.e. without waiting for the
+// next frame (see paint_scheduler.c).
+void repaint_launchpads(struct board_state *board_state) {
+  if (board_state->is_dirty) {
+    paint_client_launchpads(board_state);
+
+    paint_host_launchpads(board_state);
+
+    memset(board_state->repaint_notes, 0, sizeof(board_state->repaint_notes));
+    board_state->is_dirty = false;
+  }
+}
+
+static bool write_channel_packet(uint8_t cin, uint8_t channel, uint8_t data1, uint8_t data2) {
+  // This should use cable 3.
+  uint8_t packet[4] = {
+    (3 << 4) | cin, (cin << 4) | channel, data1, data2
+  };
+
+  return client_packets_write(packet);
+}
+
+static uint32_t client_packets_space(void) {
+  return CLIENT_PACKETS_SIZE - client_packets_depth();
+}
+
+// The MPE Configuration Message, i.e. RPN 6 on the manager channel, with the
+// number of member channels (zero turns the zone off).
+static void write_mpe_configuration(const struct mpe_config *config, uint8_t member_count) {
+  uint8_t manager = mpe_manager_channel(config);
+
+  write_channel_packet(MIDI_CIN_CONTROL_CHANGE, manager, 101, 0);
+  write_channel_packet(MIDI_CIN_CONTROL_CHANGE, manager, 100, 6);
+  write_channel_packet(MIDI_CIN_CONTROL_CHANGE, manager, 6, member_count);
+}
+
+// Flag every held note, so that sync_playing_notes starts it again. This only
+// happens when the configuration changes, so it's the one place we look at
+// every note. While arpeggiating, the arpeggiator starts the notes itself.
+static void restart_held_notes(struct board_state *board_state) {
+  if (arpeggiator_is_active(&board_state->arpeggiator)) {
+    return;
+  }
+
+  for (int note = 0; note < 128; note++) {
+    if (board_state->held_note_velocities[note]) {
+      board_state->pending_notes[note >> 5] |= 1u << (note & 31);
+    }
+  }
+}
+
+// Switch to a new output mode or MPE zone (see mpe.h). Everything playing is
+// stopped with "all notes off" on every channel we were using, and every held
+// note is flagged so that it starts again with the new configuration. Returns
+// false if there isn't room for all of that in the batch yet.
+static bool reconfigure_output(struct board_state *board_state) {
+  struct mpe_output *mpe = &board_state->mpe;
+
+  // All notes off for at most sixteen channels, and turning one zone off and
+  // another on.
+  if (client_packets_space() < 16 + 3 + 3) {
+    return false;
+  }
+
+  if (mpe->active.mode == OUTPUT_MPE) {
+    for (uint8_t voice = 0; voice < mpe->allocator.member_count; voice++) {
+      write_channel_packet(MIDI_CIN_CONTROL_CHANGE, mpe->allocator.channel_for_voice[voice], 123, 0);
+    }
+
+    write_channel_packet(MIDI_CIN_CONTROL_CHANGE, mpe_manager_channel(&mpe->active), 123, 0);
+    write_mpe_configuration(&mpe->active, 0);
+  }
+  else {
+    write_channel_packet(MIDI_CIN_CONTROL_CHANGE, 0, 123, 0);
+  }
+
+  mpe_apply_config(mpe);
+
+  if (mpe->active.mode == OUTPUT_MPE) {
+    write_mpe_configuration(&mpe->active, mpe->active.member_count);
+  }
+
+  memset(board_state->playing_note_velocities, 0, sizeof(board_state->playing_note_velocities));
+  board_state->arpeggiator.playing_note = ARP_NO_NOTE;
+
+  restart_held_notes(board_state);
+
+  return true;
+}
+
+static bool write_note_on(struct board_state *board_state, uint8_t note, uint8_t velocity) {
+  if (board_state->mpe.active.mode != OUTPUT_MPE) {
+    return write_channel_packet(MIDI_CIN_NOTE_ON, 0, note, velocity);
+  }
+
+  // Leave room for stopping a stolen note, so that the two go together.
+  if (client_packets_space() < 2) {
+    return false;
+  }
+
+  uint8_t stolen_note;
+  uint8_t channel = mpe_allocate(&board_state->mpe.allocator, note, &stolen_note);
+
+  if (stolen_note != MPE_NO_VOICE) {
+    write_channel_packet(MIDI_CIN_NOTE_OFF, channel, stolen_note, 0);
+  }
+
+  return write_channel_packet(MIDI_CIN_NOTE_ON, channel, note, velocity);
+}
+
+static bool write_note_off(struct board_state *board_state, uint8_t note) {
+  if (board_state->mpe.active.mode != OUTPUT_MPE) {
+    return write_channel_packet(MIDI_CIN_NOTE_OFF, 0, note, 0);
+  }
+
+  // A note that lost its channel has already been stopped.
+  uint8_t channel = mpe_channel_for_note(&board_state->mpe.allocator, note);
+  if (channel == MPE_NO_VOICE) {
+    return true;
+  }
+
+  if (!write_channel_packet(MIDI_CIN_NOTE_OFF, channel, note, 0)) {
+    return false;
+  }
+
+  mpe_release(&board_state->mpe.allocator, note);
+  return true;
+}
+
+// Poly aftertouch on a single channel, or channel pressure on the note's own
+// channel with MPE.
+static bool write_pressure(struct board_state *board_state, uint8_t note, uint8_t pressure) {
+  if (board_state->mpe.active.mode != OUTPUT_MPE) {
+    return write_channel_packet(MIDI_CIN_POLY_KEYPRESS, 0, note, pressure);
+  }
+
+  uint8_t channel = mpe_channel_for_note(&board_state->mpe.allocator, note);
+  if (channel == MPE_NO_VOICE) {
+    return true;
+  }
+
+  return write_channel_packet(MIDI_CIN_CHANNEL_PRESSURE, channel, pressure, 0);
+}
+
+// Only the notes flagged in pending_notes are looked at, so a pass where
+// nothing has changed costs four word reads (and with MPE, finding a note's
+// channel is a lookup, see mpe.h). Note ons and offs are sent
+// first, so that they never wait behind aftertouch for room in the batch, and
+// pressure changes are then thinned out by the aftertouch coalescer (see
+// aftertouch.h). Anything that doesn't fit (or isn't due yet) stays flagged
+// for a later pass.
+void sync_playing_notes(struct board_state *board_state) {
+  uint32_t now_us = latency_now_us();
+
+  if (board_state->mpe.reconfigure_pending && !reconfigure_output(board_state)) {
+    return;
+  }
+
+  for (int word = 0; word < 4; word++) {
+    uint32_t pending_bits = board_state->pending_notes[word];
+
+    while (pending_bits) {
+      int bit = __builtin_ctz(pending_bits);
+      pending_bits &= pending_bits - 1;
+
+      uint8_t a = (word << 5) + bit;
+
+      uint8_t held_velocity = board_state->held_note_velocities[a];
+      uint8_t playing_velocity = board_state->playing_note_velocities[a];
+
+      // Pressure changes are left for the second pass.
+      if (playing_velocity && held_velocity && playing_velocity != held_velocity) {
+        continue;
+      }
+
+      // Nothing to send, i.e. the note changed and then changed back.
+      if (playing_velocity == held_velocity) {
+        board_state->pending_notes[word] &= ~(1u << bit);
+        continue;
+      }
+
+      bool sent = held_velocity
+        ? write_note_on(board_state, a, held_velocity)
+        : write_note_off(board_state, a);
+
+      // The batch is full, so there's no point trying anything else.
+      if (!sent) {
+        return;
+      }
+
+      board_state->playing_note_velocities[a] = held_velocity;
+      board_state->pending_notes[word] &= ~(1u << bit);
+      if (held_velocity) {
+        boot_timeline_mark(BOOT_FIRST_NOTE);
+      }
+      aftertouch_mark_sent(&board_state->aftertouch, a, now_us);
+
+      latency_record(&board_state->latency, LATENCY_NOTE_OUT, now_us - board_state->latency.note_decoded_us[a]);
+      latency_record(&board_state->latency, LATENCY_TOTAL, now_us - board_state->latency.note_input_us[a]);
+    }
+  }
+
+  // Everything still flagged is a pressure change for a note that's playing.
+  for (int word = 0; word < 4; word++) {
+    uint32_t pending_bits = board_state->pending_notes[word];
+
+    while (pending_bits) {
+      int bit = __builtin_ctz(pending_bits);
+      pending_bits &= pending_bits - 1;
+
+      uint8_t a = (word << 5) + bit;
+      uint8_t held_velocity = board_state->held_note_velocities[a];
+
+      switch (aftertouch_check(&board_state->aftertouch, a, board_state->playing_note_velocities[a], held_velocity, now_us)) {
+        case AFTERTOUCH_DROP:
+          board_state->pending_notes[word] &= ~(1u << bit);
+          board_state->aftertouch.dropped++;
+          break;
+        case AFTERTOUCH_SEND:
+          if (!write_pressure(board_state, a, held_velocity)) {
+            return;
+          }
+
+          board_state->playing_note_velocities[a] = held_velocity;
+          board_state->pending_notes[word] &= ~(1u << bit);
+          aftertouch_mark_sent(&board_state->aftertouch, a, now_us);
+          board_state->aftertouch.sent++;
+          break;
+        default:
+          break;
+      }
+    }
+  }
+}
+
+// Stop the note the arpeggiator is playing, if there is one.
+static bool stop_arpeggiated_note(struct board_state *board_state) {
+  struct arpeggiator *arpeggiator = &board_state->arpeggiator;
+
+  if (arpeggiator->playing_note == ARP_NO_NOTE) {
+    return true;
+  }
+
+  if (!write_note_off(board_state, arpeggiator->playing_note)) {
+    return false;
+  }
+
+  board_state->playing_note_velocities[arpeggiator->playing_note] = 0;
+  arpeggiator->playing_note = ARP_NO_NOTE;
+  return true;
+}
+
+// Switch the arpeggiator to its requested config. Turning it on stops
+// everything that's playing, as it takes over from there, and turning it off
+// starts the held notes again. Returns false if there isn't room for the note
+// offs in the batch yet, in which case the next pass carries on from where
+// this one got to.
+static bool reconfigure_arpeggiator(struct board_state *board_state) {
+  struct arpeggiator *arpeggiator = &board_state->arpeggiator;
+
+  if (!stop_arpeggiated_note(board_state)) {
+    return false;
+  }
+
+  if (!arpeggiator_is_active(arpeggiator) && arpeggiator->requested.mode != ARP_OFF) {
+    for (int note = 0; note < 128; note++) {
+      if (board_state->playing_note_velocities[note]) {
+        if (!write_note_off(board_state, note)) {
+          return false;
+        }
+
+        board_state->playing_note_velocities[note] = 0;
+      }
+    }
+
+    memset(board_state->pending_notes, 0, sizeof(board_state->pending_notes));
+  }
+
+  arpeggiator_apply_config(arpeggiator);
+  restart_held_notes(board_state);
+
+  return true;
+}
+
+// Send whatever the arpeggiator's alarm says is due (see arpeggiator.h). The
+// alarm keeps the time, so all this has to do is keep up.
+static void arpeggiate(struct board_state *board_state) {
+  struct arpeggiator *arpeggiator = &board_state->arpeggiator;
+
+  if (arpeggiator->reconfigure_pending && !reconfigure_arpeggiator(board_state)) {
+    return;
+  }
+
+  if (!arpeggiator_is_active(arpeggiator)) {
+    return;
+  }
+
+  // Start on the first note pressed, rather than waiting for a step.
+  if (!arpeggiator->is_running) {
+    if (!arpeggiator->note_count) {
+      return;
+    }
+
+    arpeggiator_start(arpeggiator, latency_now_us());
+  }
+
+  uint32_t state;
+  uint32_t step_due_us;
+  arpeggiator_read_alarm(arpeggiator, &state, &step_due_us);
+
+  uint32_t steps = state >> 1;
+  bool is_gate_open = state & 1;
+
+  if (steps != arpeggiator->steps_taken) {
+    // Stopping the last note and starting the next (which with MPE might
+    // also stop a stolen note) go together.
+    if (client_packets_space() < 3) {
+      return;
+    }
+
+    stop_arpeggiated_note(board_state);
+
+    // Steps that went by before we got here are skipped, including this one
+    // if its gate has already closed.
+    arpeggiator->missed_steps += steps - arpeggiator->steps_taken - (is_gate_open ? 1 : 0);
+    arpeggiator->steps_taken = steps;
+
+    uint8_t base_note = ARP_NO_NOTE;
+    uint8_t note = is_gate_open ? arpeggiator_next_note(arpeggiator, &base_note) : ARP_NO_NOTE;
+
+    if (note != ARP_NO_NOTE) {
+      uint8_t velocity = board_state->held_note_velocities[base_note];
+
+      write_note_on(board_state, note, velocity);
+      board_state->playing_note_velocities[note] = velocity;
+      arpeggiator->playing_note = note;
+
+      int32_t late_us = latency_now_us() - step_due_us;
+      latency_histogram_add(&arpeggiator->note_lateness, late_us > 0 ? late_us : 0);
+      arpeggiator->steps++;
+
+      boot_timeline_mark(BOOT_FIRST_NOTE);
+    }
+  }
+  else if (!is_gate_open && !stop_arpeggiated_note(board_state)) {
+    return;
+  }
+
+  // Once nothing is sounding, the alarm waits for the next note.
+  if (!arpeggiator->note_count && arpeggiator->playing_note == ARP_NO_NOTE) {
+    arpeggiator_stop(arpeggiator);
+  }
+}
+
+// Send the chord on (see chords.h) once it's changed, if anyone wants it.
+static void report_chord(struct chord_tracker *chords) {
+  if (!chords->changed) {
+    return;
+  }
+
+  if (chords->output == CHORD_OUTPUT_SYSEX) {
+    uint8_t report[] = {
+      0xF0, SYSEX_MANUFACTURER_ID, SYSEX_CHORDS, chords->chord.quality, chords->chord.root, chords->chord.inversion, 0xF7
+    };
+
+    // Wait until the whole message fits in this pass's batch.
+    if (client_packets_space() < (sizeof(report) + 2) / 3) {
+      return;
+    }
+
+    client_packets_stream_write(3, report, sizeof(report));
+  }
+  else if (chords->output == CHORD_OUTPUT_CC) {
+    if (client_packets_space() < 3) {
+      return;
+    }
+
+    // The quality goes last, so that anything acting on it already has the
+    // rest.
+    write_channel_packet(MIDI_CIN_CONTROL_CHANGE, chords->cc_channel, CHORD_CC_ROOT, chords->chord.root);
+    write_channel_packet(MIDI_CIN_CONTROL_CHANGE, chords->cc_channel, CHORD_CC_INVERSION, chords->chord.inversion);
+    write_channel_packet(MIDI_CIN_CONTROL_CHANGE, chords->cc_channel, CHORD_CC_QUALITY, chords->chord.quality);
+  }
+
+  chords->changed = false;
+}
+
+// Everything the main loop does after tud_task(), i.e. read what's come in
+// (from both ports), send any note changes, and repaint if a frame is due.
+// Notes go first, so that they never wait behind a repaint.
+void tonnetz_task(struct board_state *board_state, struct host_event_queue *host_events, struct paint_scheduler *paint_scheduler, uint64_t now_us) {
+  // The self-test's load (if it's running) arrives along with everything
+  // else.
+  stress_self_test_task(board_state, latency_now_us());
+
+  midi_client_task(board_state);
+
+  host_event_task(board_state, host_events);
+
+  // Before sync_playing_notes, so that switching the arpeggiator off starts
+  // the held notes again in the same pass.
+  arpeggiate(board_state);
+
+  sync_playing_notes(board_state);
+
+  report_chord(&board_state->chords);
+
+  flush_outbound_queues(board_state);
+
+  paint_scheduler_task(paint_scheduler, board_state, now_us);
+
+  sysex_commands_task(board_state);
+
+  // Again, so that a step that fell due while we were painting still goes
+  // out with this pass's batch.
+  arpeggiate(board_state);
+
+  // Everything for the client port goes out together, a full endpoint at a
+  // time.
+  client_packets_flush();
+
+  // Last, so that a save (which pauses the USB host for a page write) never
+  // holds up anything from this pass.
+  settings_task(board_state, now_us);
+}
@@ -0,0 +1,29 @@
+#ifndef _TONNETZ_H_
+#define _TONNETZ_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "launchpad.h"
+#include "host_events.h"
+#include "paint_scheduler.h"
+
+// The work done on each pass through the main loop, split out from main() so
+// that it can also be built and benchmarked on a Linux host.
+
+void midi_client_task(struct board_state*);
+
+void host_event_task(struct board_state*, struct host_event_queue*);
+
+void repaint_launchpads(struct board_state*);
+
+void sync_playing_notes(struct board_state*);
+
+void tonnetz_task(struct board_state*, struct host_event_queue*, struct paint_scheduler*, uint64_t);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _TONNETZ_H_ */
@@ -0,0 +1,137 @@
+#include <string.h>
+#include "velocity_curves.h"
+
+static uint8_t integer_sqrt(uint32_t value) {
+  uint32_t root = 0;
+  while ((root + 1) * (root + 1) <= value) {
+    root++;
+  }
+
+  return root;
+}
+
+// Any press has to stay a press, i.e. only zero maps to zero.
+static uint8_t clamp_velocity(uint32_t velocity) {
+  if (velocity < 1) {
+    return 1;
+  }
+
+  return velocity > 127 ? 127 : velocity;
+}
+
+static void build_table(struct velocity_curves *curves, uint8_t family) {
+  uint8_t *table = curves->table_by_family[family];
+
+  table[0] = 0;
+  for (uint32_t velocity = 1; velocity < 128; velocity++) {
+    switch (curves->curve_by_family[family]) {
+      case VELOCITY_CURVE_SOFT:
+        table[velocity] = clamp_velocity(integer_sqrt(velocity * 127));
+        break;
+      case VELOCITY_CURVE_HARD:
+        table[velocity] = clamp_velocity(((velocity * velocity) + 126) / 127);
+        break;
+      case VELOCITY_CURVE_FIXED:
+        table[velocity] = clamp_velocity(curves->fixed_velocity);
+        break;
+      case VELOCITY_CURVE_CUSTOM:
+        table[velocity] = curves->custom_table[velocity];
+        break;
+      default:
+        table[velocity] = velocity;
+        break;
+    }
+  }
+}
+
+// Only the families using `curve` need to change.
+static void rebuild_tables_using(struct velocity_curves *curves, enum VelocityCurve curve) {
+  for (int family = 0; family < VELOCITY_CURVE_FAMILIES; family++) {
+    if (curves->curve_by_family[family] == curve) {
+      build_table(curves, family);
+    }
+  }
+}
+
+void velocity_curves_init(struct velocity_curves *curves) {
+  memset(curves, 0, sizeof(*curves));
+
+  curves->fixed_velocity = DEFAULT_FIXED_VELOCITY;
+
+  for (int velocity = 0; velocity < 128; velocity++) {
+    curves->custom_table[velocity] = velocity;
+  }
+
+  rebuild_tables_using(curves, VELOCITY_CURVE_LINEAR);
+}
+
+void velocity_curves_select(struct velocity_curves *curves, uint8_t family, enum VelocityCurve curve) {
+  if (family >= VELOCITY_CURVE_FAMILIES || curve >= VELOCITY_CURVE_COUNT) {
+    return;
+  }
+
+  curves->curve_by_family[family] = curve;
+  build_table(curves, family);
+}
+
+enum VelocityCurve velocity_curves_cycle(struct velocity_curves *curves, uint8_t family) {
+  if (family >= VELOCITY_CURVE_FAMILIES) {
+    return VELOCITY_CURVE_LINEAR;
+  }
+
+  enum VelocityCurve curve = (curves->curve_by_family[family] + 1) % VELOCITY_CURVE_COUNT;
+  velocity_curves_select(curves, family, curve);
+  return curve;
+}
+
+void velocity_curves_set_fixed(struct velocity_curves *curves, uint8_t velocity) {
+  curves->fixed_velocity = clamp_velocity(velocity & 0x7F);
+  rebuild_tables_using(curves, VELOCITY_CURVE_FIXED);
+}
+
+void velocity_curves_set_custom(struct velocity_curves *curves, const uint8_t *points, uint8_t point_count) {
+  uint8_t *table = curves->custom_table;
+
+  if (point_count > VELOCITY_CUSTOM_MAX_POINTS) {
+    point_count = VELOCITY_CUSTOM_MAX_POINTS;
+  }
+
+  // With no points, there may not be anything to copy from at all.
+  if (point_count) {
+    memmove(curves->custom_points, points, point_count * 2);
+  }
+  curves->custom_point_count = point_count;
+
+  table[0] = 0;
+  for (int velocity = 1; velocity < 128; velocity++) {
+    if (point_count == 0) {
+      table[velocity] = velocity;
+      continue;
+    }
+
+    // Find the first point at or above this velocity.
+    int next = 0;
+    while (next < point_count && (points[next * 2] & 0x7F) < velocity) {
+      next++;
+    }
+
+    if (next == 0) {
+      table[velocity] = clamp_velocity(points[1] & 0x7F);
+    }
+    else if (next == point_count) {
+      table[velocity] = clamp_velocity(points[(point_count * 2) - 1] & 0x7F);
+    }
+    else {
+      int in_low = points[(next - 1) * 2] & 0x7F;
+      int out_low = points[((next - 1) * 2) + 1] & 0x7F;
+      int in_high = points[next * 2] & 0x7F;
+      int out_high = points[(next * 2) + 1] & 0x7F;
+
+      // in_high is at or above velocity, which is above in_low, so this is
+      // never a division by zero.
+      table[velocity] = clamp_velocity(out_low + (((out_high - out_low) * (velocity - in_low)) / (in_high - in_low)));
+    }
+  }
+
+  rebuild_tables_using(curves, VELOCITY_CURVE_CUSTOM);
+}
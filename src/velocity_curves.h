@@ -0,0 +1,80 @@
+#ifndef _VELOCITY_CURVES_H_
+#define _VELOCITY_CURVES_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+// Every pad velocity is passed through a 128 entry lookup table for the
+// Launchpad family it came from, so that each family can have its own
+// response. The tables are only rebuilt when a curve is changed, so decoding
+// a pad costs a single lookup whichever curve is selected.
+
+enum VelocityCurve {
+    // What the Launchpad sends.
+    VELOCITY_CURVE_LINEAR,
+
+    // Boosts gentle presses, for Launchpads that need a heavy touch.
+    VELOCITY_CURVE_SOFT,
+
+    // The opposite, for Launchpads that are too easy to hit hard.
+    VELOCITY_CURVE_HARD,
+
+    // The same velocity for every press.
+    VELOCITY_CURVE_FIXED,
+
+    // Interpolated from breakpoints sent over sysex (see sysex_commands.h).
+    VELOCITY_CURVE_CUSTOM,
+
+    VELOCITY_CURVE_COUNT
+};
+
+// One per LaunchpadVersion (the first, UNkNOWN, is never used).
+#define VELOCITY_CURVE_FAMILIES 4
+
+#define DEFAULT_FIXED_VELOCITY 100
+
+// The most (input, output) pairs a custom curve can have.
+#define VELOCITY_CUSTOM_MAX_POINTS 14
+
+struct velocity_curves {
+    uint8_t curve_by_family[VELOCITY_CURVE_FAMILIES];
+
+    // What each family's pads are decoded with, indexed by the velocity the
+    // Launchpad sends. Zero always maps to zero, i.e. a release.
+    uint8_t table_by_family[VELOCITY_CURVE_FAMILIES][128];
+
+    uint8_t fixed_velocity;
+    uint8_t custom_table[128];
+
+    // What the custom table was built from, so that it can be saved (see
+    // settings.h).
+    uint8_t custom_points[VELOCITY_CUSTOM_MAX_POINTS * 2];
+    uint8_t custom_point_count;
+};
+
+// Everything starts with the linear curve.
+void velocity_curves_init(struct velocity_curves*);
+
+// Select a curve for a family.
+void velocity_curves_select(struct velocity_curves*, uint8_t, enum VelocityCurve);
+
+// Move a family on to the next curve, and return it.
+enum VelocityCurve velocity_curves_cycle(struct velocity_curves*, uint8_t);
+
+// Change the velocity used by VELOCITY_CURVE_FIXED.
+void velocity_curves_set_fixed(struct velocity_curves*, uint8_t);
+
+// Build the custom curve from (input, output) breakpoints, i.e. 2 bytes per
+// point, sorted by input. Inputs between two points are interpolated, and
+// anything before the first point (or after the last) uses that point's
+// output. With no points, the custom curve is linear.
+void velocity_curves_set_custom(struct velocity_curves*, const uint8_t*, uint8_t);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _VELOCITY_CURVES_H_ */